@@ -1,5 +1,9 @@
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 
 /* The logic here for 'Z' and 'B' macros as well as there use within
@@ -39,6 +43,8 @@
 #define B 
 #endif /* ] AS_SILO_BUILTIN */
 
+#include "H5Zzfp_direct.h"
+#include "H5Zzfp_direct_private.h"
 #include "H5Zzfp_plugin.h"
 #include "H5Zzfp_props_private.h"
 
@@ -69,6 +75,17 @@ do                                                    \
     goto done;                                        \
 } while(0)
 
+/* As H5Z_ZFP_PUSH_AND_GOTO, but pushing MSG only if PUSH */
+#define H5Z_ZFP_PUSH_IF_AND_GOTO(PUSH, MAJ, MIN, RET, MSG) \
+do                                                    \
+{                                                     \
+    if (PUSH)                                         \
+        H5Epush(H5E_DEFAULT,__FILE__,_funcname_,__LINE__, \
+            H5Z_ZFP_ERRCLASS,MAJ,MIN,MSG);            \
+    retval = RET;                                     \
+    goto done;                                        \
+} while(0)
+
 static size_t H5Z_filter_zfp   (unsigned int flags, size_t cd_nelmts, const unsigned int cd_values[],
                                 size_t nbytes, size_t *buf_size, void **buf);
 static htri_t H5Z_zfp_can_apply(hid_t dcpl_id, hid_t type_id, hid_t space_id);
@@ -93,400 +110,3495 @@ const H5Z_class2_t H5Z_ZFP[1] = {{
 #ifdef H5Z_ZFP_AS_LIB
 int H5Z_zfp_initialize(void)
 {
-    if (H5Zfilter_avail(H5Z_FILTER_ZFP))
-        return 1;
-    return H5Zregister(H5Z_ZFP)<0?-1:1;
+    /* H5Zfilter_avail opens the HDF5 library, which H5Z_zfp_init needs */
+    if (!H5Zfilter_avail(H5Z_FILTER_ZFP) && H5Zregister(H5Z_ZFP)<0)
+        return -1;
+    H5Z_zfp_init();
+    return 1;
 }
 #else
 H5PL_type_t H5PLget_plugin_type(void) {return H5PL_TYPE_FILTER;}
 const void *H5PLget_plugin_info(void) {return H5Z_ZFP;}
 #endif
 
-static hid_t H5Z_ZFP_ERRCLASS = -1;
-#ifndef H5Z_ZFP_AS_LIB
-static
-#endif
-int H5Z_zfp_finalize(void)
-{
-    herr_t ret1, ret2;
-    if (H5Z_ZFP_ERRCLASS != -1 && H5Z_ZFP_ERRCLASS != H5E_ERR_CLS_g)
-        ret1 = H5Eunregister_class(H5Z_ZFP_ERRCLASS);
-    H5Z_ZFP_ERRCLASS = -1;
-    ret2 = H5Zunregister(H5Z_FILTER_ZFP);
-    if (ret1 < 0 || ret2 < 0) return -1;
-    return 1;
-}
+/* The filter's error class. While it is -1, H5Z_zfp_init registers it, under
+   h5z_zfp_init_mutex. H5Z_zfp_finalize unregisters it. */
+static volatile hid_t H5Z_ZFP_ERRCLASS = -1;
+static pthread_mutex_t h5z_zfp_init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static void H5Z_zfp_final(void)
+/* The H5Z_ZFP_* environment variables are read exactly once per process, by
+   h5z_zfp_env_init, the first time one of the filter's entry points needs them.
+   Settings taken from them hold -1 until then. */
+static pthread_once_t h5z_zfp_env_once = PTHREAD_ONCE_INIT;
+static void h5z_zfp_env_init(void);
+
+static void
+h5z_zfp_env(void)
 {
-    H5Z_zfp_finalize();
+    pthread_once(&h5z_zfp_env_once, h5z_zfp_env_init);
 }
 
-static void H5Z_zfp_init(void)
+/* H5Tget_order(H5T_NATIVE_UINT), without calling into HDF5 */
+static H5T_order_t
+h5z_zfp_native_order(void)
 {
-    /* Register the error class */
-    if (H5Z_ZFP_ERRCLASS == -1)
-    {
-        if (H5Eget_class_name(H5E_ERR_CLS_g,0,0) < 0)
-        {
-            H5Z_ZFP_ERRCLASS = H5Eregister_class("H5Z-ZFP", "ZFP-" ZFP_VERSION_STR,
-                                                 "H5Z-ZFP-" H5Z_FILTER_ZFP_VERSION_STR);
-#if !defined(H5Z_ZFP_AS_LIB) && !defined(NDEBUG)
-            /* helps to eliminate resource leak for memory analysis */
-            atexit(H5Z_zfp_final);
-#endif
-        }
-        else
-        {
-            H5Z_ZFP_ERRCLASS = H5E_ERR_CLS_g;
-        }
-    }
+    unsigned int const one = 1;
+    return *(unsigned char const *) &one ? H5T_ORDER_LE : H5T_ORDER_BE;
 }
 
-static htri_t
-H5Z_zfp_can_apply(hid_t dcpl_id, hid_t type_id, hid_t chunk_space_id)
-{   
-    static char const *_funcname_ = "H5Z_zfp_can_apply";
-    int ndims, ndims_used = 0;
-    size_t i, dsize;
-    htri_t retval = 0;
-    hsize_t dims[H5S_MAX_RANK];
-    H5T_class_t dclass;
-    hid_t native_type_id;
+/* Everything the filter needs, beyond cd_values, to (de)compress a chunk */
+typedef struct _h5z_zfp_info_t {
+    uint64 zfp_mode;
+    uint64 zfp_meta;
+    H5T_order_t swap;
+    unsigned int precond; /* H5Z_ZFP_PRECOND_* flags from cd_values */
+    unsigned int cstats;  /* H5Z_ZFP_CSTATS_* flags from cd_values */
+    unsigned int target;  /* H5Z_ZFP_TARGET_* flags from cd_values */
+    h5z_zfp_execution_t exec; /* writer's execution policy from cd_values, serial if none */
+} h5z_zfp_info_t;
 
-    H5Z_zfp_init();
+/* Pre-conditioning and chunk statistics flags are recorded in cd_values words after
+   the ZFP header, tagged in their upper half. The low half of cd_values[0] is the
+   cd_values format, not the filter's version. Only datasets using one of these get
+   the newer format stamped there, the oldest able to read them. Others get 0x0080,
+   what filter version 0.8.0 writes, so older versions can still read them. */
+#define H5Z_ZFP_PRECOND_TAG        0x50430000 /* "PC" */
+#define H5Z_ZFP_CSTATS_TAG         0x53540000 /* "ST" */
+#define H5Z_ZFP_CD_VERSION_BASE    0x0080
+#define H5Z_ZFP_CD_VERSION_PRECOND 0x0090
+#define H5Z_ZFP_CD_VERSION_CSTATS  0x0100
 
-    /* Disable the ZFP filter entirely if it looks like the ZFP library
-       hasn't been compiled for 8-bit stream word size */
-    if (B (int) stream_word_bits != 8)
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTINIT, -1,
-            "ZFP lib not compiled with -DBIT_STREAM_WORD_TYPE=uint8");
+/* Compact cd_values layout (H5Pset_zfp_compact_header), format 0x0110. In place of
+   ZFP's own header, a marker word, tagged in its upper half, holding ZFP's codec
+   and the writer's byte order, followed by the ZFP mode and meta words, low half
+   first. Like all cd_values, HDF5 stores them as integers, so there is no header
+   to parse and nothing to byte-swap. Any tagged words follow at index 6. */
+#define H5Z_ZFP_COMPACT_TAG        0x5a430000 /* "ZC" */
+#define H5Z_ZFP_COMPACT_LE         0x01
+#define H5Z_ZFP_COMPACT_BE         0x02
+#define H5Z_ZFP_CD_VERSION_COMPACT 0x0110
+#define H5Z_ZFP_CD_NELMTS_COMPACT  6
 
-    /* get datatype class, size and space dimensions */
-    if (H5T_NO_CLASS == (dclass = H5Tget_class(type_id)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, -1, "bad datatype class");
+/* Execution policy (H5Pset_zfp_execution), format 0x0120, recorded only if not
+   serial. A tagged word holding the policy in its low 4 bits and nthreads in the
+   12 above them and, if chunk_blocks is not 0, another holding chunk_blocks. These
+   don't change what chunks hold, only how they are (de)compressed. */
+#define H5Z_ZFP_EXEC_TAG           0x45580000 /* "EX" */
+#define H5Z_ZFP_EXEC_BLOCKS_TAG    0x45420000 /* "EB" */
+#define H5Z_ZFP_CD_VERSION_EXEC    0x0120
 
-    if (0 == (dsize = H5Tget_size(type_id)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, -1, "bad datatype size");
+/* Target mode with both a ratio and an error, format 0x0130. A tagged word marks
+   datasets whose chunks are each tuned, as they are compressed, and record the
+   tolerance chosen (see h5z_zfp_target_tune). */
+#define H5Z_ZFP_TARGET_TAG         0x54470000 /* "TG" */
+#define H5Z_ZFP_TARGET_TUNE        0x01
+#define H5Z_ZFP_CD_VERSION_TARGET  0x0130
 
-    if (0 > (ndims = H5Sget_simple_extent_dims(chunk_space_id, dims, 0)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, -1, "bad chunk data space");
+/* Newest cd_values format this code reads */
+#define H5Z_ZFP_CD_VERSION_NEWEST  H5Z_ZFP_CD_VERSION_TARGET
 
-    /* confirm ZFP library can handle this data */
-#if ZFP_VERSION_NO < 0x0051
-    if (!(dclass == H5T_FLOAT))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
-            "requires datatype class of H5T_FLOAT");
-#else
-    if (!(dclass == H5T_FLOAT || dclass == H5T_INTEGER))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
-            "requires datatype class of H5T_FLOAT or H5T_INTEGER");
-#endif
+/* Small cache of cd_values already decoded to ZFP mode/meta. Every chunk
+   of a dataset is handed the same cd_values. So, only the first chunk
+   needs to pay for decoding the ZFP header. Entries are replaced round-robin.
+   H5Z_zfp_set_local also seeds entries here. Entries hold only what cd_values
+   determine. So, losing one costs no more than decoding the header again. */
+#define H5Z_ZFP_CACHE_SIZE 32
 
-    if (!(dsize == 4 || dsize == 8))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
-            "requires datatype size of 4 or 8");
+typedef struct _h5z_zfp_cache_entry_t {
+    size_t cd_nelmts;
+    unsigned int cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    h5z_zfp_info_t info;
+} h5z_zfp_cache_entry_t;
 
-    /* check for *USED* dimensions of the chunk */
-    for (i = 0; i < ndims; i++)
+static h5z_zfp_cache_entry_t h5z_zfp_cache[H5Z_ZFP_CACHE_SIZE];
+static int h5z_zfp_cache_count = 0;
+static int h5z_zfp_cache_next = 0;
+static unsigned long long h5z_zfp_cache_hits = 0;
+static unsigned long long h5z_zfp_cache_misses = 0;
+static pthread_mutex_t h5z_zfp_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* caller must hold h5z_zfp_cache_mutex */
+static h5z_zfp_cache_entry_t *
+h5z_zfp_cache_find(size_t cd_nelmts, unsigned int const *cd_values)
+{
+    int i;
+
+    for (i = 0; i < h5z_zfp_cache_count; i++)
     {
-        if (dims[i] <= 1) continue;
-        ndims_used++;
+        h5z_zfp_cache_entry_t *e = &h5z_zfp_cache[i];
+        if (e->cd_nelmts != cd_nelmts) continue;
+        if (memcmp(e->cd_values, cd_values, cd_nelmts * sizeof(cd_values[0]))) continue;
+        return e;
     }
+    return 0;
+}
 
-    if (ndims_used == 0 || ndims_used > 3)
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
-            "chunk must have only 1-3 non-unity dimensions");
+static int
+h5z_zfp_cache_lookup(size_t cd_nelmts, unsigned int const *cd_values, h5z_zfp_info_t *info)
+{
+    h5z_zfp_cache_entry_t const *e;
 
-    /* if caller is doing "endian targetting", disallow that */
-    native_type_id = H5Tget_native_type(type_id, H5T_DIR_ASCEND);
-    if (H5Tget_order(type_id) != H5Tget_order(native_type_id))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
-            "endian targetting non-sensical in conjunction with ZFP filter");
+    if (cd_nelmts > H5Z_ZFP_CD_NELMTS_MAX)
+        return 0;
 
-    retval = 1;
+    pthread_mutex_lock(&h5z_zfp_cache_mutex);
+    if ((e = h5z_zfp_cache_find(cd_nelmts, cd_values)))
+    {
+        *info = e->info;
+        h5z_zfp_cache_hits++;
+    }
+    else
+    {
+        h5z_zfp_cache_misses++;
+    }
+    pthread_mutex_unlock(&h5z_zfp_cache_mutex);
 
-done:
+    return e != 0;
+}
 
-    return retval;
+static void
+h5z_zfp_cache_insert(size_t cd_nelmts, unsigned int const *cd_values, h5z_zfp_info_t const *info)
+{
+    h5z_zfp_cache_entry_t *e;
+
+    if (cd_nelmts > H5Z_ZFP_CD_NELMTS_MAX)
+        return;
+
+    pthread_mutex_lock(&h5z_zfp_cache_mutex);
+    if ((e = h5z_zfp_cache_find(cd_nelmts, cd_values)))
+        ; /* replace in place */
+    else if (h5z_zfp_cache_count < H5Z_ZFP_CACHE_SIZE)
+        e = &h5z_zfp_cache[h5z_zfp_cache_count++];
+    else
+    {
+        e = &h5z_zfp_cache[h5z_zfp_cache_next];
+        h5z_zfp_cache_next = (h5z_zfp_cache_next + 1) % H5Z_ZFP_CACHE_SIZE;
+    }
+    e->cd_nelmts = cd_nelmts;
+    memcpy(e->cd_values, cd_values, cd_nelmts * sizeof(cd_values[0]));
+    e->info = *info;
+    pthread_mutex_unlock(&h5z_zfp_cache_mutex);
 }
 
-static herr_t
-H5Z_zfp_set_local(hid_t dcpl_id, hid_t type_id, hid_t chunk_space_id)
-{   
-    static char const *_funcname_ = "H5Z_zfp_set_local";
-    int i, ndims, ndims_used = 0;
-    size_t dsize, hdr_bits, hdr_bytes;
-    size_t mem_cd_nelmts = H5Z_ZFP_CD_NELMTS_MEM;
-    unsigned int mem_cd_values[H5Z_ZFP_CD_NELMTS_MEM];
-    size_t hdr_cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX;
-    unsigned int hdr_cd_values[H5Z_ZFP_CD_NELMTS_MAX];
-    unsigned int flags = 0;
-    herr_t retval = 0;
-    hsize_t dims[H5S_MAX_RANK], dims_used[H5S_MAX_RANK];
-    H5T_class_t dclass;
-    zfp_type zt;
-    zfp_field *dummy_field = 0;
-    bitstream *dummy_bstr = 0;
-    zfp_stream *dummy_zstr = 0;
-    int have_zfp_controls = 0;
-    h5z_zfp_controls_t ctrls;
+static void
+h5z_zfp_cache_clear(void)
+{
+    pthread_mutex_lock(&h5z_zfp_cache_mutex);
+    h5z_zfp_cache_count = 0;
+    h5z_zfp_cache_next = 0;
+    h5z_zfp_cache_hits = 0;
+    h5z_zfp_cache_misses = 0;
+    pthread_mutex_unlock(&h5z_zfp_cache_mutex);
+}
 
-    H5Z_zfp_init();
+/* Memo of headers H5Z_zfp_set_local has already generated. The header depends
+   only on ZFP type, used chunk dims and mode parameters. So, files with many
+   datasets sharing those need to pay for building the header only once.
+   Mode parameters are kept in the H5Z_ZFP_CD_NELMTS_MEM layout of cd_values
+   regardless of whether they came from cd_values or from properties. */
+#define H5Z_ZFP_MEMO_SIZE 16
 
-    if (0 > (dclass = H5Tget_class(type_id)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a datatype");
+typedef struct _h5z_zfp_memo_entry_t {
+    zfp_type zt;
+    int ndims_used;
+    hsize_t dims_used[4];
+    unsigned int params[H5Z_ZFP_CD_NELMTS_MEM];
+    size_t hdr_cd_nelmts;
+    unsigned int hdr_cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    uint64 zfp_mode;
+    uint64 zfp_meta;
+} h5z_zfp_memo_entry_t;
 
-    if (0 == (dsize = H5Tget_size(type_id)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a datatype");
+static h5z_zfp_memo_entry_t h5z_zfp_memo[H5Z_ZFP_MEMO_SIZE];
+static int h5z_zfp_memo_count = 0;
+static int h5z_zfp_memo_next = 0;
+static unsigned long long h5z_zfp_memo_hits = 0;
+static unsigned long long h5z_zfp_memo_misses = 0;
+static pthread_mutex_t h5z_zfp_memo_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    if (0 > (ndims = H5Sget_simple_extent_dims(chunk_space_id, dims, 0)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a data space");
+/* caller must hold h5z_zfp_memo_mutex; e holds the key to find */
+static h5z_zfp_memo_entry_t *
+h5z_zfp_memo_find(h5z_zfp_memo_entry_t const *e)
+{
+    int i;
 
-    /* setup zfp data type for meta header */
-    if (dclass == H5T_FLOAT)
+    for (i = 0; i < h5z_zfp_memo_count; i++)
     {
-        zt = (dsize == 4) ? zfp_type_float : zfp_type_double;
+        h5z_zfp_memo_entry_t *m = &h5z_zfp_memo[i];
+        if (m->zt != e->zt || m->ndims_used != e->ndims_used) continue;
+        if (memcmp(m->dims_used, e->dims_used, e->ndims_used * sizeof(e->dims_used[0]))) continue;
+        if (memcmp(m->params, e->params, sizeof(e->params))) continue;
+        return m;
     }
-    else if (dclass == H5T_INTEGER)
+    return 0;
+}
+
+/* On a hit, fills in the header part of e */
+static int
+h5z_zfp_memo_lookup(h5z_zfp_memo_entry_t *e)
+{
+    h5z_zfp_memo_entry_t const *m;
+
+    pthread_mutex_lock(&h5z_zfp_memo_mutex);
+    if ((m = h5z_zfp_memo_find(e)))
     {
-        zt = (dsize == 4) ? zfp_type_int32 : zfp_type_int64;
+        *e = *m;
+        h5z_zfp_memo_hits++;
     }
     else
     {
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
-            "datatype class must be H5T_FLOAT or H5T_INTEGER");
+        h5z_zfp_memo_misses++;
     }
+    pthread_mutex_unlock(&h5z_zfp_memo_mutex);
 
-    /* computed used (e.g. non-unity) dimensions in chunk */
-    for (i = 0; i < ndims; i++)
+    return m != 0;
+}
+
+static void
+h5z_zfp_memo_insert(h5z_zfp_memo_entry_t const *e)
+{
+    h5z_zfp_memo_entry_t *m;
+
+    pthread_mutex_lock(&h5z_zfp_memo_mutex);
+    if ((m = h5z_zfp_memo_find(e)))
+        ; /* replace in place */
+    else if (h5z_zfp_memo_count < H5Z_ZFP_MEMO_SIZE)
+        m = &h5z_zfp_memo[h5z_zfp_memo_count++];
+    else
     {
-        if (dims[i] <= 1) continue;
-        dims_used[ndims_used] = dims[i];
-        ndims_used++;
+        m = &h5z_zfp_memo[h5z_zfp_memo_next];
+        h5z_zfp_memo_next = (h5z_zfp_memo_next + 1) % H5Z_ZFP_MEMO_SIZE;
     }
+    *m = *e;
+    pthread_mutex_unlock(&h5z_zfp_memo_mutex);
+}
 
-    /* set up dummy zfp field to compute meta header */
-    switch (ndims_used)
+static void
+h5z_zfp_memo_clear(void)
+{
+    pthread_mutex_lock(&h5z_zfp_memo_mutex);
+    h5z_zfp_memo_count = 0;
+    h5z_zfp_memo_next = 0;
+    h5z_zfp_memo_hits = 0;
+    h5z_zfp_memo_misses = 0;
+    pthread_mutex_unlock(&h5z_zfp_memo_mutex);
+}
+
+/* Put mode parameters, from either source, into the memo key. Returns 0
+   for an invalid mode, which set_local reports when it builds the header. */
+static int
+h5z_zfp_memo_params(int have_zfp_controls, h5z_zfp_controls_t const *ctrls,
+    size_t mem_cd_nelmts, unsigned int const *mem_cd_values, unsigned int *params)
+{
+    size_t i, n = H5Z_ZFP_CD_NELMTS_MEM;
+
+    for (i = 0; i < H5Z_ZFP_CD_NELMTS_MEM; i++)
+        params[i] = 0;
+
+    if (!have_zfp_controls)
     {
-        case 1: dummy_field = Z zfp_field_1d(0, zt, dims_used[0]); break;
-        case 2: dummy_field = Z zfp_field_2d(0, zt, dims_used[1], dims_used[0]); break;
-        case 3: dummy_field = Z zfp_field_3d(0, zt, dims_used[2], dims_used[1], dims_used[0]); break;
-        default: H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
-                     "chunks may have only 1,2 or 3 non-unity dims");
+        for (i = 0; i < mem_cd_nelmts && i < H5Z_ZFP_CD_NELMTS_MEM; i++)
+            params[i] = mem_cd_values[i];
+        params[1] = 0; /* unused in all modes */
+        return params[0] >= H5Z_ZFP_MODE_RATE && params[0] <= H5Z_ZFP_MODE_TARGET;
     }
-    if (!dummy_field)
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "zfp_field_Xd() failed");
 
-    /* get current cd_values and re-map to new cd_value set */
-    if (0 > H5Pget_filter_by_id(dcpl_id, H5Z_FILTER_ZFP, &flags, &mem_cd_nelmts, mem_cd_values, 0, NULL, NULL))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, 0, "unable to get current ZFP cd_values");
-
-    /* Handle default case when no cd_values are passed by using ZFP library defaults. */
-    if (mem_cd_nelmts == 0)
+    switch (ctrls->mode)
     {
-        /* check for filter controls in the properites */
-        if (0 < H5Pexist(dcpl_id, "zfp_controls"))
-        {
-            if (0 > H5Pget(dcpl_id, "zfp_controls", &ctrls))
-                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, 0, "unable to get ZFP controls");
-            have_zfp_controls = 1;
-        }
-        else /* just use ZFP library defaults */
-        {
-            mem_cd_nelmts = H5Z_ZFP_CD_NELMTS_MEM;
-            H5Pset_zfp_expert_cdata(ZFP_MIN_BITS, ZFP_MAX_BITS, ZFP_MAX_PREC, ZFP_MIN_EXP, mem_cd_nelmts, mem_cd_values);
-        }
+        case H5Z_ZFP_MODE_RATE:
+            H5Pset_zfp_rate_cdata(ctrls->details.rate, n, params);
+            break;
+        case H5Z_ZFP_MODE_PRECISION:
+            H5Pset_zfp_precision_cdata(ctrls->details.prec, n, params);
+            break;
+        case H5Z_ZFP_MODE_ACCURACY:
+            H5Pset_zfp_accuracy_cdata(ctrls->details.acc, n, params);
+            break;
+        case H5Z_ZFP_MODE_EXPERT:
+            H5Pset_zfp_expert_cdata(ctrls->details.expert.minbits, ctrls->details.expert.maxbits,
+                ctrls->details.expert.maxprec, ctrls->details.expert.minexp, n, params);
+            break;
+        case H5Z_ZFP_MODE_REVERSIBLE:
+            H5Pset_zfp_reversible_cdata(n, params);
+            break;
+        case H5Z_ZFP_MODE_TARGET:
+            H5Pset_zfp_target_cdata(ctrls->details.target.ratio, ctrls->details.target.err, n, params);
+            break;
+        default:
+            return 0;
     }
-        
-    /* Into hdr_cd_values, we encode ZFP library and H5Z-ZFP plugin version info at
-       entry 0 and use remaining entries as a tiny buffer to write ZFP native header. */
-    hdr_cd_values[0] = (unsigned int) ((ZFP_VERSION_NO<<16) | H5Z_FILTER_ZFP_VERSION_NO);
-    if (0 == (dummy_bstr = B stream_open(&hdr_cd_values[1], sizeof(hdr_cd_values))))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "stream_open() failed");
+    return 1;
+}
 
-    if (0 == (dummy_zstr = Z zfp_stream_open(dummy_bstr)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "zfp_stream_open() failed");
+/* Execution policy override from the environment.
+   H5Z_ZFP_EXECUTION=policy[:nthreads[:chunk_blocks]] where policy is
+   "serial", "omp", "cuda" or the numeric value of an H5Z_ZFP_EXEC_XXX constant. */
+static h5z_zfp_execution_t h5z_zfp_env_exec;
+static int h5z_zfp_env_exec_set = 0;
 
-    /* Set the ZFP stream basic mode from mem_cd_values[0] */
-    if (have_zfp_controls)
+static void
+h5z_zfp_exec_env(void)
+{
+    char const *s = getenv("H5Z_ZFP_EXECUTION");
+    char *end;
+    h5z_zfp_execution_t exec = {H5Z_ZFP_EXEC_SERIAL, 0, 0};
+
+    if (!s || !*s) return;
+
+    if (!strncasecmp(s, "serial", 6))
+        s += 6;
+    else if (!strncasecmp(s, "omp", 3))
     {
-        switch (ctrls.mode)
-        {
-            case H5Z_ZFP_MODE_RATE:
-                Z zfp_stream_set_rate(dummy_zstr, ctrls.details.rate, zt, ndims_used, 0);
-                break;
-            case H5Z_ZFP_MODE_PRECISION:
-#if ZFP_VERSION_NO < 0x0051
-                Z zfp_stream_set_precision(dummy_zstr, ctrls.details.prec, zt);
-#else
-                Z zfp_stream_set_precision(dummy_zstr, ctrls.details.prec);
-#endif
-                break;
-            case H5Z_ZFP_MODE_ACCURACY:
-#if ZFP_VERSION_NO < 0x0051
-                Z zfp_stream_set_accuracy(dummy_zstr, ctrls.details.acc, zt);
-#else
-                Z zfp_stream_set_accuracy(dummy_zstr, ctrls.details.acc);
-#endif
-                break;
-            case H5Z_ZFP_MODE_EXPERT:
-                Z zfp_stream_set_params(dummy_zstr, ctrls.details.expert.minbits,
-                    ctrls.details.expert.maxbits, ctrls.details.expert.maxprec,
-                    ctrls.details.expert.minexp);
-                break;
-            default:
-                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "invalid ZFP mode");
-        }
+        exec.policy = H5Z_ZFP_EXEC_OMP;
+        s += 3;
+    }
+    else if (!strncasecmp(s, "cuda", 4))
+    {
+        exec.policy = H5Z_ZFP_EXEC_CUDA;
+        s += 4;
     }
     else
     {
-        switch (mem_cd_values[0])
-        {
-            case H5Z_ZFP_MODE_RATE:
-                Z zfp_stream_set_rate(dummy_zstr, *((double*) &mem_cd_values[2]), zt, ndims_used, 0);
-                break;
-            case H5Z_ZFP_MODE_PRECISION:
-#if ZFP_VERSION_NO < 0x0051
-                Z zfp_stream_set_precision(dummy_zstr, mem_cd_values[2], zt);
-#else
-                Z zfp_stream_set_precision(dummy_zstr, mem_cd_values[2]);
-#endif
-                break;
-            case H5Z_ZFP_MODE_ACCURACY:
-#if ZFP_VERSION_NO < 0x0051
-                Z zfp_stream_set_accuracy(dummy_zstr, *((double*) &mem_cd_values[2]), zt);
-#else
-                Z zfp_stream_set_accuracy(dummy_zstr, *((double*) &mem_cd_values[2]));
-#endif
-                break;
-            case H5Z_ZFP_MODE_EXPERT:
-                Z zfp_stream_set_params(dummy_zstr, mem_cd_values[2], mem_cd_values[3],
-                    mem_cd_values[4], (int) mem_cd_values[5]);
-                break;
-            default:
-                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "invalid ZFP mode");
-        }
+        exec.policy = (int) strtol(s, &end, 10);
+        if (end == s) return;
+        s = end;
     }
+    if (*s == ':')
+    {
+        exec.nthreads = (unsigned int) strtoul(s+1, &end, 10);
+        s = end;
+    }
+    if (*s == ':')
+        exec.chunk_blocks = (unsigned int) strtoul(s+1, 0, 10);
 
-    /* Use ZFP's write_header method to write the ZFP header into hdr_cd_values array */
-    if (0 == (hdr_bits = Z zfp_write_header(dummy_zstr, dummy_field, ZFP_HEADER_FULL)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTINIT, 0, "unable to write header");
+    if (exec.policy != H5Z_ZFP_EXEC_SERIAL && exec.policy != H5Z_ZFP_EXEC_OMP &&
+        exec.policy != H5Z_ZFP_EXEC_CUDA)
+        return;
 
-    /* Flush the ZFP stream */
-    Z zfp_stream_flush(dummy_zstr);
+    h5z_zfp_env_exec = exec;
+    h5z_zfp_env_exec_set = 1;
+}
+
+static void
+h5z_zfp_env_execution(h5z_zfp_execution_t *exec)
+{
+    h5z_zfp_env();
+    if (h5z_zfp_env_exec_set)
+        *exec = h5z_zfp_env_exec;
+}
+
+/* Dataset access settings bound to a thread by H5Z_zfp_set_access. They
+   override the H5Z_ZFP_EXECUTION, H5Z_ZFP_READ_PRECISION and H5Z_ZFP_BUFFER_POOL
+   environment variables for filter calls on that thread. The execution policy
+   applies only to its reads, where it also overrides the dataset's. */
+typedef struct _h5z_zfp_access_t {
+    int have_exec;
+    h5z_zfp_execution_t exec;
+    unsigned int read_prec; /* 0 if not set */
+    int pool;               /* -1 if not set */
+} h5z_zfp_access_t;
+
+/* Per-thread ZFP field and stream objects, re-bound to each chunk the thread
+   (de)compresses instead of being allocated and freed every filter call. All
+   contexts are also kept on a list so H5Z_zfp_finalize can free them. Deleting
+   the key there effectively resets every thread's context to NULL. A second pair
+   is for a slab of a chunk being decoded on many threads (see h5z_zfp_decode_task),
+   as the calling thread's first pair stays bound to the whole chunk meanwhile. */
+typedef struct _h5z_zfp_context_t {
+    zfp_field *zfld;
+    zfp_stream *zstr;
+    zfp_field *slab_zfld;
+    zfp_stream *slab_zstr;
+    unsigned int read_prec; /* from H5Z_zfp_set_read_precision, 0 if not set */
+    h5z_zfp_access_t access; /* from H5Z_zfp_set_access */
+    struct _h5z_zfp_context_t *next;
+} h5z_zfp_context_t;
+
+static pthread_key_t h5z_zfp_context_key;
+static volatile int h5z_zfp_context_key_valid = 0;
+static h5z_zfp_context_t *h5z_zfp_contexts = 0;
+static pthread_mutex_t h5z_zfp_context_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+h5z_zfp_context_free(h5z_zfp_context_t *ctx)
+{
+    if (ctx->zfld) Z zfp_field_free(ctx->zfld);
+    if (ctx->zstr) Z zfp_stream_close(ctx->zstr);
+    if (ctx->slab_zfld) Z zfp_field_free(ctx->slab_zfld);
+    if (ctx->slab_zstr) Z zfp_stream_close(ctx->slab_zstr);
+    free(ctx);
+}
+
+/* thread exit destructor; finalize may have freed ctx already */
+static void
+h5z_zfp_context_release(void *arg)
+{
+    h5z_zfp_context_t **p;
+
+    pthread_mutex_lock(&h5z_zfp_context_mutex);
+    for (p = &h5z_zfp_contexts; *p; p = &(*p)->next)
+    {
+        if (*p != arg) continue;
+        *p = (*p)->next;
+        h5z_zfp_context_free((h5z_zfp_context_t *) arg);
+        break;
+    }
+    pthread_mutex_unlock(&h5z_zfp_context_mutex);
+}
+
+static h5z_zfp_context_t *
+h5z_zfp_context_get(void)
+{
+    h5z_zfp_context_t *ctx;
+
+    if (!h5z_zfp_context_key_valid)
+    {
+        pthread_mutex_lock(&h5z_zfp_context_mutex);
+        if (!h5z_zfp_context_key_valid &&
+            0 == pthread_key_create(&h5z_zfp_context_key, h5z_zfp_context_release))
+            h5z_zfp_context_key_valid = 1;
+        pthread_mutex_unlock(&h5z_zfp_context_mutex);
+        if (!h5z_zfp_context_key_valid)
+            return 0;
+    }
+
+    if ((ctx = (h5z_zfp_context_t *) pthread_getspecific(h5z_zfp_context_key)))
+        return ctx;
+
+    if (0 == (ctx = (h5z_zfp_context_t *) calloc(1, sizeof(*ctx))))
+        return 0;
+    ctx->access.pool = -1;
+    ctx->zfld = Z zfp_field_alloc();
+    ctx->zstr = Z zfp_stream_open(0);
+    ctx->slab_zfld = Z zfp_field_alloc();
+    ctx->slab_zstr = Z zfp_stream_open(0);
+    if (!ctx->zfld || !ctx->zstr || !ctx->slab_zfld || !ctx->slab_zstr ||
+        pthread_setspecific(h5z_zfp_context_key, ctx))
+    {
+        h5z_zfp_context_free(ctx);
+        return 0;
+    }
+
+    pthread_mutex_lock(&h5z_zfp_context_mutex);
+    ctx->next = h5z_zfp_contexts;
+    h5z_zfp_contexts = ctx;
+    pthread_mutex_unlock(&h5z_zfp_context_mutex);
+
+    return ctx;
+}
+
+static void
+h5z_zfp_context_clear(void)
+{
+    pthread_mutex_lock(&h5z_zfp_context_mutex);
+    while (h5z_zfp_contexts)
+    {
+        h5z_zfp_context_t *ctx = h5z_zfp_contexts;
+        h5z_zfp_contexts = ctx->next;
+        h5z_zfp_context_free(ctx);
+    }
+    if (h5z_zfp_context_key_valid)
+        pthread_key_delete(h5z_zfp_context_key);
+    h5z_zfp_context_key_valid = 0;
+    pthread_mutex_unlock(&h5z_zfp_context_mutex);
+}
+
+/* Buffers handed back to HDF5 in *buf are ultimately freed by HDF5. So,
+   they must come from HDF5's allocator when it is available. */
+#if H5_VERSION_GE(1,8,15)
+#define H5Z_ZFP_MALLOC(N)    H5allocate_memory(N, 0)
+#define H5Z_ZFP_REALLOC(P,N) H5resize_memory(P, N)
+#define H5Z_ZFP_FREE(P)      H5free_memory(P)
+#else
+#define H5Z_ZFP_MALLOC(N)    malloc(N)
+#define H5Z_ZFP_REALLOC(P,N) realloc(P, N)
+#define H5Z_ZFP_FREE(P)      free(P)
+#endif
+
+/* Optional pool of scratch buffers in power-of-2 size classes. Pool buffers
+   are never handed to HDF5. Instead, compression writes into a pool buffer and
+   then copies the (smaller) result into the chunk buffer HDF5 gave us. This
+   avoids allocating a worst case sized buffer for every chunk. The pool is
+   off unless enabled by H5Z_zfp_set_buffer_pool or H5Z_ZFP_BUFFER_POOL=1. */
+#define H5Z_ZFP_POOL_MIN_SHIFT 12 /* 4 KiB */
+#define H5Z_ZFP_POOL_CLASSES   24 /* up to 32 GiB */
+#define H5Z_ZFP_POOL_DEPTH      8 /* max idle buffers kept per size class */
+
+typedef struct _h5z_zfp_pool_class_t {
+    void *bufs[H5Z_ZFP_POOL_DEPTH];
+    int nbufs;
+} h5z_zfp_pool_class_t;
+
+static h5z_zfp_pool_class_t h5z_zfp_pool[H5Z_ZFP_POOL_CLASSES];
+static int h5z_zfp_pool_enabled = -1; /* -1 means not yet checked env. */
+static unsigned long long h5z_zfp_pool_resident = 0;
+static unsigned long long h5z_zfp_pool_peak = 0;
+static pthread_mutex_t h5z_zfp_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+h5z_zfp_pool_class(size_t n)
+{
+    int c = 0;
+
+    while (c < H5Z_ZFP_POOL_CLASSES && ((size_t) 1 << (H5Z_ZFP_POOL_MIN_SHIFT + c)) < n)
+        c++;
+    return c;
+}
+
+/* caller must hold h5z_zfp_pool_mutex */
+static void
+h5z_zfp_pool_drain(void)
+{
+    int c;
+
+    for (c = 0; c < H5Z_ZFP_POOL_CLASSES; c++)
+    {
+        while (h5z_zfp_pool[c].nbufs > 0)
+        {
+            free(h5z_zfp_pool[c].bufs[--h5z_zfp_pool[c].nbufs]);
+            h5z_zfp_pool_resident -= (size_t) 1 << (H5Z_ZFP_POOL_MIN_SHIFT + c);
+        }
+    }
+}
+
+static void
+h5z_zfp_pool_env(void)
+{
+    char const *s = getenv("H5Z_ZFP_BUFFER_POOL");
+    h5z_zfp_pool_enabled = s && strtol(s, 0, 10) > 0;
+}
+
+static int
+h5z_zfp_pool_on(void)
+{
+    h5z_zfp_env();
+    return h5z_zfp_pool_enabled;
+}
+
+/* The pool setting for the calling thread, which H5Z_zfp_set_access may override */
+static int
+h5z_zfp_pool_use(void)
+{
+    h5z_zfp_context_t const *ctx = h5z_zfp_context_key_valid ?
+        (h5z_zfp_context_t const *) pthread_getspecific(h5z_zfp_context_key) : 0;
+
+    if (ctx && ctx->access.pool >= 0)
+        return ctx->access.pool;
+    return h5z_zfp_pool_on();
+}
+
+static void *
+h5z_zfp_scratch_get(size_t n)
+{
+    int c = h5z_zfp_pool_class(n);
+    size_t csize = (size_t) 1 << (H5Z_ZFP_POOL_MIN_SHIFT + c);
+    void *p = 0;
+
+    if (c == H5Z_ZFP_POOL_CLASSES)
+        return malloc(n);
+
+    pthread_mutex_lock(&h5z_zfp_pool_mutex);
+    if (h5z_zfp_pool[c].nbufs > 0)
+        p = h5z_zfp_pool[c].bufs[--h5z_zfp_pool[c].nbufs];
+    pthread_mutex_unlock(&h5z_zfp_pool_mutex);
+    if (p) return p;
+
+    if (0 == (p = malloc(csize)))
+        return 0;
+
+    pthread_mutex_lock(&h5z_zfp_pool_mutex);
+    h5z_zfp_pool_resident += csize;
+    if (h5z_zfp_pool_resident > h5z_zfp_pool_peak)
+        h5z_zfp_pool_peak = h5z_zfp_pool_resident;
+    pthread_mutex_unlock(&h5z_zfp_pool_mutex);
+
+    return p;
+}
+
+/* n must be the size p was obtained with */
+static void
+h5z_zfp_scratch_put(void *p, size_t n)
+{
+    int c = h5z_zfp_pool_class(n);
+    int keep;
+
+    if (!p) return;
+
+    if (c < H5Z_ZFP_POOL_CLASSES)
+    {
+        keep = h5z_zfp_pool_use() > 0;
+        pthread_mutex_lock(&h5z_zfp_pool_mutex);
+        if (keep && h5z_zfp_pool[c].nbufs < H5Z_ZFP_POOL_DEPTH)
+        {
+            h5z_zfp_pool[c].bufs[h5z_zfp_pool[c].nbufs++] = p;
+            p = 0;
+        }
+        else
+        {
+            h5z_zfp_pool_resident -= (size_t) 1 << (H5Z_ZFP_POOL_MIN_SHIFT + c);
+        }
+        pthread_mutex_unlock(&h5z_zfp_pool_mutex);
+    }
+
+    if (p) free(p);
+}
+
+int H5Z_zfp_set_buffer_pool(int enable)
+{
+    int prev = h5z_zfp_pool_on();
+
+    pthread_mutex_lock(&h5z_zfp_pool_mutex);
+    h5z_zfp_pool_enabled = enable ? 1 : 0;
+    if (!enable)
+        h5z_zfp_pool_drain();
+    pthread_mutex_unlock(&h5z_zfp_pool_mutex);
+
+    return prev;
+}
+
+int H5Z_zfp_pool_stats(unsigned long long *resident, unsigned long long *peak)
+{
+    pthread_mutex_lock(&h5z_zfp_pool_mutex);
+    if (resident) *resident = h5z_zfp_pool_resident;
+    if (peak) *peak = h5z_zfp_pool_peak;
+    pthread_mutex_unlock(&h5z_zfp_pool_mutex);
+    return 1;
+}
+
+static void
+h5z_zfp_pool_clear(void)
+{
+    pthread_mutex_lock(&h5z_zfp_pool_mutex);
+    h5z_zfp_pool_drain();
+    h5z_zfp_pool_peak = h5z_zfp_pool_resident;
+    pthread_mutex_unlock(&h5z_zfp_pool_mutex);
+}
+
+/* Cap, in bytes, on the memory compression allocates for a chunk beyond the
+   chunk buffer HDF5 gives us, from H5Z_zfp_set_memory_limit or
+   H5Z_ZFP_MEMORY_LIMIT. 0 means no limit. Under a limit, chunks are encoded a
+   row of blocks at a time into an output buffer grown only up to the limit and
+   a chunk that would need more fails to compress. */
+static long long h5z_zfp_mem_limit = -1; /* -1 means not yet checked env. */
+static pthread_mutex_t h5z_zfp_mem_limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+h5z_zfp_mem_limit_env(void)
+{
+    char const *s = getenv("H5Z_ZFP_MEMORY_LIMIT");
+    h5z_zfp_mem_limit = s ? (long long) strtoull(s, 0, 10) : 0;
+}
+
+static size_t
+h5z_zfp_memory_limit(void)
+{
+    size_t limit;
+
+    h5z_zfp_env();
+    pthread_mutex_lock(&h5z_zfp_mem_limit_mutex);
+    limit = (size_t) h5z_zfp_mem_limit;
+    pthread_mutex_unlock(&h5z_zfp_mem_limit_mutex);
+    return limit;
+}
+
+size_t H5Z_zfp_set_memory_limit(size_t nbytes)
+{
+    size_t prev = h5z_zfp_memory_limit();
+
+    pthread_mutex_lock(&h5z_zfp_mem_limit_mutex);
+    h5z_zfp_mem_limit = (long long) nbytes;
+    pthread_mutex_unlock(&h5z_zfp_mem_limit_mutex);
+
+    return prev;
+}
+
+/* Decompression output placement, from H5Z_ZFP_INPLACE_DECODE
+      0: always decode into a newly allocated buffer
+      1: decode straight into the chunk buffer when it is large enough (default)
+      2: as 1 but also grow the chunk buffer (realloc) when it is not */
+static int h5z_zfp_inplace = -1;
+
+static void
+h5z_zfp_inplace_env(void)
+{
+    char const *s = getenv("H5Z_ZFP_INPLACE_DECODE");
+    int mode = s && *s ? (int) strtol(s, 0, 10) : 1;
+    h5z_zfp_inplace = (mode < 0 || mode > 2) ? 1 : mode;
+}
+
+static int
+h5z_zfp_inplace_mode(void)
+{
+    h5z_zfp_env();
+    return h5z_zfp_inplace;
+}
+
+/* Filter instrumentation, enabled by H5Z_zfp_set_stats() or H5Z_ZFP_STATS
+      unset, "" or "0": off (default)
+      "1":              on, dumped to stderr at exit
+      anything else:    on, appended to the named file at exit
+   Counters enabled by H5Z_zfp_set_stats() are dumped to stderr at exit too.
+   Counters, and the switch itself, are updated with relaxed atomics and need
+   no lock. */
+static H5Z_zfp_stats_t h5z_zfp_stats;
+static int h5z_zfp_stats_enabled = -1;
+static char const *h5z_zfp_stats_file = 0;
+static pthread_once_t h5z_zfp_stats_dump_once = PTHREAD_ONCE_INIT;
+
+static void h5z_zfp_stats_dump(void);
+
+static void
+h5z_zfp_stats_dump_register(void)
+{
+    atexit(h5z_zfp_stats_dump);
+}
+
+#define H5Z_ZFP_STATS_WORDS (sizeof(H5Z_zfp_stats_t) / sizeof(unsigned long long))
+
+#ifdef __GNUC__
+#define H5Z_ZFP_STATS_ADD(F,V) __atomic_fetch_add(&h5z_zfp_stats.F, (V), __ATOMIC_RELAXED)
+#define H5Z_ZFP_STATS_LOAD(P) __atomic_load_n((P), __ATOMIC_RELAXED)
+#define H5Z_ZFP_STATS_STORE(P,V) __atomic_store_n((P), (V), __ATOMIC_RELAXED)
+#else
+#define H5Z_ZFP_STATS_ADD(F,V) (h5z_zfp_stats.F += (V))
+#define H5Z_ZFP_STATS_LOAD(P) (*(P))
+#define H5Z_ZFP_STATS_STORE(P,V) (*(P) = (V))
+#endif
+
+static unsigned long long
+h5z_zfp_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static void
+h5z_zfp_stats_env(void)
+{
+    char const *s = getenv("H5Z_ZFP_STATS");
+    int enabled = s && *s && strcmp(s, "0");
+    H5Z_ZFP_STATS_STORE(&h5z_zfp_stats_enabled, enabled);
+    if (enabled)
+    {
+        if (strcmp(s, "1")) h5z_zfp_stats_file = s;
+        pthread_once(&h5z_zfp_stats_dump_once, h5z_zfp_stats_dump_register);
+    }
+}
+
+static int
+h5z_zfp_stats_on(void)
+{
+    h5z_zfp_env();
+    return H5Z_ZFP_STATS_LOAD(&h5z_zfp_stats_enabled);
+}
+
+static void
+h5z_zfp_stats_record(int dir, size_t raw, size_t zfp, unsigned long long ns, int mt)
+{
+    int bin = 0;
+
+    H5Z_ZFP_STATS_ADD(calls[dir], 1);
+    if (raw == 0) H5Z_ZFP_STATS_ADD(errors[dir], 1);
+    else if (mt) H5Z_ZFP_STATS_ADD(threaded[dir], 1);
+    H5Z_ZFP_STATS_ADD(raw_bytes[dir], raw);
+    H5Z_ZFP_STATS_ADD(zfp_bytes[dir], zfp);
+    H5Z_ZFP_STATS_ADD(total_ns[dir], ns);
+    while (ns > 1 && bin < H5Z_ZFP_STATS_BINS - 1)
+    {
+        ns >>= 1;
+        bin++;
+    }
+    H5Z_ZFP_STATS_ADD(latency[dir][bin], 1);
+}
+
+int H5Z_zfp_set_stats(int enable)
+{
+    int prev = h5z_zfp_stats_on();
+    if (enable)
+        pthread_once(&h5z_zfp_stats_dump_once, h5z_zfp_stats_dump_register);
+    H5Z_ZFP_STATS_STORE(&h5z_zfp_stats_enabled, enable ? 1 : 0);
+    return prev;
+}
+
+int H5Z_zfp_get_stats(H5Z_zfp_stats_t *stats)
+{
+    unsigned long long *src = (unsigned long long *) &h5z_zfp_stats;
+    unsigned long long *dst = (unsigned long long *) stats;
+    size_t i;
+
+    if (!stats) return 0;
+    for (i = 0; i < H5Z_ZFP_STATS_WORDS; i++)
+        dst[i] = H5Z_ZFP_STATS_LOAD(&src[i]);
+    return 1;
+}
+
+static void
+h5z_zfp_stats_dump(void)
+{
+    static char const *dir[2] = {"compress", "decompress"};
+    H5Z_zfp_stats_t s;
+    FILE *f = stderr;
+    int d, i;
+
+    if (h5z_zfp_stats_file && 0 == (f = fopen(h5z_zfp_stats_file, "a")))
+        return;
+
+    H5Z_zfp_get_stats(&s);
+    for (d = 0; d < 2; d++)
+    {
+        if (s.calls[d] == 0) continue;
+        fprintf(f, "H5Z-ZFP %s: calls=%llu errors=%llu raw_bytes=%llu zfp_bytes=%llu "
+            "total_ns=%llu setup_ns=%llu alloc_ns=%llu zfp_ns=%llu swap_ns=%llu threaded=%llu\n",
+            dir[d], s.calls[d], s.errors[d], s.raw_bytes[d], s.zfp_bytes[d],
+            s.total_ns[d], s.setup_ns[d], s.alloc_ns[d], s.zfp_ns[d], s.swap_ns[d],
+            s.threaded[d]);
+        fprintf(f, "H5Z-ZFP %s latency log2(ns):", dir[d]);
+        for (i = 0; i < H5Z_ZFP_STATS_BINS; i++)
+            if (s.latency[d][i]) fprintf(f, " %d:%llu", i, s.latency[d][i]);
+        fprintf(f, "\n");
+    }
+
+    if (f != stderr) fclose(f);
+}
+
+int H5Z_zfp_reset_stats(void)
+{
+    unsigned long long *p = (unsigned long long *) &h5z_zfp_stats;
+    size_t i;
+
+    for (i = 0; i < H5Z_ZFP_STATS_WORDS; i++)
+        H5Z_ZFP_STATS_STORE(&p[i], 0);
+    return 1;
+}
+
+/* Reduced precision reads, for previews. In fixed-rate mode, zfp skips to the
+   start of the next block after decoding a block. So, lowering the decode stream's
+   maxprec stops decoding each block after that many bit planes without losing
+   our place in the stream. Blocks of other modes have no fixed length and are
+   always decoded in full. The precision comes from H5Z_zfp_set_access() or
+   H5Z_zfp_set_read_precision(), for the calling thread, or H5Z_ZFP_READ_PRECISION.
+   Zero means full precision. */
+static int h5z_zfp_env_read_prec = -1;
+
+static void
+h5z_zfp_read_prec_env(void)
+{
+    char const *s = getenv("H5Z_ZFP_READ_PRECISION");
+    long p = s && *s ? strtol(s, 0, 10) : 0;
+    h5z_zfp_env_read_prec = p > 0 ? (int) p : 0;
+}
+
+static void
+h5z_zfp_read_precision(zfp_stream *zstr, h5z_zfp_context_t const *ctx)
+{
+    unsigned int prec = ctx->access.read_prec ? ctx->access.read_prec : ctx->read_prec;
+
+    h5z_zfp_env();
+    if (prec == 0)
+        prec = (unsigned int) h5z_zfp_env_read_prec;
+
+    if (prec && zstr->minbits == zstr->maxbits && prec < zstr->maxprec)
+        Z zfp_stream_set_params(zstr, zstr->minbits, zstr->maxbits, prec, zstr->minexp);
+}
+
+int H5Z_zfp_set_read_precision(unsigned int bits)
+{
+    h5z_zfp_context_t *ctx;
+    int prev;
+
+    if (0 == (ctx = h5z_zfp_context_get()))
+        return -1;
+    prev = (int) ctx->read_prec;
+    ctx->read_prec = bits;
+    return prev;
+}
+
+int H5Z_zfp_cache_stats(unsigned long long *hits, unsigned long long *misses)
+{
+    pthread_mutex_lock(&h5z_zfp_cache_mutex);
+    if (hits) *hits = h5z_zfp_cache_hits;
+    if (misses) *misses = h5z_zfp_cache_misses;
+    pthread_mutex_unlock(&h5z_zfp_cache_mutex);
+    return 1;
+}
+
+int H5Z_zfp_memo_stats(unsigned long long *hits, unsigned long long *misses)
+{
+    pthread_mutex_lock(&h5z_zfp_memo_mutex);
+    if (hits) *hits = h5z_zfp_memo_hits;
+    if (misses) *misses = h5z_zfp_memo_misses;
+    pthread_mutex_unlock(&h5z_zfp_memo_mutex);
+    return 1;
+}
+
+/* stops the threads h5z_zfp_decompress keeps */
+static void h5z_zfp_workers_clear(void);
+
+#ifndef H5Z_ZFP_AS_LIB
+static
+#endif
+int H5Z_zfp_finalize(void)
+{
+    herr_t ret1 = 0, ret2;
+    h5z_zfp_cache_clear();
+    h5z_zfp_memo_clear();
+    h5z_zfp_workers_clear();
+    h5z_zfp_context_clear();
+    h5z_zfp_pool_clear();
+    pthread_mutex_lock(&h5z_zfp_init_mutex);
+    if (H5Z_ZFP_ERRCLASS != -1 && H5Z_ZFP_ERRCLASS != H5E_ERR_CLS_g)
+        ret1 = H5Eunregister_class(H5Z_ZFP_ERRCLASS);
+    H5Z_ZFP_ERRCLASS = -1;
+    pthread_mutex_unlock(&h5z_zfp_init_mutex);
+    ret2 = H5Zunregister(H5Z_FILTER_ZFP);
+    if (ret1 < 0 || ret2 < 0) return -1;
+    return 1;
+}
+
+static void H5Z_zfp_final(void)
+{
+    H5Z_zfp_finalize();
+}
+
+#if !defined(H5Z_ZFP_AS_LIB) && !defined(NDEBUG)
+static pthread_once_t h5z_zfp_final_once = PTHREAD_ONCE_INIT;
+
+static void
+h5z_zfp_final_register(void)
+{
+    /* helps to eliminate resource leak for memory analysis */
+    atexit(H5Z_zfp_final);
+}
+#endif
+
+/* Every entry point calls this first. It may be called concurrently from any
+   number of threads and, after the first call, takes no lock. */
+void H5Z_zfp_init(void)
+{
+    h5z_zfp_env();
+
+    /* Register the error class */
+    if (H5Z_ZFP_ERRCLASS == -1)
+    {
+        pthread_mutex_lock(&h5z_zfp_init_mutex);
+        if (H5Z_ZFP_ERRCLASS == -1)
+        {
+            if (H5Eget_class_name(H5E_ERR_CLS_g,0,0) < 0)
+            {
+                H5Z_ZFP_ERRCLASS = H5Eregister_class("H5Z-ZFP", "ZFP-" ZFP_VERSION_STR,
+                                                     "H5Z-ZFP-" H5Z_FILTER_ZFP_VERSION_STR);
+#if !defined(H5Z_ZFP_AS_LIB) && !defined(NDEBUG)
+                /* the class may be registered again after H5Z_zfp_finalize */
+                pthread_once(&h5z_zfp_final_once, h5z_zfp_final_register);
+#endif
+            }
+            else
+                H5Z_ZFP_ERRCLASS = H5E_ERR_CLS_g;
+        }
+        pthread_mutex_unlock(&h5z_zfp_init_mutex);
+    }
+}
+
+hid_t h5z_zfp_errclass(void)
+{
+    return H5Z_ZFP_ERRCLASS;
+}
+
+int H5Z_zfp_set_access(hid_t dapl_id)
+{
+    static char const *_funcname_ = "H5Z_zfp_set_access";
+    h5z_zfp_access_t access = {0, {H5Z_ZFP_EXEC_SERIAL, 0, 0}, 0, -1};
+    h5z_zfp_context_t *ctx;
+    int retval = -1;
+
+    H5Z_zfp_init();
+
+    if (0 == (ctx = h5z_zfp_context_get()))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "ZFP context alloc failed");
+
+    /* H5P_DEFAULT, or a list without ZFP access properties, unbinds */
+    if (dapl_id != H5P_DEFAULT)
+    {
+        if (0 >= H5Pisa_class(dapl_id, H5P_DATASET_ACCESS))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a dataset access property list");
+        if (0 < H5Pexist(dapl_id, "zfp_access_exec"))
+        {
+            if (0 > H5Pget(dapl_id, "zfp_access_exec", &access.exec))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "unable to get ZFP execution policy");
+            access.have_exec = 1;
+        }
+        if (0 < H5Pexist(dapl_id, "zfp_access_prec") &&
+            0 > H5Pget(dapl_id, "zfp_access_prec", &access.read_prec))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "unable to get ZFP read precision");
+        if (0 < H5Pexist(dapl_id, "zfp_access_pool") &&
+            0 > H5Pget(dapl_id, "zfp_access_pool", &access.pool))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "unable to get ZFP buffer pool setting");
+    }
+
+    ctx->access = access;
+    retval = 1;
+
+done:
+    return retval;
+}
+
+/* ZFP 0.5.4 added 4D fields */
+#if ZFP_VERSION_NO >= 0x0054
+#define H5Z_ZFP_MAX_DIMS 4
+#else
+#define H5Z_ZFP_MAX_DIMS 3
+#endif
+
+/* ZFP's header stores field dimensions in 48 bits split evenly among them */
+static int
+h5z_zfp_dims_fit(int n, hsize_t const *fdims)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        if (fdims[i] - 1 >= ((hsize_t) 1 << (48 / n)))
+            return 0;
+    return 1;
+}
+
+/* Map a chunk's dimensions (slowest first) to those of a ZFP field, also slowest
+   first. Unity dimensions are dropped. When more non-unity dimensions remain than
+   ZFP supports, or four remain that don't fit in ZFP's header, all but the fastest
+   two are folded into the slowest dimension of a 3D field. The chunk is then
+   treated as a stack of 3D slabs. Returns the field's dimensionality or 0 if ZFP
+   cannot represent the chunk. */
+static int
+h5z_zfp_field_dims(int ndims, hsize_t const *dims, hsize_t *fdims)
+{
+    int i, n = 0;
+
+    for (i = 0; i < ndims; i++)
+    {
+        if (dims[i] <= 1) continue;
+        fdims[n++] = dims[i];
+    }
+
+    if (n > H5Z_ZFP_MAX_DIMS || (n == 4 && !h5z_zfp_dims_fit(n, fdims)))
+    {
+        for (i = 1; i < n-2; i++)
+            fdims[0] *= fdims[i];
+        fdims[1] = fdims[n-2];
+        fdims[2] = fdims[n-1];
+        n = 3;
+    }
+
+    if (n == 0 || !h5z_zfp_dims_fit(n, fdims))
+        return 0;
+
+    return n;
+}
+
+/* Chunk alignment check, from H5Z_ZFP_CHUNK_CHECK
+      unset, "" or "0": off (default)
+      "1": warn, on stderr, of chunks ZFP must pad to whole 4^d blocks
+      "2": refuse such chunks
+   A field dimension that isn't a multiple of 4 leaves partial blocks along
+   it, which cost as many bits and as much time to code as whole ones. */
+static int h5z_zfp_chunk_check = -1;
+
+static void
+h5z_zfp_chunk_check_env(void)
+{
+    char const *s = getenv("H5Z_ZFP_CHUNK_CHECK");
+    int mode = s && *s ? (int) strtol(s, 0, 10) : 0;
+    h5z_zfp_chunk_check = (mode < 0 || mode > 2) ? 0 : mode;
+}
+
+static int
+h5z_zfp_chunk_check_mode(void)
+{
+    h5z_zfp_env();
+    return h5z_zfp_chunk_check;
+}
+
+static int
+h5z_zfp_dims_aligned(int n, hsize_t const *fdims)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        if (fdims[i] % 4)
+            return 0;
+    return 1;
+}
+
+static void
+h5z_zfp_chunk_dims_str(int ndims, hsize_t const *dims, char *str, size_t len)
+{
+    int i;
+    size_t k = 0;
+
+    str[0] = '\0';
+    for (i = 0; i < ndims && k < len; i++)
+        k += snprintf(str + k, len - k, "%s%llu", i ? "x" : "", (unsigned long long) dims[i]);
+}
+
+static htri_t
+H5Z_zfp_can_apply(hid_t dcpl_id, hid_t type_id, hid_t chunk_space_id)
+{   
+    static char const *_funcname_ = "H5Z_zfp_can_apply";
+    int ndims, nf;
+    size_t dsize;
+    htri_t retval = 0;
+    hsize_t dims[H5S_MAX_RANK], fdims[H5S_MAX_RANK];
+    H5T_class_t dclass;
+    hid_t native_type_id;
+
+    H5Z_zfp_init();
+
+    /* Disable the ZFP filter entirely if it looks like the ZFP library
+       hasn't been compiled for 8-bit stream word size */
+    if (B (int) stream_word_bits != 8)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTINIT, -1,
+            "ZFP lib not compiled with -DBIT_STREAM_WORD_TYPE=uint8");
+
+    /* get datatype class, size and space dimensions */
+    if (H5T_NO_CLASS == (dclass = H5Tget_class(type_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, -1, "bad datatype class");
+
+    if (0 == (dsize = H5Tget_size(type_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, -1, "bad datatype size");
+
+    if (0 > (ndims = H5Sget_simple_extent_dims(chunk_space_id, dims, 0)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, -1, "bad chunk data space");
+
+    /* confirm ZFP library can handle this data */
+#if ZFP_VERSION_NO < 0x0051
+    if (!(dclass == H5T_FLOAT))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
+            "requires datatype class of H5T_FLOAT");
+#else
+    if (!(dclass == H5T_FLOAT || dclass == H5T_INTEGER))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
+            "requires datatype class of H5T_FLOAT or H5T_INTEGER");
+#endif
+
+    if (!(dsize == 4 || dsize == 8))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
+            "requires datatype size of 4 or 8");
+
+    /* check for *USED* dimensions of the chunk */
+    if (0 == (nf = h5z_zfp_field_dims(ndims, dims, fdims)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
+            "chunk must have non-unity dimensions small enough for ZFP header");
+
+    /* a warning goes on a stack of its own, printed here, so as not to fail */
+    if (h5z_zfp_chunk_check_mode() && !h5z_zfp_dims_aligned(nf, fdims))
+    {
+        char str[256];
+        hid_t es;
+
+        h5z_zfp_chunk_dims_str(ndims, dims, str, sizeof(str));
+        if (h5z_zfp_chunk_check_mode() > 1)
+        {
+            H5Epush(H5E_DEFAULT, __FILE__, _funcname_, __LINE__, H5Z_ZFP_ERRCLASS, H5E_PLINE,
+                H5E_BADVALUE, "chunk %s not a multiple of ZFP's 4^d blocks", str);
+            goto done;
+        }
+        if (0 <= (es = H5Ecreate_stack()))
+        {
+            H5Epush(es, __FILE__, _funcname_, __LINE__, H5Z_ZFP_ERRCLASS, H5E_PLINE,
+                H5E_BADVALUE, "chunk %s not a multiple of ZFP's 4^d blocks; partial blocks are padded", str);
+            H5Eprint(es, stderr);
+            H5Eclose_stack(es);
+        }
+    }
+
+    /* if caller is doing "endian targetting", disallow that */
+    native_type_id = H5Tget_native_type(type_id, H5T_DIR_ASCEND);
+    if (H5Tget_order(type_id) != H5Tget_order(native_type_id))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
+            "endian targetting non-sensical in conjunction with ZFP filter");
+
+    retval = 1;
+
+done:
+
+    return retval;
+}
+
+/* Default target for H5Z_zfp_suggest_chunk: the L2 cache, so a chunk is decoded
+   without going to memory, or 1 MiB if the size of that is not known */
+static size_t
+h5z_zfp_l2_size(void)
+{
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long n = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (n > 0) return (size_t) n;
+#endif
+    return (size_t) 1 << 20;
+}
+
+/* Start from the fastest varying non-unity dimensions ZFP can use, whole but
+   rounded down to a multiple of 4, and halve the largest of them, keeping it
+   a multiple of 4, until the chunk is at most target_bytes. Halving the
+   largest first keeps the chunk close to a cube, which ZFP decorrelates best. */
+int H5Z_zfp_suggest_chunk(int ndims, hsize_t const *dims, hid_t type_id,
+    size_t target_bytes, hsize_t *chunk)
+{
+    static char const *_funcname_ = "H5Z_zfp_suggest_chunk";
+    int i, used = 0, retval = -1;
+    size_t dsize;
+    hsize_t n, fdims[H5S_MAX_RANK];
+    H5T_class_t dclass;
+
+    H5Z_zfp_init();
+
+    if (ndims < 1 || ndims > H5S_MAX_RANK || !dims || !chunk)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+
+    dclass = H5Tget_class(type_id);
+    dsize = H5Tget_size(type_id);
+    if (!(dclass == H5T_FLOAT || dclass == H5T_INTEGER) || !(dsize == 4 || dsize == 8))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1,
+            "requires 4 or 8 byte H5T_FLOAT or H5T_INTEGER datatype");
+
+    if (target_bytes == 0)
+        target_bytes = h5z_zfp_l2_size();
+
+    for (i = ndims-1; i >= 0; i--)
+    {
+        chunk[i] = 1;
+        if (dims[i] <= 1 || used == H5Z_ZFP_MAX_DIMS) continue;
+        chunk[i] = dims[i] < 4 ? dims[i] : dims[i] & ~(hsize_t) 3;
+        used++;
+    }
+
+    while (1)
+    {
+        int big = -1;
+
+        for (i = 0, n = dsize; i < ndims; i++)
+        {
+            n *= chunk[i];
+            if (chunk[i] > 4 && (big < 0 || chunk[i] > chunk[big]))
+                big = i;
+        }
+        if (n <= target_bytes || big < 0)
+            break;
+        chunk[big] = (chunk[big] / 2) & ~(hsize_t) 3;
+        if (chunk[big] < 4) chunk[big] = 4;
+    }
+
+    if (0 == h5z_zfp_field_dims(ndims, chunk, fdims))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADSIZE, -1, "no chunk shape ZFP can represent");
+
+    retval = 1;
+
+done:
+    return retval;
+}
+
+/* Resolve a target ratio and/or error to ZFP stream parameters for a field of the
+   given type and dimensionality. The ratio alone is met exactly by fixed-rate mode
+   and the error alone, for floating point data, by fixed-accuracy mode. Together,
+   fixed-accuracy mode is capped at the ratio's bits per block. So, the ratio is then
+   a minimum and the error is met wherever that budget permits. */
+static int
+h5z_zfp_set_target(zfp_stream *zstr, zfp_type zt, uint dims, double ratio, double err)
+{
+    double const bits = (zt == zfp_type_int32 || zt == zfp_type_float) ? 32 : 64;
+    zfp_stream capped;
+
+    if (ratio < 1 && ratio != 0) return 0;
+    if (err < 0 || (ratio == 0 && err == 0)) return 0;
+    if (err > 0 && (zt == zfp_type_int32 || zt == zfp_type_int64)) return 0;
+
+    if (err == 0)
+    {
+        Z zfp_stream_set_rate(zstr, bits / ratio, zt, dims, 0);
+        return 1;
+    }
+
+#if ZFP_VERSION_NO < 0x0051
+    Z zfp_stream_set_accuracy(zstr, err, zt);
+#else
+    Z zfp_stream_set_accuracy(zstr, err);
+#endif
+    if (ratio > 0)
+    {
+        capped = *zstr;
+        Z zfp_stream_set_rate(&capped, bits / ratio, zt, dims, 0);
+        Z zfp_stream_set_params(zstr, zstr->minbits, capped.maxbits, zstr->maxprec, zstr->minexp);
+    }
+    return 1;
+}
+
+/* Raise the filter version stamped in cd_values[0] to at least version */
+static void
+h5z_zfp_cd_version(unsigned int *cd_values, unsigned int version)
+{
+    if ((cd_values[0] & 0x0000FFFF) < version)
+        cd_values[0] = (cd_values[0] & 0xFFFF0000) | version;
+}
+
+/* Replace the ZFP header in cd_values with the compact layout of info's mode and meta */
+static void
+h5z_zfp_compact_put(unsigned int *cd_values, h5z_zfp_info_t const *info)
+{
+    memset(cd_values, 0, H5Z_ZFP_CD_NELMTS_MAX * sizeof(cd_values[0]));
+    cd_values[0] = (unsigned int) ((ZFP_VERSION_NO<<16) | H5Z_ZFP_CD_VERSION_COMPACT);
+    cd_values[1] = H5Z_ZFP_COMPACT_TAG | ((unsigned int) ZFP_CODEC << 8) |
+        (H5T_ORDER_BE == h5z_zfp_native_order() ? H5Z_ZFP_COMPACT_BE : H5Z_ZFP_COMPACT_LE);
+    cd_values[2] = (unsigned int) (info->zfp_mode & 0xFFFFFFFF);
+    cd_values[3] = (unsigned int) (info->zfp_mode >> 32);
+    cd_values[4] = (unsigned int) (info->zfp_meta & 0xFFFFFFFF);
+    cd_values[5] = (unsigned int) (info->zfp_meta >> 32);
+}
+
+/* Build, into hdr_cd_values, the cd_values stored for a dataset of ZFP type zt and
+   chunk (field) dimensions dims_used, from the settings in dcpl_id. Also returns
+   the ZFP mode and meta info and pre-conditioning flags in info and the filter
+   flags. Returns 1 on success. */
+static herr_t
+h5z_zfp_header(hid_t dcpl_id, H5T_class_t dclass, zfp_type zt, int ndims_used,
+    hsize_t const *dims_used, unsigned int *flags, size_t *hdr_cd_nelmts,
+    unsigned int *hdr_cd_values, h5z_zfp_info_t *info)
+{
+    static char const *_funcname_ = "h5z_zfp_header";
+    size_t hdr_bits, hdr_bytes;
+    size_t mem_cd_nelmts = H5Z_ZFP_CD_NELMTS_MEM;
+    unsigned int mem_cd_values[H5Z_ZFP_CD_NELMTS_MEM];
+    double mem_cd_dbl[2] = {0, 0};
+    herr_t retval = 0;
+    zfp_field *dummy_field = 0;
+    bitstream *dummy_bstr = 0;
+    zfp_stream *dummy_zstr = 0;
+    int have_zfp_controls = 0;
+    h5z_zfp_controls_t ctrls;
+    h5z_zfp_memo_entry_t memo;
+    int use_memo;
+
+    /* get current cd_values and re-map to new cd_value set */
+    if (0 > H5Pget_filter_by_id(dcpl_id, H5Z_FILTER_ZFP, flags, &mem_cd_nelmts, mem_cd_values, 0, NULL, NULL))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, 0, "unable to get current ZFP cd_values");
+
+    /* Handle default case when no cd_values are passed by using ZFP library defaults. */
+    if (mem_cd_nelmts == 0)
+    {
+        /* check for filter controls in the properites */
+        if (0 < H5Pexist(dcpl_id, "zfp_controls"))
+        {
+            if (0 > H5Pget(dcpl_id, "zfp_controls", &ctrls))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, 0, "unable to get ZFP controls");
+            have_zfp_controls = 1;
+        }
+        else /* just use ZFP library defaults */
+        {
+            mem_cd_nelmts = H5Z_ZFP_CD_NELMTS_MEM;
+            H5Pset_zfp_expert_cdata(ZFP_MIN_BITS, ZFP_MAX_BITS, ZFP_MAX_PREC, ZFP_MIN_EXP, mem_cd_nelmts, mem_cd_values);
+        }
+    }
+
+    /* rate, accuracy and target modes keep doubles in the word pairs at 2 and 4 */
+    if (mem_cd_nelmts >= 4)
+        memcpy(&mem_cd_dbl[0], &mem_cd_values[2], sizeof(double));
+    if (mem_cd_nelmts >= 6)
+        memcpy(&mem_cd_dbl[1], &mem_cd_values[4], sizeof(double));
+
+    /* Reuse a header already built for the same type, chunk shape and mode */
+    memset(&memo, 0, sizeof(memo));
+    memo.zt = zt;
+    memo.ndims_used = ndims_used;
+    use_memo = 0 < ndims_used && ndims_used <= 4 &&
+        h5z_zfp_memo_params(have_zfp_controls, &ctrls, mem_cd_nelmts, mem_cd_values, memo.params);
+    if (use_memo)
+    {
+        memcpy(memo.dims_used, dims_used, ndims_used * sizeof(dims_used[0]));
+        if (h5z_zfp_memo_lookup(&memo))
+        {
+            *hdr_cd_nelmts = memo.hdr_cd_nelmts;
+            memcpy(hdr_cd_values, memo.hdr_cd_values, *hdr_cd_nelmts * sizeof(hdr_cd_values[0]));
+            info->zfp_mode = memo.zfp_mode;
+            info->zfp_meta = memo.zfp_meta;
+            goto have_header;
+        }
+    }
+
+    /* set up dummy zfp field to compute meta header */
+    switch (ndims_used)
+    {
+        case 1: dummy_field = Z zfp_field_1d(0, zt, dims_used[0]); break;
+        case 2: dummy_field = Z zfp_field_2d(0, zt, dims_used[1], dims_used[0]); break;
+        case 3: dummy_field = Z zfp_field_3d(0, zt, dims_used[2], dims_used[1], dims_used[0]); break;
+#if ZFP_VERSION_NO >= 0x0054
+        case 4: dummy_field = Z zfp_field_4d(0, zt, dims_used[3], dims_used[2], dims_used[1], dims_used[0]); break;
+#endif
+        default: H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
+                     "chunk non-unity dims too large for ZFP header");
+    }
+    if (!dummy_field)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "zfp_field_Xd() failed");
+
+    /* Into hdr_cd_values, we encode ZFP library and H5Z-ZFP plugin version info at
+       entry 0 and use remaining entries as a tiny buffer to write ZFP native header.
+       Zero it first so bits past the header are the same for identical settings. */
+    memset(hdr_cd_values, 0, H5Z_ZFP_CD_NELMTS_MAX * sizeof(hdr_cd_values[0]));
+    hdr_cd_values[0] = (unsigned int) ((ZFP_VERSION_NO<<16) | H5Z_ZFP_CD_VERSION_BASE);
+    if (0 == (dummy_bstr = B stream_open(&hdr_cd_values[1], (H5Z_ZFP_CD_NELMTS_MAX-1) * sizeof(hdr_cd_values[0]))))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "stream_open() failed");
+
+    if (0 == (dummy_zstr = Z zfp_stream_open(dummy_bstr)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "zfp_stream_open() failed");
+
+    /* Set the ZFP stream basic mode from mem_cd_values[0] */
+    if (have_zfp_controls)
+    {
+        switch (ctrls.mode)
+        {
+            case H5Z_ZFP_MODE_RATE:
+                Z zfp_stream_set_rate(dummy_zstr, ctrls.details.rate, zt, ndims_used, 0);
+                break;
+            case H5Z_ZFP_MODE_PRECISION:
+#if ZFP_VERSION_NO < 0x0051
+                Z zfp_stream_set_precision(dummy_zstr, ctrls.details.prec, zt);
+#else
+                Z zfp_stream_set_precision(dummy_zstr, ctrls.details.prec);
+#endif
+                break;
+            case H5Z_ZFP_MODE_ACCURACY:
+#if ZFP_VERSION_NO < 0x0051
+                Z zfp_stream_set_accuracy(dummy_zstr, ctrls.details.acc, zt);
+#else
+                Z zfp_stream_set_accuracy(dummy_zstr, ctrls.details.acc);
+#endif
+                break;
+            case H5Z_ZFP_MODE_EXPERT:
+                Z zfp_stream_set_params(dummy_zstr, ctrls.details.expert.minbits,
+                    ctrls.details.expert.maxbits, ctrls.details.expert.maxprec,
+                    ctrls.details.expert.minexp);
+                break;
+            case H5Z_ZFP_MODE_REVERSIBLE:
+#if ZFP_VERSION_NO < 0x0054
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
+                    "reversible mode requires ZFP 0.5.4 or newer");
+#else
+                Z zfp_stream_set_reversible(dummy_zstr);
+#endif
+                break;
+            case H5Z_ZFP_MODE_TARGET:
+                if (0 == h5z_zfp_set_target(dummy_zstr, zt, ndims_used,
+                             ctrls.details.target.ratio, ctrls.details.target.err))
+                    H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
+                        "invalid ZFP target (error requires floating point data)");
+                break;
+            default:
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "invalid ZFP mode");
+        }
+    }
+    else
+    {
+        switch (mem_cd_values[0])
+        {
+            case H5Z_ZFP_MODE_RATE:
+                Z zfp_stream_set_rate(dummy_zstr, mem_cd_dbl[0], zt, ndims_used, 0);
+                break;
+            case H5Z_ZFP_MODE_PRECISION:
+#if ZFP_VERSION_NO < 0x0051
+                Z zfp_stream_set_precision(dummy_zstr, mem_cd_values[2], zt);
+#else
+                Z zfp_stream_set_precision(dummy_zstr, mem_cd_values[2]);
+#endif
+                break;
+            case H5Z_ZFP_MODE_ACCURACY:
+#if ZFP_VERSION_NO < 0x0051
+                Z zfp_stream_set_accuracy(dummy_zstr, mem_cd_dbl[0], zt);
+#else
+                Z zfp_stream_set_accuracy(dummy_zstr, mem_cd_dbl[0]);
+#endif
+                break;
+            case H5Z_ZFP_MODE_EXPERT:
+                Z zfp_stream_set_params(dummy_zstr, mem_cd_values[2], mem_cd_values[3],
+                    mem_cd_values[4], (int) mem_cd_values[5]);
+                break;
+            case H5Z_ZFP_MODE_REVERSIBLE:
+#if ZFP_VERSION_NO < 0x0054
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
+                    "reversible mode requires ZFP 0.5.4 or newer");
+#else
+                Z zfp_stream_set_reversible(dummy_zstr);
+#endif
+                break;
+            case H5Z_ZFP_MODE_TARGET:
+                if (0 == h5z_zfp_set_target(dummy_zstr, zt, ndims_used,
+                             mem_cd_dbl[0], mem_cd_dbl[1]))
+                    H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
+                        "invalid ZFP target (error requires floating point data)");
+                break;
+            default:
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "invalid ZFP mode");
+        }
+    }
+
+    /* Use ZFP's write_header method to write the ZFP header into hdr_cd_values array */
+    if (0 == (hdr_bits = Z zfp_write_header(dummy_zstr, dummy_field, ZFP_HEADER_FULL)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTINIT, 0, "unable to write header");
+
+    /* Flush the ZFP stream */
+    Z zfp_stream_flush(dummy_zstr);
 
     /* compute necessary hdr_cd_values size */
     hdr_bytes     = 1 + ((hdr_bits  - 1) / 8);
-    hdr_cd_nelmts = 1 + ((hdr_bytes - 1) / sizeof(hdr_cd_values[0]));
-    hdr_cd_nelmts++; /* for slot 0 holding version info */
+    *hdr_cd_nelmts = 1 + ((hdr_bytes - 1) / sizeof(hdr_cd_values[0]));
+    (*hdr_cd_nelmts)++; /* for slot 0 holding version info */
+
+    if (*hdr_cd_nelmts > H5Z_ZFP_CD_NELMTS_MAX)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "buffer overrun in hdr_cd_values");
+
+    info->zfp_mode = Z zfp_stream_mode(dummy_zstr);
+    info->zfp_meta = Z zfp_field_metadata(dummy_field);
+
+    if (use_memo)
+    {
+        memo.hdr_cd_nelmts = *hdr_cd_nelmts;
+        memcpy(memo.hdr_cd_values, hdr_cd_values, *hdr_cd_nelmts * sizeof(hdr_cd_values[0]));
+        memo.zfp_mode = info->zfp_mode;
+        memo.zfp_meta = info->zfp_meta;
+        h5z_zfp_memo_insert(&memo);
+    }
+
+    /* cleanup the dummy ZFP stuff we used to generate the header */
+    Z zfp_field_free(dummy_field); dummy_field = 0;
+    Z zfp_stream_close(dummy_zstr); dummy_zstr = 0;
+    B stream_close(dummy_bstr); dummy_bstr = 0;
+
+have_header:
+
+    /* the compact layout needs only the mode and meta just found */
+    if (0 < H5Pexist(dcpl_id, "zfp_compact_header"))
+    {
+        int compact = 0;
+        if (0 > H5Pget(dcpl_id, "zfp_compact_header", &compact))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "unable to get ZFP header layout");
+#ifdef ZFP_META_NULL
+        if (compact && info->zfp_meta == ZFP_META_NULL)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "chunk too large for ZFP meta word");
+#endif
+        if (compact)
+        {
+            h5z_zfp_compact_put(hdr_cd_values, info);
+            *hdr_cd_nelmts = H5Z_ZFP_CD_NELMTS_COMPACT;
+        }
+    }
+
+    /* integer pre-conditioning, ignored for floating point data */
+    if (dclass == H5T_INTEGER && 0 < H5Pexist(dcpl_id, "zfp_precond"))
+    {
+        if (0 > H5Pget(dcpl_id, "zfp_precond", &info->precond))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "unable to get ZFP pre-conditioning");
+        if ((info->precond & H5Z_ZFP_PRECOND_DELTA) &&
+            (have_zfp_controls ? ctrls.mode : mem_cd_values[0]) != H5Z_ZFP_MODE_REVERSIBLE)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1,
+                "delta pre-conditioning requires reversible mode");
+        if (info->precond)
+        {
+            if (*hdr_cd_nelmts >= H5Z_ZFP_CD_NELMTS_MAX)
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "buffer overrun in hdr_cd_values");
+            h5z_zfp_cd_version(hdr_cd_values, H5Z_ZFP_CD_VERSION_PRECOND);
+            hdr_cd_values[(*hdr_cd_nelmts)++] = H5Z_ZFP_PRECOND_TAG | info->precond;
+        }
+    }
+
+    /* per-chunk statistics, for any datatype */
+    if (0 < H5Pexist(dcpl_id, "zfp_cstats"))
+    {
+        if (0 > H5Pget(dcpl_id, "zfp_cstats", &info->cstats))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "unable to get ZFP chunk statistics");
+        if (info->cstats)
+        {
+            if (*hdr_cd_nelmts >= H5Z_ZFP_CD_NELMTS_MAX)
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "buffer overrun in hdr_cd_values");
+            h5z_zfp_cd_version(hdr_cd_values, H5Z_ZFP_CD_VERSION_CSTATS);
+            hdr_cd_values[(*hdr_cd_nelmts)++] = H5Z_ZFP_CSTATS_TAG | info->cstats;
+        }
+    }
+
+    /* a target of both a ratio and an error is tuned chunk by chunk */
+    if (have_zfp_controls ? ctrls.mode == H5Z_ZFP_MODE_TARGET &&
+                            ctrls.details.target.ratio > 0 && ctrls.details.target.err > 0
+                          : mem_cd_values[0] == H5Z_ZFP_MODE_TARGET &&
+                            mem_cd_dbl[0] > 0 && mem_cd_dbl[1] > 0)
+    {
+        if (*hdr_cd_nelmts >= H5Z_ZFP_CD_NELMTS_MAX)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "buffer overrun in hdr_cd_values");
+        info->target = H5Z_ZFP_TARGET_TUNE;
+        h5z_zfp_cd_version(hdr_cd_values, H5Z_ZFP_CD_VERSION_TARGET);
+        hdr_cd_values[(*hdr_cd_nelmts)++] = H5Z_ZFP_TARGET_TAG | info->target;
+    }
+
+    /* execution policy, so every write of the dataset uses it, whatever the thread */
+    if (0 < H5Pexist(dcpl_id, "zfp_execution"))
+    {
+        if (0 > H5Pget(dcpl_id, "zfp_execution", &info->exec))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "unable to get ZFP execution policy");
+        if (info->exec.policy == H5Z_ZFP_EXEC_SERIAL)
+        {
+            info->exec.nthreads = 0;
+            info->exec.chunk_blocks = 0;
+        }
+        else
+        {
+            if (*hdr_cd_nelmts + (info->exec.chunk_blocks ? 2 : 1) > H5Z_ZFP_CD_NELMTS_MAX)
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "buffer overrun in hdr_cd_values");
+            h5z_zfp_cd_version(hdr_cd_values, H5Z_ZFP_CD_VERSION_EXEC);
+            hdr_cd_values[(*hdr_cd_nelmts)++] = H5Z_ZFP_EXEC_TAG |
+                (unsigned int) info->exec.policy | (info->exec.nthreads << 4);
+            if (info->exec.chunk_blocks)
+                hdr_cd_values[(*hdr_cd_nelmts)++] = H5Z_ZFP_EXEC_BLOCKS_TAG | info->exec.chunk_blocks;
+        }
+    }
+
+    retval = 1;
+
+done:
+
+    if (dummy_field) Z zfp_field_free(dummy_field);
+    if (dummy_zstr) Z zfp_stream_close(dummy_zstr);
+    if (dummy_bstr) B stream_close(dummy_bstr);
+    return retval;
+}
+
+static void
+h5z_zfp_env_init(void)
+{
+    h5z_zfp_exec_env();
+    h5z_zfp_pool_env();
+    h5z_zfp_mem_limit_env();
+    h5z_zfp_inplace_env();
+    h5z_zfp_stats_env();
+    h5z_zfp_read_prec_env();
+    h5z_zfp_chunk_check_env();
+}
+
+static herr_t
+H5Z_zfp_set_local(hid_t dcpl_id, hid_t type_id, hid_t chunk_space_id)
+{   
+    static char const *_funcname_ = "H5Z_zfp_set_local";
+    int ndims, ndims_used;
+    size_t dsize;
+    size_t hdr_cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX;
+    unsigned int hdr_cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    unsigned int flags = 0;
+    herr_t retval = 0;
+    hsize_t dims[H5S_MAX_RANK], dims_used[H5S_MAX_RANK];
+    H5T_class_t dclass;
+    zfp_type zt;
+    h5z_zfp_info_t info = {0, 0, H5T_ORDER_NONE, 0, 0, 0, {H5Z_ZFP_EXEC_SERIAL, 0, 0}};
+
+    H5Z_zfp_init();
+
+    if (0 > (dclass = H5Tget_class(type_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a datatype");
+
+    if (0 == (dsize = H5Tget_size(type_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a datatype");
+
+    if (0 > (ndims = H5Sget_simple_extent_dims(chunk_space_id, dims, 0)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a data space");
+
+    /* setup zfp data type for meta header */
+    if (dclass == H5T_FLOAT)
+    {
+        zt = (dsize == 4) ? zfp_type_float : zfp_type_double;
+    }
+    else if (dclass == H5T_INTEGER)
+    {
+        zt = (dsize == 4) ? zfp_type_int32 : zfp_type_int64;
+    }
+    else
+    {
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0,
+            "datatype class must be H5T_FLOAT or H5T_INTEGER");
+    }
+
+    /* computed used (e.g. non-unity) dimensions in chunk */
+    ndims_used = h5z_zfp_field_dims(ndims, dims, dims_used);
+
+    if (1 != (retval = h5z_zfp_header(dcpl_id, dclass, zt, ndims_used, dims_used,
+                           &flags, &hdr_cd_nelmts, hdr_cd_values, &info)))
+        goto done;
+
+    /* Now, update cd_values for the filter */
+    if (0 > H5Pmodify_filter(dcpl_id, H5Z_FILTER_ZFP, flags, hdr_cd_nelmts, hdr_cd_values))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
+            "failed to modify cd_values");
+
+    /* Seed the cache so the filter needn't decode the header we just wrote */
+    h5z_zfp_cache_insert(hdr_cd_nelmts, hdr_cd_values, &info);
+
+    retval = 1;
+
+done:
+
+    return retval;
+}
+
+static int
+get_zfp_info_from_cd_values_0x0030(size_t cd_nelmts, unsigned int const *cd_values,
+    uint64 *zfp_mode, uint64 *zfp_meta, H5T_order_t *swap, size_t *hdr_bits, int push)
+{
+    static char const *_funcname_ = "get_zfp_info_from_cd_values_0x0030";
+    unsigned int cd_values_copy[H5Z_ZFP_CD_NELMTS_MAX];
+    int retval = 0;
+    bitstream *bstr = 0;
+    zfp_stream *zstr = 0;
+    zfp_field *zfld = 0;
+
+    if (cd_nelmts > H5Z_ZFP_CD_NELMTS_MAX)
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_OVERFLOW, 0, "cd_nelmts exceeds max");
+
+    /* make a copy of cd_values in case we need to byte-swap it */
+    memcpy(cd_values_copy, cd_values, cd_nelmts * sizeof(cd_values[0]));
+
+    /* treat the cd_values as a zfp bitstream buffer */
+    if (0 == (bstr = B stream_open(&cd_values_copy[0], sizeof(cd_values_copy[0]) * cd_nelmts)))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, 0, "opening header bitstream failed");
+
+    if (0 == (zstr = Z zfp_stream_open(bstr)))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, 0, "opening header zfp stream failed");
+
+    /* Allocate the field object */
+    if (0 == (zfld = Z zfp_field_alloc()))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, 0, "allocating field failed");
+
+    /* Read ZFP header */
+    if (0 == (*hdr_bits = Z zfp_read_header(zstr, zfld, ZFP_HEADER_FULL)))
+    {
+        size_t i;
+
+        /* The read may have failed due to difference in endian-ness between
+           writer and reader. So, byte-swap cd_values array, rewind the stream and re-try. */
+        *swap = h5z_zfp_native_order();
+        for (i = 0; i < cd_nelmts; i++)
+        {
+            unsigned int v = cd_values_copy[i];
+            cd_values_copy[i] = (v >> 24) | ((v >> 8) & 0xFF00) | ((v & 0xFF00) << 8) | (v << 24);
+        }
+
+        Z zfp_stream_rewind(zstr);
+        if (0 == (*hdr_bits = Z zfp_read_header(zstr, zfld, ZFP_HEADER_FULL)))
+            H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_CANTGET, 0, "reading header failed");
+    }
+
+    /* Get ZFP stream mode and field meta */
+    *zfp_mode = Z zfp_stream_mode(zstr);
+    *zfp_meta = Z zfp_field_metadata(zfld);
+
+    /* cleanup */
+    Z zfp_field_free(zfld); zfld = 0;
+    Z zfp_stream_close(zstr); zstr = 0;
+    B stream_close(bstr); bstr = 0;
+    retval = 1;
+
+done:
+    if (zfld) Z zfp_field_free(zfld);
+    if (zstr) Z zfp_stream_close(zstr);
+    if (bstr) B stream_close(bstr);
+
+    return retval;
+}
+
+/* Decode the compact layout. Returns 0 if cd_values aren't in it and -1 on failure. */
+static int
+get_zfp_info_from_cd_values_compact(size_t cd_nelmts, unsigned int const *cd_values,
+    h5z_zfp_info_t *info, int push)
+{
+    unsigned int const marker = cd_nelmts >= H5Z_ZFP_CD_NELMTS_COMPACT ? cd_values[1] : 0;
+    unsigned int const order = marker & 0xFF;
+    H5T_order_t const native = h5z_zfp_native_order();
+
+    if ((marker & 0xFFFF0000) != H5Z_ZFP_COMPACT_TAG)
+        return 0;
+
+    if (((marker >> 8) & 0xFF) != ZFP_CODEC ||
+        (order != H5Z_ZFP_COMPACT_LE && order != H5Z_ZFP_COMPACT_BE))
+    {
+        if (push)
+            H5Epush(H5E_DEFAULT, __FILE__, "", __LINE__, H5Z_ZFP_ERRCLASS, H5E_PLINE, H5E_BADVALUE,
+                "unsupported ZFP codec or byte order in compact header: 0x%x", marker);
+        return -1;
+    }
+
+    info->zfp_mode = (uint64) cd_values[2] | ((uint64) cd_values[3] << 32);
+    info->zfp_meta = (uint64) cd_values[4] | ((uint64) cd_values[5] << 32);
+
+    /* as for the ZFP header, swap is the reader's order when the writer's differs */
+    if ((order == H5Z_ZFP_COMPACT_BE) != (native == H5T_ORDER_BE))
+        info->swap = native;
+    return 1;
+}
+
+/* Decode cd_values for ZFP info for various versions of this filter. Errors are
+   pushed only if push. */
+static int
+get_zfp_info_from_cd_values(size_t cd_nelmts, unsigned int const *cd_values,
+    h5z_zfp_info_t *info, int push)
+{
+    unsigned int const h5z_zfp_version_no = cd_values[0]&0x0000FFFF;
+    size_t hdr_bits, first;
+    int compact;
+
+    H5Z_zfp_init();
+
+    /* All chunks of a dataset share cd_values, so we usually have this already */
+    if (h5z_zfp_cache_lookup(cd_nelmts, cd_values, info))
+        return 1;
+
+    /* Pass &cd_values[1] here to strip off first entry holding version info */
+    if (0x0020 <= h5z_zfp_version_no && h5z_zfp_version_no <= H5Z_ZFP_CD_VERSION_NEWEST)
+    {
+        info->swap = H5T_ORDER_NONE;
+        info->precond = 0;
+        info->cstats = 0;
+        info->target = 0;
+        info->exec.policy = H5Z_ZFP_EXEC_SERIAL;
+        info->exec.nthreads = 0;
+        info->exec.chunk_blocks = 0;
+
+        /* Since format 0x0110, cd_values may hold the mode and meta words themselves */
+        compact = h5z_zfp_version_no >= H5Z_ZFP_CD_VERSION_COMPACT ?
+            get_zfp_info_from_cd_values_compact(cd_nelmts, cd_values, info, push) : 0;
+        if (compact < 0)
+            return 0;
+        if (compact)
+            first = H5Z_ZFP_CD_NELMTS_COMPACT;
+        else if (0 == get_zfp_info_from_cd_values_0x0030(cd_nelmts-1, &cd_values[1],
+                     &info->zfp_mode, &info->zfp_meta, &info->swap, &hdr_bits, push))
+            return 0;
+        else
+            first = 2 + (hdr_bits - 1) / (8 * sizeof(cd_values[0]));
+
+        /* Since format 0x0090, tagged words after the ZFP header hold
+           pre-conditioning, since 0x0100, chunk statistics flags, since
+           0x0120, the execution policy and, since 0x0130, target tuning */
+        if (h5z_zfp_version_no >= H5Z_ZFP_CD_VERSION_PRECOND)
+        {
+            size_t i;
+            for (i = first; i < cd_nelmts; i++)
+            {
+                unsigned int const w = cd_values[i];
+                if ((w & 0xFFFF0000) == H5Z_ZFP_PRECOND_TAG)
+                    info->precond = w & 0x0000FFFF;
+                else if ((w & 0xFFFF0000) == H5Z_ZFP_CSTATS_TAG)
+                    info->cstats = w & 0x0000FFFF;
+                else if ((w & 0xFFFF0000) == H5Z_ZFP_EXEC_TAG &&
+                         ((w & 0xF) == H5Z_ZFP_EXEC_OMP || (w & 0xF) == H5Z_ZFP_EXEC_CUDA))
+                {
+                    info->exec.policy = (int) (w & 0xF);
+                    info->exec.nthreads = (w & 0x0000FFFF) >> 4;
+                }
+                else if ((w & 0xFFFF0000) == H5Z_ZFP_EXEC_BLOCKS_TAG)
+                    info->exec.chunk_blocks = w & 0x0000FFFF;
+                else if ((w & 0xFFFF0000) == H5Z_ZFP_TARGET_TAG && (w & 0x0000FFFF) == H5Z_ZFP_TARGET_TUNE)
+                    info->target = w & 0x0000FFFF;
+                else
+                {
+                    if (push)
+                        H5Epush(H5E_DEFAULT, __FILE__, "", __LINE__, H5Z_ZFP_ERRCLASS, H5E_PLINE, H5E_BADVALUE,
+                            "unrecognized cd_values word after ZFP header: 0x%x", w);
+                    return 0;
+                }
+            }
+        }
+        h5z_zfp_cache_insert(cd_nelmts, cd_values, info);
+        return 1;
+    }
+
+    if (push)
+        H5Epush(H5E_DEFAULT, __FILE__, "", __LINE__, H5Z_ZFP_ERRCLASS, H5E_PLINE, H5E_BADVALUE,
+            "version mismatch: (file) 0x0%x <-> 0x0%x (code)", h5z_zfp_version_no, H5Z_ZFP_CD_VERSION_NEWEST);
+
+    return 0;
+}
+
+/* Byte-swap kernels used to undo endian-ness right after decoding each block
+   row, while it is still in cache, instead of in a second pass over the whole
+   chunk with H5Tconvert. On x86, with GCC or Clang, the AVX2 and SSSE3 versions
+   are always compiled, each for its own target, and the one to use is picked
+   at run time from what the CPU supports. So, a build for the baseline ISA
+   still gets them. Other compilers use them only if they target them. NEON is
+   used when the compiler targets it. */
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define H5Z_ZFP_X86_AVX2  1
+#define H5Z_ZFP_X86_SSSE3 1
+#define H5Z_ZFP_TARGET_AVX2  __attribute__((target("avx2")))
+#define H5Z_ZFP_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#if defined(__AVX2__)
+#define H5Z_ZFP_X86_AVX2  1
+#endif
+#if defined(__SSSE3__) || defined(__AVX2__)
+#define H5Z_ZFP_X86_SSSE3 1
+#endif
+#define H5Z_ZFP_TARGET_AVX2
+#define H5Z_ZFP_TARGET_SSSE3
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+/* Whether the CPU runs the AVX2 or SSSE3 kernels. The checks are a load of
+   what libgcc found at start up, so they are made on every call. */
+#if defined(__AVX2__) || !defined(__GNUC__)
+#define H5Z_ZFP_CPU_AVX2  1
+#else
+#define H5Z_ZFP_CPU_AVX2  __builtin_cpu_supports("avx2")
+#endif
+#if defined(__SSSE3__) || !defined(__GNUC__)
+#define H5Z_ZFP_CPU_SSSE3 1
+#else
+#define H5Z_ZFP_CPU_SSSE3 __builtin_cpu_supports("ssse3")
+#endif
+
+/* The SIMD kernels below work through the start of their buffer and return
+   how far they got. The caller finishes off the rest. */
+#if defined(H5Z_ZFP_X86_AVX2)
+H5Z_ZFP_TARGET_AVX2 static size_t
+h5z_zfp_bswap32_avx2(uint32 *p, size_t n)
+{
+    size_t i = 0;
+    __m256i const m = _mm256_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3,
+                                      12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *) (p+i), _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *) (p+i)), m));
+    return i;
+}
+
+H5Z_ZFP_TARGET_AVX2 static size_t
+h5z_zfp_bswap64_avx2(uint64 *p, size_t n)
+{
+    size_t i = 0;
+    __m256i const m = _mm256_set_epi8(8,9,10,11,12,13,14,15, 0,1,2,3,4,5,6,7,
+                                      8,9,10,11,12,13,14,15, 0,1,2,3,4,5,6,7);
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_si256((__m256i *) (p+i), _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i *) (p+i)), m));
+    return i;
+}
+#endif
+
+#if defined(H5Z_ZFP_X86_SSSE3)
+H5Z_ZFP_TARGET_SSSE3 static size_t
+h5z_zfp_bswap32_ssse3(uint32 *p, size_t n)
+{
+    size_t i = 0;
+    __m128i const m = _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *) (p+i), _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (p+i)), m));
+    return i;
+}
+
+H5Z_ZFP_TARGET_SSSE3 static size_t
+h5z_zfp_bswap64_ssse3(uint64 *p, size_t n)
+{
+    size_t i = 0;
+    __m128i const m = _mm_set_epi8(8,9,10,11,12,13,14,15, 0,1,2,3,4,5,6,7);
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_si128((__m128i *) (p+i), _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (p+i)), m));
+    return i;
+}
+#endif
+
+static void
+h5z_zfp_bswap32(uint32 *p, size_t n)
+{
+    size_t i = 0;
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (H5Z_ZFP_CPU_AVX2)
+        i = h5z_zfp_bswap32_avx2(p, n);
+    else
+#endif
+#if defined(H5Z_ZFP_X86_SSSE3)
+    if (H5Z_ZFP_CPU_SSSE3)
+        i = h5z_zfp_bswap32_ssse3(p, n);
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 4 <= n; i += 4)
+        vst1q_u8((uint8_t *) (p+i), vrev32q_u8(vld1q_u8((uint8_t *) (p+i))));
+#endif
+    for (; i < n; i++)
+    {
+        uint32 v = p[i];
+        p[i] = (v >> 24) | ((v >> 8) & 0x0000FF00) | ((v << 8) & 0x00FF0000) | (v << 24);
+    }
+}
+
+static void
+h5z_zfp_bswap64(uint64 *p, size_t n)
+{
+    size_t i = 0;
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (H5Z_ZFP_CPU_AVX2)
+        i = h5z_zfp_bswap64_avx2(p, n);
+    else
+#endif
+#if defined(H5Z_ZFP_X86_SSSE3)
+    if (H5Z_ZFP_CPU_SSSE3)
+        i = h5z_zfp_bswap64_ssse3(p, n);
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for (; i + 2 <= n; i += 2)
+        vst1q_u8((uint8_t *) (p+i), vrev64q_u8(vld1q_u8((uint8_t *) (p+i))));
+#endif
+    for (; i < n; i++)
+    {
+        uint64 v = p[i];
+        v = ((v & 0x00000000FFFFFFFFULL) << 32) | (v >> 32);
+        v = ((v & 0x0000FFFF0000FFFFULL) << 16) | ((v >> 16) & 0x0000FFFF0000FFFFULL);
+        p[i] = ((v & 0x00FF00FF00FF00FFULL) << 8) | ((v >> 8) & 0x00FF00FF00FF00FFULL);
+    }
+}
+
+static void
+h5z_zfp_bswap(void *p, size_t n, size_t dsize)
+{
+    if (dsize == 4)
+        h5z_zfp_bswap32((uint32 *) p, n);
+    else
+        h5z_zfp_bswap64((uint64 *) p, n);
+}
+
+/* Integer pre-conditioning (H5Pset_zfp_int_precondition). Before compression,
+   a chunk of integers may be differenced (DELTA) and then shifted by its
+   mid-range value (OFFSET) so it is centered on zero and ZFP has fewer bit
+   planes to code. An int64 chunk whose range fits in 31 bits is then
+   compressed as int32 (NARROW). What was actually done to the chunk, and the
+   offset, are recorded in a small trailer after the ZFP stream. The inverse is
+   applied right after decoding, widening in place. The min/max scan, offset and
+   narrow/widen kernels have AVX2 versions, picked at run time like the byte
+   swaps'. Undoing the delta is a prefix sum and stays scalar. Arithmetic is
+   done unsigned so that it wraps and round-trips exactly. */
+#define H5Z_ZFP_TRAILER_SIZE  16
+#define H5Z_ZFP_TRAILER_MAGIC 0x5a504331 /* "ZPC1" */
+
+typedef struct _h5z_zfp_precond_t {
+    unsigned int flags;         /* pre-conditioning applied to this chunk */
+    int64 offset;               /* subtracted from every value if OFFSET */
+} h5z_zfp_precond_t;
+
+#if defined(H5Z_ZFP_X86_AVX2)
+/* n >= 8; *mn and *mx start as p[0] */
+H5Z_ZFP_TARGET_AVX2 static size_t
+h5z_zfp_minmax32_avx2(int32 const *p, size_t n, int32 *mn, int32 *mx)
+{
+    size_t i, k;
+    int32 t[8];
+    __m256i vmn = _mm256_loadu_si256((__m256i const *) p), vmx = vmn;
+    for (i = 8; i + 8 <= n; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((__m256i const *) (p+i));
+        vmn = _mm256_min_epi32(vmn, v);
+        vmx = _mm256_max_epi32(vmx, v);
+    }
+    _mm256_storeu_si256((__m256i *) t, vmn);
+    for (k = 0; k < 8; k++) if (t[k] < *mn) *mn = t[k];
+    _mm256_storeu_si256((__m256i *) t, vmx);
+    for (k = 0; k < 8; k++) if (t[k] > *mx) *mx = t[k];
+    return i;
+}
+
+/* n >= 4; *mn and *mx start as p[0] */
+H5Z_ZFP_TARGET_AVX2 static size_t
+h5z_zfp_minmax64_avx2(int64 const *p, size_t n, int64 *mn, int64 *mx)
+{
+    size_t i, k;
+    long long t[4];
+    __m256i vmn = _mm256_loadu_si256((__m256i const *) p), vmx = vmn;
+    for (i = 4; i + 4 <= n; i += 4)
+    {
+        __m256i v = _mm256_loadu_si256((__m256i const *) (p+i));
+        vmn = _mm256_blendv_epi8(vmn, v, _mm256_cmpgt_epi64(vmn, v));
+        vmx = _mm256_blendv_epi8(vmx, v, _mm256_cmpgt_epi64(v, vmx));
+    }
+    _mm256_storeu_si256((__m256i *) t, vmn);
+    for (k = 0; k < 4; k++) if (t[k] < *mn) *mn = t[k];
+    _mm256_storeu_si256((__m256i *) t, vmx);
+    for (k = 0; k < 4; k++) if (t[k] > *mx) *mx = t[k];
+    return i;
+}
+
+/* these start at i = 1 */
+H5Z_ZFP_TARGET_AVX2 static size_t
+h5z_zfp_delta32_avx2(int32 *q, int32 const *p, size_t n)
+{
+    size_t i = 1;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *) (q+i),
+            _mm256_sub_epi32(_mm256_loadu_si256((__m256i const *) (p+i)),
+                             _mm256_loadu_si256((__m256i const *) (p+i-1))));
+    return i;
+}
+
+H5Z_ZFP_TARGET_AVX2 static size_t
+h5z_zfp_delta64_avx2(int64 *q, int64 const *p, size_t n)
+{
+    size_t i = 1;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_si256((__m256i *) (q+i),
+            _mm256_sub_epi64(_mm256_loadu_si256((__m256i const *) (p+i)),
+                             _mm256_loadu_si256((__m256i const *) (p+i-1))));
+    return i;
+}
+
+H5Z_ZFP_TARGET_AVX2 static size_t
+h5z_zfp_offset32_avx2(int32 *q, int32 const *p, size_t n, int64 off)
+{
+    size_t i = 0;
+    __m256i const o = _mm256_set1_epi32((int) off);
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_si256((__m256i *) (q+i),
+            _mm256_sub_epi32(_mm256_loadu_si256((__m256i const *) (p+i)), o));
+    return i;
+}
+
+H5Z_ZFP_TARGET_AVX2 static size_t
+h5z_zfp_offset64_avx2(int64 *q, int64 const *p, size_t n, int64 off)
+{
+    size_t i = 0;
+    __m256i const o = _mm256_set1_epi64x((long long) off);
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_si256((__m256i *) (q+i),
+            _mm256_sub_epi64(_mm256_loadu_si256((__m256i const *) (p+i)), o));
+    return i;
+}
+
+H5Z_ZFP_TARGET_AVX2 static size_t
+h5z_zfp_narrow64_avx2(void *q, void const *p, size_t n, int64 off)
+{
+    size_t i = 0;
+    __m256i const o = _mm256_set1_epi64x((long long) off);
+    __m256i const lo32 = _mm256_set_epi32(7,5,3,1, 6,4,2,0);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256i v = _mm256_sub_epi64(_mm256_loadu_si256((__m256i const *) ((int64 const *) p + i)), o);
+        _mm_storeu_si128((__m128i *) ((int32 *) q + i),
+            _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(v, lo32)));
+    }
+    return i;
+}
+
+/* widens the first n values, n a multiple of 4, working backwards */
+H5Z_ZFP_TARGET_AVX2 static void
+h5z_zfp_widen32_avx2(void *p, size_t n, int64 off)
+{
+    size_t i = n;
+    __m256i const o = _mm256_set1_epi64x((long long) off);
+    while (i > 0)
+    {
+        i -= 4;
+        _mm256_storeu_si256((__m256i *) ((int64 *) p + i), _mm256_add_epi64(
+            _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i const *) ((int32 *) p + i))), o));
+    }
+}
+#endif
+
+static void
+h5z_zfp_minmax32(int32 const *p, size_t n, int64 *lo, int64 *hi)
+{
+    size_t i = 0;
+    int32 mn = p[0], mx = p[0];
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (n >= 8 && H5Z_ZFP_CPU_AVX2)
+        i = h5z_zfp_minmax32_avx2(p, n, &mn, &mx);
+#endif
+    for (; i < n; i++)
+    {
+        if (p[i] < mn) mn = p[i];
+        if (p[i] > mx) mx = p[i];
+    }
+    *lo = mn;
+    *hi = mx;
+}
+
+static void
+h5z_zfp_minmax64(int64 const *p, size_t n, int64 *lo, int64 *hi)
+{
+    size_t i = 0;
+    int64 mn = p[0], mx = p[0];
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (n >= 4 && H5Z_ZFP_CPU_AVX2)
+        i = h5z_zfp_minmax64_avx2(p, n, &mn, &mx);
+#endif
+    for (; i < n; i++)
+    {
+        if (p[i] < mn) mn = p[i];
+        if (p[i] > mx) mx = p[i];
+    }
+    *lo = mn;
+    *hi = mx;
+}
+
+/* q[i] = p[i] - p[i-1], q[0] = p[0]; q and p must not overlap */
+static void
+h5z_zfp_delta32(int32 *q, int32 const *p, size_t n)
+{
+    size_t i = 1;
+    q[0] = p[0];
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (H5Z_ZFP_CPU_AVX2)
+        i = h5z_zfp_delta32_avx2(q, p, n);
+#endif
+    for (; i < n; i++)
+        q[i] = (int32) ((uint32) p[i] - (uint32) p[i-1]);
+}
+
+static void
+h5z_zfp_delta64(int64 *q, int64 const *p, size_t n)
+{
+    size_t i = 1;
+    q[0] = p[0];
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (H5Z_ZFP_CPU_AVX2)
+        i = h5z_zfp_delta64_avx2(q, p, n);
+#endif
+    for (; i < n; i++)
+        q[i] = (int64) ((uint64) p[i] - (uint64) p[i-1]);
+}
+
+static void
+h5z_zfp_undelta32(int32 *p, size_t n)
+{
+    size_t i;
+    for (i = 1; i < n; i++)
+        p[i] = (int32) ((uint32) p[i] + (uint32) p[i-1]);
+}
+
+static void
+h5z_zfp_undelta64(int64 *p, size_t n)
+{
+    size_t i;
+    for (i = 1; i < n; i++)
+        p[i] = (int64) ((uint64) p[i] + (uint64) p[i-1]);
+}
+
+/* q[i] = p[i] - off; q may be p */
+static void
+h5z_zfp_offset32(int32 *q, int32 const *p, size_t n, int64 off)
+{
+    size_t i = 0;
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (H5Z_ZFP_CPU_AVX2)
+        i = h5z_zfp_offset32_avx2(q, p, n, off);
+#endif
+    for (; i < n; i++)
+        q[i] = (int32) ((uint32) p[i] - (uint32) off);
+}
+
+static void
+h5z_zfp_offset64(int64 *q, int64 const *p, size_t n, int64 off)
+{
+    size_t i = 0;
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (H5Z_ZFP_CPU_AVX2)
+        i = h5z_zfp_offset64_avx2(q, p, n, off);
+#endif
+    for (; i < n; i++)
+        q[i] = (int64) ((uint64) p[i] - (uint64) off);
+}
+
+/* int64 at p less off to int32 at q. q may be p, in which case this works
+   forwards through the buffer. Elements are moved with memcpy because the two
+   types then share storage. */
+static void
+h5z_zfp_narrow64(void *q, void const *p, size_t n, int64 off)
+{
+    size_t i = 0;
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (H5Z_ZFP_CPU_AVX2)
+        i = h5z_zfp_narrow64_avx2(q, p, n, off);
+#endif
+    for (; i < n; i++)
+    {
+        int64 v;
+        int32 w;
+        memcpy(&v, (int64 const *) p + i, sizeof(v));
+        w = (int32) ((uint64) v - (uint64) off);
+        memcpy((int32 *) q + i, &w, sizeof(w));
+    }
+}
+
+/* int32 at the start of p plus off to int64 filling p, working backwards. The
+   last n % 4 values go first, then the SIMD kernel, if used, does the rest. */
+static void
+h5z_zfp_widen32(void *p, size_t n, int64 off)
+{
+    size_t i = n, m = 0;
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (H5Z_ZFP_CPU_AVX2)
+        m = n - n % 4;
+#endif
+    while (i > m)
+    {
+        int32 w;
+        int64 v;
+        i--;
+        memcpy(&w, (int32 *) p + i, sizeof(w));
+        v = (int64) ((uint64) (int64) w + (uint64) off);
+        memcpy((int64 *) p + i, &v, sizeof(v));
+    }
+#if defined(H5Z_ZFP_X86_AVX2)
+    if (m > 0)
+        h5z_zfp_widen32_avx2(p, m, off);
+#endif
+}
+
+/* Pre-condition the n integers of type *zt at in. flags are those requested.
+   The result, if any, goes to out, which has room for n values of type *zt.
+   Returns the flags applied, setting *zt to zfp_type_int32 if narrowed. When
+   nothing is applied, out is unused and in should be compressed as is. */
+static unsigned int
+h5z_zfp_precond_apply(void const *in, size_t n, zfp_type *zt, unsigned int flags,
+    int64 *offset, void *out)
+{
+    unsigned int done = 0;
+    void const *src = in;
+    int64 lo, hi;
+    uint64 range;
+
+    *offset = 0;
+    if (n == 0) return 0;
+
+    /* delta only in reversible mode; set_local sees to that */
+    if (flags & H5Z_ZFP_PRECOND_DELTA)
+    {
+        if (*zt == zfp_type_int32)
+            h5z_zfp_delta32((int32 *) out, (int32 const *) in, n);
+        else
+            h5z_zfp_delta64((int64 *) out, (int64 const *) in, n);
+        src = out;
+        done |= H5Z_ZFP_PRECOND_DELTA;
+    }
+
+    if (!(flags & (H5Z_ZFP_PRECOND_OFFSET | H5Z_ZFP_PRECOND_NARROW)))
+        return done;
+
+    if (*zt == zfp_type_int32)
+        h5z_zfp_minmax32((int32 const *) src, n, &lo, &hi);
+    else
+        h5z_zfp_minmax64((int64 const *) src, n, &lo, &hi);
+    range = (uint64) hi - (uint64) lo;
+    *offset = (int64) ((uint64) lo + range / 2);
+
+    /* centered values must stay within what ZFP accepts, [-2^30, 2^30) for int32 */
+    if (*zt == zfp_type_int64 && (flags & H5Z_ZFP_PRECOND_NARROW) && range < ((uint64) 1 << 31) - 1)
+    {
+        h5z_zfp_narrow64(out, src, n, *offset);
+        *zt = zfp_type_int32;
+        done |= H5Z_ZFP_PRECOND_NARROW | H5Z_ZFP_PRECOND_OFFSET;
+    }
+    else if (range < ((uint64) 1 << (*zt == zfp_type_int32 ? 31 : 63)) - 1)
+    {
+        if (*zt == zfp_type_int32)
+            h5z_zfp_offset32((int32 *) out, (int32 const *) src, n, *offset);
+        else
+            h5z_zfp_offset64((int64 *) out, (int64 const *) src, n, *offset);
+        done |= H5Z_ZFP_PRECOND_OFFSET;
+    }
+    else
+        *offset = 0;
+
+    return done;
+}
+
+/* Undo pre-conditioning of n values decoded at p, which has room for n values
+   of the chunk's type, zt. Values decoded narrowed are int32 at the start of p. */
+static void
+h5z_zfp_precond_undo(void *p, size_t n, zfp_type zt, h5z_zfp_precond_t const *pc)
+{
+    if (pc->flags & H5Z_ZFP_PRECOND_NARROW)
+        h5z_zfp_widen32(p, n, pc->offset);
+    else if ((pc->flags & H5Z_ZFP_PRECOND_OFFSET) && zt == zfp_type_int32)
+        h5z_zfp_offset32((int32 *) p, (int32 const *) p, n, (int64) (0 - (uint64) pc->offset));
+    else if (pc->flags & H5Z_ZFP_PRECOND_OFFSET)
+        h5z_zfp_offset64((int64 *) p, (int64 const *) p, n, (int64) (0 - (uint64) pc->offset));
+
+    if (!(pc->flags & H5Z_ZFP_PRECOND_DELTA))
+        return;
+    if (zt == zfp_type_int32)
+        h5z_zfp_undelta32((int32 *) p, n);
+    else
+        h5z_zfp_undelta64((int64 *) p, n);
+}
+
+/* Trailer: offset (8 bytes), flags (4 bytes), magic (4 bytes), little-endian */
+static void
+h5z_zfp_trailer_put(unsigned char *t, h5z_zfp_precond_t const *pc)
+{
+    uint64 off = (uint64) pc->offset;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        t[i] = (unsigned char) (off >> (8*i));
+    for (i = 0; i < 4; i++)
+        t[8+i] = (unsigned char) (pc->flags >> (8*i));
+    for (i = 0; i < 4; i++)
+        t[12+i] = (unsigned char) ((uint32) H5Z_ZFP_TRAILER_MAGIC >> (8*i));
+}
+
+static int
+h5z_zfp_trailer_get(void const *zbuf, size_t zsize, h5z_zfp_precond_t *pc)
+{
+    unsigned char const *t;
+    uint64 off = 0;
+    uint32 magic = 0;
+    int i;
+
+    if (zsize < H5Z_ZFP_TRAILER_SIZE)
+        return 0;
+    t = (unsigned char const *) zbuf + zsize - H5Z_ZFP_TRAILER_SIZE;
+    for (i = 0; i < 4; i++)
+        magic |= (uint32) t[12+i] << (8*i);
+    if (magic != H5Z_ZFP_TRAILER_MAGIC)
+        return 0;
+    for (i = 0; i < 8; i++)
+        off |= (uint64) t[i] << (8*i);
+    pc->offset = (int64) off;
+    pc->flags = 0;
+    for (i = 0; i < 4; i++)
+        pc->flags |= (unsigned int) t[8+i] << (8*i);
+    return !(pc->flags & ~(unsigned int) (H5Z_ZFP_PRECOND_OFFSET |
+        H5Z_ZFP_PRECOND_NARROW | H5Z_ZFP_PRECOND_DELTA));
+}
+
+/* Per-chunk statistics (H5Pset_zfp_chunk_stats). The min, max and mean of a
+   chunk's values are taken as it is compressed, before any pre-conditioning.
+   With H5Z_ZFP_CSTATS_ERROR, the chunk is then decoded again to find the max
+   absolute error of its compressed values. All are recorded, as doubles, in a
+   record right after the ZFP stream. That is ahead of any pre-conditioning
+   trailer, which must stay last, and where ZFP never reads. So, decompression
+   doesn't need to know about it. Only H5Z_zfp_chunk_stats_get reads it. */
+#define H5Z_ZFP_CSTATS_SIZE  40
+#define H5Z_ZFP_CSTATS_MAGIC 0x5a535431 /* "ZST1" */
+
+#define H5Z_ZFP_CSTATS_SCAN(T)                                  \
+{                                                               \
+    T const *q = (T const *) p;                                 \
+    T lo = q[0], hi = q[0];                                     \
+    double sum = 0;                                             \
+    for (i = 0; i < n; i++)                                     \
+    {                                                           \
+        if (q[i] < lo) lo = q[i];                               \
+        if (q[i] > hi) hi = q[i];                               \
+        sum += (double) q[i];                                   \
+    }                                                           \
+    st->min = (double) lo;                                      \
+    st->max = (double) hi;                                      \
+    st->mean = sum / (double) n;                                \
+}
+
+static void
+h5z_zfp_cstats_scan(void const *p, size_t n, zfp_type zt, H5Z_zfp_chunk_stats_t *st)
+{
+    size_t i;
+
+    st->min = st->max = st->mean = st->maxerr = 0;
+    st->flags = H5Z_ZFP_CSTATS_RANGE;
+    if (n == 0)
+        return;
+    switch (zt)
+    {
+        case zfp_type_int32:  H5Z_ZFP_CSTATS_SCAN(int32);  break;
+        case zfp_type_int64:  H5Z_ZFP_CSTATS_SCAN(int64);  break;
+        case zfp_type_float:  H5Z_ZFP_CSTATS_SCAN(float);  break;
+        case zfp_type_double: H5Z_ZFP_CSTATS_SCAN(double); break;
+        default: st->flags = 0; break;
+    }
+}
+
+#define H5Z_ZFP_CSTATS_DIFF(T)                                  \
+{                                                               \
+    T const *a = (T const *) orig, *b = (T const *) dec;        \
+    for (i = 0; i < n; i++)                                     \
+    {                                                           \
+        double d = a[i] > b[i] ? (double) a[i] - (double) b[i]  \
+                               : (double) b[i] - (double) a[i]; \
+        if (d > err) err = d;                                   \
+    }                                                           \
+}
+
+/* Max absolute error of the zsize bytes in zbuf zstr compressed zfld's data to.
+   Decodes serially into scratch space and leaves zfld pointing at its data.
+   Returns -1 if the chunk can't be decoded. */
+static double
+h5z_zfp_cstats_maxerr(zfp_stream *zstr, zfp_field *zfld, void *zbuf, size_t zsize)
+{
+    zfp_type zt = Z zfp_field_type(zfld);
+    size_t i, n = Z zfp_field_size(zfld, 0);
+    size_t dsize = (zt == zfp_type_int32 || zt == zfp_type_float) ? 4 : 8;
+    void *orig = Z zfp_field_pointer(zfld), *dec;
+    bitstream *bstr;
+    double err = 0;
+
+    if (0 == (dec = h5z_zfp_scratch_get(n * dsize)))
+        return -1;
+    if (0 == (bstr = B stream_open(zbuf, zsize)))
+    {
+        h5z_zfp_scratch_put(dec, n * dsize);
+        return -1;
+    }
+#if ZFP_VERSION_NO >= 0x0053
+    Z zfp_stream_set_execution(zstr, zfp_exec_serial);
+#endif
+    Z zfp_stream_set_bit_stream(zstr, bstr);
+    Z zfp_stream_rewind(zstr);
+    Z zfp_field_set_pointer(zfld, dec);
+    if (0 == Z zfp_decompress(zstr, zfld))
+        err = -1;
+    else switch (zt)
+    {
+        case zfp_type_int32:  H5Z_ZFP_CSTATS_DIFF(int32);  break;
+        case zfp_type_int64:  H5Z_ZFP_CSTATS_DIFF(int64);  break;
+        case zfp_type_float:  H5Z_ZFP_CSTATS_DIFF(float);  break;
+        case zfp_type_double: H5Z_ZFP_CSTATS_DIFF(double); break;
+        default: err = -1; break;
+    }
+    Z zfp_field_set_pointer(zfld, orig);
+    Z zfp_stream_set_bit_stream(zstr, 0);
+    B stream_close(bstr);
+    h5z_zfp_scratch_put(dec, n * dsize);
+    return err;
+}
+
+/* Record: min, max, mean and max error (8 byte IEEE doubles), flags (4 bytes),
+   magic (4 bytes), little-endian */
+static void
+h5z_zfp_cstats_put(unsigned char *t, H5Z_zfp_chunk_stats_t const *st)
+{
+    double const v[4] = {st->min, st->max, st->mean, st->maxerr};
+    int i, k;
+
+    for (k = 0; k < 4; k++)
+    {
+        uint64 u;
+        memcpy(&u, &v[k], sizeof(u));
+        for (i = 0; i < 8; i++)
+            t[8*k+i] = (unsigned char) (u >> (8*i));
+    }
+    for (i = 0; i < 4; i++)
+        t[32+i] = (unsigned char) (st->flags >> (8*i));
+    for (i = 0; i < 4; i++)
+        t[36+i] = (unsigned char) ((uint32) H5Z_ZFP_CSTATS_MAGIC >> (8*i));
+}
+
+static int
+h5z_zfp_cstats_get(unsigned char const *t, H5Z_zfp_chunk_stats_t *st)
+{
+    double v[4];
+    uint32 magic = 0;
+    int i, k;
 
-    if (hdr_cd_nelmts > H5Z_ZFP_CD_NELMTS_MAX)
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "buffer overrun in hdr_cd_values");
+    for (i = 0; i < 4; i++)
+        magic |= (uint32) t[36+i] << (8*i);
+    if (magic != H5Z_ZFP_CSTATS_MAGIC)
+        return 0;
+    for (k = 0; k < 4; k++)
+    {
+        uint64 u = 0;
+        for (i = 0; i < 8; i++)
+            u |= (uint64) t[8*k+i] << (8*i);
+        memcpy(&v[k], &u, sizeof(u));
+    }
+    st->min = v[0];
+    st->max = v[1];
+    st->mean = v[2];
+    st->maxerr = v[3];
+    st->flags = 0;
+    for (i = 0; i < 4; i++)
+        st->flags |= (unsigned int) t[32+i] << (8*i);
+    return 1;
+}
 
-    /* Now, update cd_values for the filter */
-    if (0 > H5Pmodify_filter(dcpl_id, H5Z_FILTER_ZFP, flags, hdr_cd_nelmts, hdr_cd_values))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
-            "failed to modify cd_values");
+/* The tolerance a tuned target mode chunk was compressed with is recorded after
+   any statistics record, ahead of any pre-conditioning trailer. Record: minexp
+   (4 bytes, two's complement), magic (4 bytes), little-endian */
+#define H5Z_ZFP_TARGET_SIZE  8
+#define H5Z_ZFP_TARGET_MAGIC 0x5a544731 /* "ZTG1" */
 
-    /* cleanup the dummy ZFP stuff we used to generate the header */
-    Z zfp_field_free(dummy_field); dummy_field = 0;
-    Z zfp_stream_close(dummy_zstr); dummy_zstr = 0;
-    B stream_close(dummy_bstr); dummy_bstr = 0;
+static void
+h5z_zfp_target_put(unsigned char *t, int minexp)
+{
+    uint32 u = (uint32) minexp;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        t[i] = (unsigned char) (u >> (8*i));
+    for (i = 0; i < 4; i++)
+        t[4+i] = (unsigned char) ((uint32) H5Z_ZFP_TARGET_MAGIC >> (8*i));
+}
+
+/* Find the record in the zsize bytes of a chunk at zbuf */
+static int
+h5z_zfp_target_get(void const *zbuf, size_t zsize, h5z_zfp_info_t const *info, int *minexp)
+{
+    size_t after = info->precond ? H5Z_ZFP_TRAILER_SIZE : 0;
+    unsigned char const *t;
+    uint32 u = 0, magic = 0;
+    int i;
+
+    if (zsize < H5Z_ZFP_TARGET_SIZE + after)
+        return 0;
+    t = (unsigned char const *) zbuf + zsize - after - H5Z_ZFP_TARGET_SIZE;
+    for (i = 0; i < 4; i++)
+        magic |= (uint32) t[4+i] << (8*i);
+    if (magic != H5Z_ZFP_TARGET_MAGIC)
+        return 0;
+    for (i = 0; i < 4; i++)
+        u |= (uint32) t[i] << (8*i);
+    *minexp = (int) (int32) u;
+    return *minexp >= ZFP_MIN_EXP;
+}
+
+/* Bytes a dataset's chunks carry after the ZFP stream */
+static size_t
+h5z_zfp_tail_size(h5z_zfp_info_t const *info)
+{
+    return (info->cstats ? H5Z_ZFP_CSTATS_SIZE : 0) + (info->target ? H5Z_ZFP_TARGET_SIZE : 0) +
+           (info->precond ? H5Z_ZFP_TRAILER_SIZE : 0);
+}
+
+/* Write the statistics record, tolerance record and/or pre-conditioning trailer
+   at t. minexp is the one the chunk was tuned to, if the dataset records it. */
+static void
+h5z_zfp_tail_put(unsigned char *t, h5z_zfp_info_t const *info,
+    H5Z_zfp_chunk_stats_t const *st, int minexp, h5z_zfp_precond_t const *pc)
+{
+    if (info->cstats)
+    {
+        h5z_zfp_cstats_put(t, st);
+        t += H5Z_ZFP_CSTATS_SIZE;
+    }
+    if (info->target)
+    {
+        h5z_zfp_target_put(t, minexp);
+        t += H5Z_ZFP_TARGET_SIZE;
+    }
+    if (info->precond)
+        h5z_zfp_trailer_put(t, pc);
+}
+
+/* Statistics recorded in the compressed chunk, zbuf of zsize bytes, of a dataset
+   with the given ZFP cd_values, as read with H5Dread_chunk. The chunk is not
+   decompressed. Returns 1 if found, 0 if the dataset doesn't record them and -1
+   on failure. */
+int H5Z_zfp_chunk_stats_get(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *zbuf, size_t zsize, H5Z_zfp_chunk_stats_t *stats)
+{
+    static char const *_funcname_ = "H5Z_zfp_chunk_stats_get";
+    h5z_zfp_info_t info;
+    size_t tsize;
+    int retval = -1;
+
+    H5Z_zfp_init();
+
+    if (!cd_values || !zbuf || !stats)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+
+    if (0 == get_zfp_info_from_cd_values(cd_nelmts, cd_values, &info, 1))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "can't get ZFP mode/meta");
+
+    if (!info.cstats)
+    {
+        retval = 0;
+        goto done;
+    }
+
+    tsize = h5z_zfp_tail_size(&info);
+    if (zsize < tsize ||
+        !h5z_zfp_cstats_get((unsigned char const *) zbuf + zsize - tsize, stats))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "missing ZFP chunk statistics");
 
     retval = 1;
 
 done:
+    return retval;
+}
 
-    if (dummy_field) Z zfp_field_free(dummy_field);
-    if (dummy_zstr) Z zfp_stream_close(dummy_zstr);
-    if (dummy_bstr) B stream_close(dummy_bstr);
+/* Decode a (contiguous) field block by block in the same order zfp_decompress
+   does, byte-swapping each row of blocks as soon as it is complete. 1D fields
+   are swapped in strips of H5Z_ZFP_SWAP_STRIP values. */
+#define H5Z_ZFP_SWAP_STRIP 4096
+
+#define H5Z_ZFP_DECODE_ROWS(T, S)                                                   \
+static void                                                                         \
+h5z_zfp_decode_rows_##S(zfp_stream *zstr, T *data, uint dims,                       \
+    uint nx, uint ny, uint nz, int swap)                                            \
+{                                                                                   \
+    int const sx = 1, sy = (int) nx, sz = (int) (nx*ny);                            \
+    uint x, y, z, j, k;                                                             \
+                                                                                    \
+    if (dims == 1)                                                                  \
+    {                                                                               \
+        uint x0 = 0;                                                                \
+        for (x = 0; x < nx; x += 4)                                                 \
+        {                                                                           \
+            if (nx - x < 4)                                                         \
+                Z zfp_decode_partial_block_strided_##S##_1(zstr, data+x, nx-x, sx); \
+            else                                                                    \
+                Z zfp_decode_block_##S##_1(zstr, data+x);                           \
+            if (swap && (x+4 - x0 >= H5Z_ZFP_SWAP_STRIP || x+4 >= nx))              \
+            {                                                                       \
+                uint x1 = x+4 < nx ? x+4 : nx;                                      \
+                h5z_zfp_bswap(data+x0, x1-x0, sizeof(T));                           \
+                x0 = x1;                                                            \
+            }                                                                       \
+        }                                                                           \
+    }                                                                               \
+    else if (dims == 2)                                                             \
+    {                                                                               \
+        for (y = 0; y < ny; y += 4)                                                 \
+        {                                                                           \
+            uint by = ny-y < 4 ? ny-y : 4;                                          \
+            for (x = 0; x < nx; x += 4)                                             \
+            {                                                                       \
+                T *p = data + x*sx + y*sy;                                          \
+                if (nx-x < 4 || by < 4)                                             \
+                    Z zfp_decode_partial_block_strided_##S##_2(zstr, p,             \
+                        nx-x < 4 ? nx-x : 4, by, sx, sy);                           \
+                else                                                                \
+                    Z zfp_decode_block_strided_##S##_2(zstr, p, sx, sy);            \
+            }                                                                       \
+            if (swap) h5z_zfp_bswap(data + y*sy, (size_t) by*nx, sizeof(T));        \
+        }                                                                           \
+    }                                                                               \
+    else                                                                            \
+    {                                                                               \
+        for (z = 0; z < nz; z += 4)                                                 \
+        {                                                                           \
+            uint bz = nz-z < 4 ? nz-z : 4;                                          \
+            for (y = 0; y < ny; y += 4)                                             \
+            {                                                                       \
+                uint by = ny-y < 4 ? ny-y : 4;                                      \
+                for (x = 0; x < nx; x += 4)                                         \
+                {                                                                   \
+                    T *p = data + x*sx + y*sy + (size_t) z*sz;                      \
+                    if (nx-x < 4 || by < 4 || bz < 4)                               \
+                        Z zfp_decode_partial_block_strided_##S##_3(zstr, p,         \
+                            nx-x < 4 ? nx-x : 4, by, bz, sx, sy, sz);               \
+                    else                                                            \
+                        Z zfp_decode_block_strided_##S##_3(zstr, p, sx, sy, sz);    \
+                }                                                                   \
+                if (swap)                                                           \
+                {                                                                   \
+                    for (k = 0; k < bz; k++)                                        \
+                        for (j = 0; j < by; j++)                                    \
+                            h5z_zfp_bswap(data + (y+j)*sy + (size_t) (z+k)*sz,      \
+                                nx, sizeof(T));                                     \
+                }                                                                   \
+            }                                                                       \
+        }                                                                           \
+    }                                                                               \
+}
+
+H5Z_ZFP_DECODE_ROWS(int32, int32)
+H5Z_ZFP_DECODE_ROWS(int64, int64)
+H5Z_ZFP_DECODE_ROWS(float, float)
+H5Z_ZFP_DECODE_ROWS(double, double)
+
+/* Can h5z_zfp_decode_rows handle this field? */
+static int
+h5z_zfp_can_fuse_swap(zfp_field const *zfld)
+{
+#ifdef H5Z_ZFP_NO_FUSED_SWAP
+    return 0;
+#else
+    uint dims = Z zfp_field_dimensionality(zfld);
+    return 1 <= dims && dims <= 3;
+#endif
+}
+
+static int
+h5z_zfp_decode_rows(zfp_stream *zstr, zfp_field const *zfld, int swap)
+{
+    uint dims = Z zfp_field_dimensionality(zfld);
+    uint nx = zfld->nx, ny = dims > 1 ? zfld->ny : 1, nz = dims > 2 ? zfld->nz : 1;
+
+    switch (zfld->type)
+    {
+        case zfp_type_int32:  h5z_zfp_decode_rows_int32(zstr, (int32 *) zfld->data, dims, nx, ny, nz, swap); break;
+        case zfp_type_int64:  h5z_zfp_decode_rows_int64(zstr, (int64 *) zfld->data, dims, nx, ny, nz, swap); break;
+        case zfp_type_float:  h5z_zfp_decode_rows_float(zstr, (float *) zfld->data, dims, nx, ny, nz, swap); break;
+        case zfp_type_double: h5z_zfp_decode_rows_double(zstr, (double *) zfld->data, dims, nx, ny, nz, swap); break;
+        default: return 0;
+    }
+    Z zfp_stream_align(zstr);
+    return 1;
+}
+
+/* Encode a (contiguous) field one row of blocks at a time, in the same order
+   zfp_compress does. A row is all blocks sharing the same y (2D) or y and z (3D)
+   block index. For 1D, a row is a strip of H5Z_ZFP_ROW_BLOCKS_1D blocks. Working a
+   row at a time permits sampling rows to estimate the compressed size and
+   growing the output buffer between rows. */
+#define H5Z_ZFP_ROW_BLOCKS_1D 1024
+
+static size_t
+h5z_zfp_field_blocks(zfp_field const *zfld)
+{
+    uint i, n[4], dims = Z zfp_field_dimensionality(zfld);
+    size_t nblocks = 1;
+
+    Z zfp_field_size(zfld, n);
+    for (i = 0; i < dims; i++)
+        nblocks *= (n[i] + 3) / 4;
+    return nblocks;
+}
+
+/* Bytes needed for a compressed chunk. In fixed-rate mode (minbits == maxbits),
+   every block occupies maxbits and this is exact. Otherwise, it is msize, zfp's
+   worst case. Returns 1 when exact. */
+static int
+h5z_zfp_stream_bytes(zfp_stream const *zstr, zfp_field const *zfld, size_t msize, size_t *nbytes)
+{
+    size_t n;
+
+    *nbytes = msize;
+    if (zstr->minbits != zstr->maxbits)
+        return 0;
+    n = (h5z_zfp_field_blocks(zfld) * zstr->maxbits + 7) / 8;
+    if (n > msize)
+        return 0;
+    *nbytes = n;
+    return 1;
+}
+
+/* Predict, from the same header set_local would store, the compressed size
+   of a chunk before writing it. An existing dataset's creation properties hold
+   the stored cd_values already, marked by the ZFP version in their first word. */
+int H5Z_zfp_predict_chunk_bytes(hid_t dcpl_id, hid_t type_id, hid_t chunk_space_id, size_t *nbytes)
+{
+    static char const *_funcname_ = "H5Z_zfp_predict_chunk_bytes";
+    int ndims, ndims_used, retval = -1;
+    size_t dsize, cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX;
+    unsigned int cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    unsigned int flags = 0;
+    hsize_t dims[H5S_MAX_RANK], dims_used[H5S_MAX_RANK];
+    H5T_class_t dclass;
+    zfp_type zt;
+    h5z_zfp_context_t *ctx;
+    h5z_zfp_info_t info = {0, 0, H5T_ORDER_NONE, 0, 0, 0, {H5Z_ZFP_EXEC_SERIAL, 0, 0}};
+
+    H5Z_zfp_init();
+
+    if (!nbytes)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+
+    dclass = H5Tget_class(type_id);
+    dsize = H5Tget_size(type_id);
+    if (!(dclass == H5T_FLOAT || dclass == H5T_INTEGER) || !(dsize == 4 || dsize == 8))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1,
+            "requires 4 or 8 byte H5T_FLOAT or H5T_INTEGER datatype");
+    if (dclass == H5T_FLOAT)
+        zt = (dsize == 4) ? zfp_type_float : zfp_type_double;
+    else
+        zt = (dsize == 4) ? zfp_type_int32 : zfp_type_int64;
+
+    if (0 > (ndims = H5Sget_simple_extent_dims(chunk_space_id, dims, 0)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a data space");
+
+    if (0 == (ndims_used = h5z_zfp_field_dims(ndims, dims, dims_used)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1,
+            "chunk must have non-unity dimensions small enough for ZFP header");
+
+    if (0 > H5Pget_filter_by_id(dcpl_id, H5Z_FILTER_ZFP, &flags, &cd_nelmts, cd_values, 0, NULL, NULL))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "no ZFP filter in dcpl");
+
+    if (cd_nelmts > 1 && (cd_values[0] >> 16))
+    {
+        if (0 == get_zfp_info_from_cd_values(cd_nelmts, cd_values, &info, 1))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, -1, "can't get ZFP mode/meta");
+    }
+    else if (1 != h5z_zfp_header(dcpl_id, dclass, zt, ndims_used, dims_used,
+                      &flags, &cd_nelmts, cd_values, &info))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTINIT, -1, "unable to build ZFP header");
+
+    /* ZFP field and stream objects are re-used from this thread's context */
+    if (0 == (ctx = h5z_zfp_context_get()))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "ZFP context alloc failed");
+    Z zfp_field_set_metadata(ctx->zfld, info.zfp_meta);
+    Z zfp_stream_set_mode(ctx->zstr, info.zfp_mode);
+
+    retval = h5z_zfp_stream_bytes(ctx->zstr, ctx->zfld,
+                 Z zfp_stream_maximum_size(ctx->zstr, ctx->zfld), nbytes);
+    *nbytes += h5z_zfp_tail_size(&info);
+
+done:
     return retval;
 }
 
+typedef struct _h5z_zfp_rows_t {
+    uint dims, nx, ny, nz;
+    size_t nbx, nby;   /* blocks in x, y */
+    size_t row_blocks; /* blocks per (full) row */
+    size_t nrows;
+} h5z_zfp_rows_t;
+
 static int
-get_zfp_info_from_cd_values_0x0030(size_t cd_nelmts, unsigned int const *cd_values,
-    uint64 *zfp_mode, uint64 *zfp_meta, H5T_order_t *swap)
+h5z_zfp_rows_init(zfp_field const *zfld, h5z_zfp_rows_t *rows)
 {
-    static char const *_funcname_ = "get_zfp_info_from_cd_values_0x0030";
-    unsigned int cd_values_copy[H5Z_ZFP_CD_NELMTS_MAX];
-    int retval = 0;
+    rows->dims = Z zfp_field_dimensionality(zfld);
+    if (rows->dims < 1 || rows->dims > 3) return 0;
+    rows->nx = zfld->nx;
+    rows->ny = rows->dims > 1 ? zfld->ny : 1;
+    rows->nz = rows->dims > 2 ? zfld->nz : 1;
+    rows->nbx = (rows->nx + 3) / 4;
+    rows->nby = (rows->ny + 3) / 4;
+    if (rows->dims == 1)
+    {
+        rows->row_blocks = H5Z_ZFP_ROW_BLOCKS_1D;
+        rows->nrows = (rows->nbx + H5Z_ZFP_ROW_BLOCKS_1D - 1) / H5Z_ZFP_ROW_BLOCKS_1D;
+    }
+    else
+    {
+        rows->row_blocks = rows->nbx;
+        rows->nrows = rows->nby * ((rows->nz + 3) / 4);
+    }
+    return 1;
+}
+
+#define H5Z_ZFP_ENCODE_ROW(T, S)                                                    \
+static void                                                                         \
+h5z_zfp_encode_row_##S(zfp_stream *zstr, T const *data, h5z_zfp_rows_t const *rows, \
+    size_t r)                                                                       \
+{                                                                                   \
+    uint const nx = rows->nx, ny = rows->ny, nz = rows->nz;                         \
+    int const sx = 1, sy = (int) nx, sz = (int) (nx*ny);                            \
+    uint x, y, z, x0, x1, by, bz;                                                   \
+                                                                                    \
+    if (rows->dims == 1)                                                            \
+    {                                                                               \
+        x0 = (uint) (r * H5Z_ZFP_ROW_BLOCKS_1D * 4);                                \
+        x1 = x0 + H5Z_ZFP_ROW_BLOCKS_1D * 4 < nx ? x0 + H5Z_ZFP_ROW_BLOCKS_1D * 4 : nx; \
+        for (x = x0; x < x1; x += 4)                                                \
+        {                                                                           \
+            if (nx - x < 4)                                                         \
+                Z zfp_encode_partial_block_strided_##S##_1(zstr, data+x, nx-x, sx); \
+            else                                                                    \
+                Z zfp_encode_block_##S##_1(zstr, data+x);                           \
+        }                                                                           \
+        return;                                                                     \
+    }                                                                               \
+                                                                                    \
+    y = (uint) (4 * (r % rows->nby));                                               \
+    z = (uint) (4 * (r / rows->nby));                                               \
+    by = ny-y < 4 ? ny-y : 4;                                                       \
+    bz = nz-z < 4 ? nz-z : 4;                                                       \
+    for (x = 0; x < nx; x += 4)                                                     \
+    {                                                                               \
+        T const *p = data + x*sx + y*sy + (size_t) z*sz;                            \
+        uint bx = nx-x < 4 ? nx-x : 4;                                              \
+        if (rows->dims == 2)                                                        \
+        {                                                                           \
+            if (bx < 4 || by < 4)                                                   \
+                Z zfp_encode_partial_block_strided_##S##_2(zstr, p, bx, by, sx, sy); \
+            else                                                                    \
+                Z zfp_encode_block_strided_##S##_2(zstr, p, sx, sy);                \
+        }                                                                           \
+        else                                                                        \
+        {                                                                           \
+            if (bx < 4 || by < 4 || bz < 4)                                         \
+                Z zfp_encode_partial_block_strided_##S##_3(zstr, p, bx, by, bz, sx, sy, sz); \
+            else                                                                    \
+                Z zfp_encode_block_strided_##S##_3(zstr, p, sx, sy, sz);            \
+        }                                                                           \
+    }                                                                               \
+}
+
+H5Z_ZFP_ENCODE_ROW(int32, int32)
+H5Z_ZFP_ENCODE_ROW(int64, int64)
+H5Z_ZFP_ENCODE_ROW(float, float)
+H5Z_ZFP_ENCODE_ROW(double, double)
+
+static void
+h5z_zfp_encode_row(zfp_stream *zstr, zfp_field const *zfld, h5z_zfp_rows_t const *rows, size_t r)
+{
+    switch (zfld->type)
+    {
+        case zfp_type_int32:  h5z_zfp_encode_row_int32(zstr, (int32 const *) zfld->data, rows, r); break;
+        case zfp_type_int64:  h5z_zfp_encode_row_int64(zstr, (int64 const *) zfld->data, rows, r); break;
+        case zfp_type_float:  h5z_zfp_encode_row_float(zstr, (float const *) zfld->data, rows, r); break;
+        case zfp_type_double: h5z_zfp_encode_row_double(zstr, (double const *) zfld->data, rows, r); break;
+        default: break;
+    }
+}
+
+/* Estimate compressed size by encoding a few evenly spaced rows into scratch
+   space. The estimate is padded for safety. Overruns are handled by growing the
+   buffer anyway. So, this need not be a bound. */
+#define H5Z_ZFP_SIZE_SAMPLES 8
+
+static size_t
+h5z_zfp_estimate_size(zfp_stream const *zstr, zfp_field const *zfld,
+    h5z_zfp_rows_t const *rows, size_t row_max_bits, size_t msize)
+{
+    size_t i, bits = 0, est, tmp_size = row_max_bits / 8 + 16;
+    void *tmp;
+    bitstream *bstr;
+    zfp_stream zs = *zstr;
+
+    if (rows->nrows <= 2 * H5Z_ZFP_SIZE_SAMPLES)
+        return msize;
+    if (0 == (tmp = h5z_zfp_scratch_get(tmp_size)))
+        return msize;
+    if (0 == (bstr = B stream_open(tmp, tmp_size)))
+    {
+        h5z_zfp_scratch_put(tmp, tmp_size);
+        return msize;
+    }
+    zs.stream = bstr;
+
+    for (i = 0; i < H5Z_ZFP_SIZE_SAMPLES; i++)
+    {
+        /* sample the middle of each of H5Z_ZFP_SIZE_SAMPLES equal groups of rows */
+        size_t r = (2 * i + 1) * rows->nrows / (2 * H5Z_ZFP_SIZE_SAMPLES);
+        B stream_rewind(bstr);
+        h5z_zfp_encode_row(&zs, zfld, rows, r);
+        bits += B stream_wtell(bstr);
+    }
+
+    B stream_close(bstr);
+    h5z_zfp_scratch_put(tmp, tmp_size);
+
+    /* +12.5% plus one worst case row */
+    est = bits / H5Z_ZFP_SIZE_SAMPLES * rows->nrows / 8;
+    est += est / 8 + row_max_bits / 8 + 16;
+    return est < msize ? est : msize;
+}
+
+/* Target mode with both a ratio and an error. The dataset's header holds accuracy
+   mode at the error, capped at the ratio's bits per block. Where that budget is too
+   small, the cap cuts the precision of whichever blocks need more, and their error
+   is unknown. So, each chunk is first trial-compressed, a few evenly spaced rows of
+   blocks at a time, without the cap. If those rows take more than the cap on
+   average, the tolerance is raised, by powers of two, to the least whose rows fit.
+   Then the chunk is compressed with one tolerance for all its blocks, with the cap
+   still in place, and the tolerance chosen is recorded with it. Fields without rows
+   (more than 3 dimensions) keep the dataset's tolerance. */
+#define H5Z_ZFP_TARGET_STEPS 64 /* most powers of two the tolerance is raised by */
+
+/* Bits the sampled rows of zfld take in zs, encoded into bstr one at a time */
+static size_t
+h5z_zfp_target_bits(zfp_stream *zs, zfp_field const *zfld, h5z_zfp_rows_t const *rows,
+    size_t nsamples, bitstream *bstr)
+{
+    size_t i, bits = 0;
+
+    for (i = 0; i < nsamples; i++)
+    {
+        size_t r = (2 * i + 1) * rows->nrows / (2 * nsamples);
+        B stream_rewind(bstr);
+        h5z_zfp_encode_row(zs, zfld, rows, r);
+        bits += B stream_wtell(bstr);
+    }
+    return bits;
+}
+
+/* Tune zstr's tolerance for zfld's data (see above) */
+static void
+h5z_zfp_target_tune(zfp_stream *zstr, zfp_field const *zfld)
+{
+    h5z_zfp_rows_t rows;
+    zfp_stream zs = *zstr;
+    size_t i, nsamples, nblocks = 0, msize, row_max_bits, tmp_size, budget;
+    void *tmp = 0;
+    bitstream *bstr = 0;
+    int lo, hi;
+
+    if (!h5z_zfp_rows_init(zfld, &rows))
+        return;
+    nsamples = rows.nrows < H5Z_ZFP_SIZE_SAMPLES ? rows.nrows : H5Z_ZFP_SIZE_SAMPLES;
+    for (i = 0; i < nsamples; i++)
+    {
+        /* only the last 1D row may be short */
+        size_t r = (2 * i + 1) * rows.nrows / (2 * nsamples);
+        nblocks += rows.dims == 1 && (r + 1) * rows.row_blocks > rows.nbx ?
+            rows.nbx - r * rows.row_blocks : rows.row_blocks;
+    }
+    budget = nblocks * zstr->maxbits;
+
+    Z zfp_stream_set_params(&zs, zstr->minbits, ZFP_MAX_BITS, zstr->maxprec, zstr->minexp);
+    msize = Z zfp_stream_maximum_size(&zs, zfld);
+    row_max_bits = rows.row_blocks * ((8 * msize + h5z_zfp_field_blocks(zfld) - 1) / h5z_zfp_field_blocks(zfld));
+    tmp_size = row_max_bits / 8 + 16;
+    if (0 == (tmp = h5z_zfp_scratch_get(tmp_size)))
+        return;
+    if (0 == (bstr = B stream_open(tmp, tmp_size)))
+        goto done;
+    zs.stream = bstr;
+
+    /* the smooth fields the error alone fits are done in one trial */
+    if (h5z_zfp_target_bits(&zs, zfld, &rows, nsamples, bstr) <= budget)
+        goto done;
+
+    /* lo is known not to fit, hi is taken to */
+    lo = zstr->minexp;
+    hi = zstr->minexp + H5Z_ZFP_TARGET_STEPS;
+    while (hi - lo > 1)
+    {
+        int mid = lo + (hi - lo) / 2;
+        Z zfp_stream_set_params(&zs, zstr->minbits, ZFP_MAX_BITS, zstr->maxprec, mid);
+        if (h5z_zfp_target_bits(&zs, zfld, &rows, nsamples, bstr) <= budget)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    Z zfp_stream_set_params(zstr, zstr->minbits, zstr->maxbits, zstr->maxprec, hi);
+
+done:
+    if (bstr) B stream_close(bstr);
+    h5z_zfp_scratch_put(tmp, tmp_size);
+}
+
+/* Encode a field row by row into *buf, of *cap bytes, growing it as needed up to
+   msize bytes or, if smaller and not 0, limit bytes. The buffer came from the pool
+   (pooled) or from H5Z_ZFP_MALLOC. Returns compressed size or 0 on failure,
+   including when the next row might not fit within limit. */
+static size_t
+h5z_zfp_encode_rows(zfp_stream *zstr, zfp_field const *zfld, h5z_zfp_rows_t const *rows,
+    size_t row_max_bits, size_t msize, size_t limit, bitstream **bstr, void **buf,
+    size_t *cap, int pooled)
+{
+    size_t r, bound = limit && limit < msize ? limit : msize;
+
+    for (r = 0; r < rows->nrows; r++)
+    {
+        size_t pos = B stream_wtell(*bstr);
+
+        if (pos + row_max_bits > 8 * *cap && *cap < bound)
+        {
+            size_t newcap = *cap + *cap / 2;
+            void *newbuf;
+
+            if (newcap < (pos + row_max_bits) / 8 + 1) newcap = (pos + row_max_bits) / 8 + 1;
+            if (newcap > bound) newcap = bound;
+
+            /* get partial word written to buffer, re-open on the bigger buffer and
+               seek back to where we left off (which re-loads the partial word) */
+            B stream_flush(*bstr);
+            if (pooled)
+            {
+                if (0 == (newbuf = h5z_zfp_scratch_get(newcap)))
+                    return 0;
+                memcpy(newbuf, *buf, (pos + 7) / 8);
+                h5z_zfp_scratch_put(*buf, *cap);
+            }
+            else if (0 == (newbuf = H5Z_ZFP_REALLOC(*buf, newcap)))
+                return 0;
+            *buf = newbuf;
+            *cap = newcap;
+
+            B stream_close(*bstr);
+            *bstr = 0;
+            if (0 == (*bstr = B stream_open(*buf, *cap)))
+                return 0;
+            Z zfp_stream_set_bit_stream(zstr, *bstr);
+            B stream_wseek(*bstr, pos);
+        }
+
+        /* msize bounds the whole stream, so reaching it is always safe to go on */
+        if (pos + row_max_bits > 8 * *cap && bound < msize)
+            return 0;
+
+        h5z_zfp_encode_row(zstr, zfld, rows, r);
+    }
+
+    Z zfp_stream_flush(zstr);
+    return B stream_size(*bstr);
+}
+
+/* In fixed-rate mode (minbits == maxbits), every ZFP block occupies the same
+   number of bits. So, the stream can be split into independent slabs of whole
+   block layers along the slowest varying dimension, each decoded by a thread
+   with its own bitstream positioned at the slab's first block. */
+#define H5Z_ZFP_MAX_THREADS 256
+#define H5Z_ZFP_MIN_BLOCKS_PER_THREAD 256
+
+typedef struct _h5z_zfp_decode_task_t {
+    void *zbuf;
+    size_t zsize;
+    size_t offset;  /* in bits */
+    uint64 zfp_mode;
+    zfp_type type;
+    uint dims;
+    uint n[3];
+    void *data;
+    int swap;
+    int status;
+    size_t *pending; /* slabs of the task's chunk not yet decoded */
+    struct _h5z_zfp_decode_task_t *next;
+} h5z_zfp_decode_task_t;
+
+/* The slab's field and stream are those of the running thread's context */
+static void
+h5z_zfp_decode_task(h5z_zfp_decode_task_t *task)
+{
+    h5z_zfp_context_t *ctx;
     bitstream *bstr = 0;
     zfp_stream *zstr = 0;
     zfp_field *zfld = 0;
 
-    if (cd_nelmts > H5Z_ZFP_CD_NELMTS_MAX)
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_OVERFLOW, 0, "cd_nelmts exceeds max");
+    task->status = 0;
 
-    /* make a copy of cd_values in case we need to byte-swap it */
-    memcpy(cd_values_copy, cd_values, cd_nelmts * sizeof(cd_values[0]));
+    if (0 == (ctx = h5z_zfp_context_get())) goto done;
+    if (0 == (bstr = B stream_open(task->zbuf, task->zsize))) goto done;
+    zstr = ctx->slab_zstr;
+    zfld = ctx->slab_zfld;
+    Z zfp_stream_set_bit_stream(zstr, bstr);
+    Z zfp_stream_set_mode(zstr, task->zfp_mode);
+#if ZFP_VERSION_NO >= 0x0053
+    Z zfp_stream_set_execution(zstr, zfp_exec_serial);
+#endif
 
-    /* treat the cd_values as a zfp bitstream buffer */
-    if (0 == (bstr = B stream_open(&cd_values_copy[0], sizeof(cd_values_copy[0]) * cd_nelmts)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "opening header bitstream failed");
+    Z zfp_field_set_type(zfld, task->type);
+    Z zfp_field_set_pointer(zfld, task->data);
+    switch (task->dims)
+    {
+        case 1: Z zfp_field_set_size_1d(zfld, task->n[0]); break;
+        case 2: Z zfp_field_set_size_2d(zfld, task->n[0], task->n[1]); break;
+        case 3: Z zfp_field_set_size_3d(zfld, task->n[0], task->n[1], task->n[2]); break;
+    }
 
-    if (0 == (zstr = Z zfp_stream_open(bstr)))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "opening header zfp stream failed");
+    B stream_rseek(bstr, task->offset);
+    if (task->swap)
+        task->status = h5z_zfp_decode_rows(zstr, zfld, 1);
+    else
+        task->status = Z zfp_decompress(zstr, zfld) != 0;
 
-    /* Allocate the field object */
-    if (0 == (zfld = Z zfp_field_alloc()))
-        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "allocating field failed");
+done:
+    /* zfld and zstr belong to the thread's context; just unbind them */
+    if (zfld) Z zfp_field_set_pointer(zfld, 0);
+    if (zstr) Z zfp_stream_set_bit_stream(zstr, 0);
+    if (bstr) B stream_close(bstr);
+}
 
-    /* Read ZFP header */
-    if (0 == (Z zfp_read_header(zstr, zfld, ZFP_HEADER_FULL)))
-    {
-        herr_t conv;
+/* Threads decoding slabs for h5z_zfp_decompress. They are started as calls need
+   them, kept for later calls and stopped by H5Z_zfp_finalize. The slabs of all
+   calls in progress share one queue. A calling thread decodes its first slab,
+   then any still queued, and waits for the rest. */
+static pthread_mutex_t h5z_zfp_workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t h5z_zfp_workers_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t h5z_zfp_workers_done = PTHREAD_COND_INITIALIZER;
+static pthread_t h5z_zfp_workers[H5Z_ZFP_MAX_THREADS];
+static size_t h5z_zfp_workers_count = 0;
+static int h5z_zfp_workers_stop = 0;
+static h5z_zfp_decode_task_t *h5z_zfp_queue_head = 0;
+static h5z_zfp_decode_task_t *h5z_zfp_queue_tail = 0;
 
-        /* The read may have failed due to difference in endian-ness between
-           writer and reader. So, byte-swap cd_values array, rewind the stream and re-try. */
-        if (H5T_ORDER_LE == (*swap = (H5Tget_order(H5T_NATIVE_UINT))))
-            conv = H5Tconvert(H5T_STD_U32BE, H5T_NATIVE_UINT, cd_nelmts, cd_values_copy, 0, H5P_DEFAULT);
+/* caller must hold h5z_zfp_workers_mutex for this and the two below */
+static h5z_zfp_decode_task_t *
+h5z_zfp_queue_pop(void)
+{
+    h5z_zfp_decode_task_t *task = h5z_zfp_queue_head;
+
+    if (task && 0 == (h5z_zfp_queue_head = task->next))
+        h5z_zfp_queue_tail = 0;
+    return task;
+}
+
+/* Decodes the slab with the lock released, then counts it done */
+static void
+h5z_zfp_queue_run(h5z_zfp_decode_task_t *task)
+{
+    pthread_mutex_unlock(&h5z_zfp_workers_mutex);
+    h5z_zfp_decode_task(task);
+    pthread_mutex_lock(&h5z_zfp_workers_mutex);
+    if (0 == --*task->pending)
+        pthread_cond_broadcast(&h5z_zfp_workers_done);
+}
+
+static void *
+h5z_zfp_worker(void *arg)
+{
+    h5z_zfp_decode_task_t *task;
+
+    (void) arg;
+    pthread_mutex_lock(&h5z_zfp_workers_mutex);
+    while (!h5z_zfp_workers_stop)
+    {
+        if ((task = h5z_zfp_queue_pop()))
+            h5z_zfp_queue_run(task);
         else
-            conv = H5Tconvert(H5T_STD_U32LE, H5T_NATIVE_UINT, cd_nelmts, cd_values_copy, 0, H5P_DEFAULT);
-        if (conv < 0)
-            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "header endian-swap failed");
+            pthread_cond_wait(&h5z_zfp_workers_work, &h5z_zfp_workers_mutex);
+    }
+    pthread_mutex_unlock(&h5z_zfp_workers_mutex);
+    return 0;
+}
+
+/* Returns 0 if fewer than n workers could be started */
+static int
+h5z_zfp_workers_grow(size_t n)
+{
+    if (n > H5Z_ZFP_MAX_THREADS) n = H5Z_ZFP_MAX_THREADS;
+    while (h5z_zfp_workers_count < n)
+    {
+        if (pthread_create(&h5z_zfp_workers[h5z_zfp_workers_count], 0, h5z_zfp_worker, 0))
+            return 0;
+        h5z_zfp_workers_count++;
+    }
+    return 1;
+}
+
+static void
+h5z_zfp_workers_clear(void)
+{
+    size_t i, n;
+
+    pthread_mutex_lock(&h5z_zfp_workers_mutex);
+    h5z_zfp_workers_stop = 1;
+    pthread_cond_broadcast(&h5z_zfp_workers_work);
+    n = h5z_zfp_workers_count;
+    pthread_mutex_unlock(&h5z_zfp_workers_mutex);
+
+    for (i = 0; i < n; i++)
+        pthread_join(h5z_zfp_workers[i], 0);
+
+    pthread_mutex_lock(&h5z_zfp_workers_mutex);
+    h5z_zfp_workers_count = 0;
+    h5z_zfp_workers_stop = 0;
+    pthread_mutex_unlock(&h5z_zfp_workers_mutex);
+}
+
+#if defined(H5Z_ZFP_CUDA) && ZFP_VERSION_NO >= 0x0054
+/* For H5Z_ZFP_EXEC_CUDA, switch zstr to zfp's CUDA execution policy. That handles
+   only fixed-rate 1-3D fields. Returns 0 if the chunk is to stay on the CPU, as it
+   also does when zfp itself was compiled without CUDA support. */
+static int
+h5z_zfp_use_cuda(zfp_stream *zstr, zfp_field const *zfld, h5z_zfp_execution_t const *exec)
+{
+    uint dims = Z zfp_field_dimensionality(zfld);
+    return exec->policy == H5Z_ZFP_EXEC_CUDA && zstr->minbits == zstr->maxbits &&
+           1 <= dims && dims <= 3 && Z zfp_stream_set_execution(zstr, zfp_exec_cuda);
+}
+#endif
+
+/* Sets *mt when more than one thread decoded the chunk. Returns -1, without
+   decoding, if the threads it needs could not be started. */
+static int
+h5z_zfp_decompress(zfp_stream *zstr, zfp_field *zfld, void *zbuf, size_t zsize,
+    h5z_zfp_execution_t const *exec, int swap, int *mt)
+{
+    h5z_zfp_decode_task_t *tasks = 0, *task;
+    size_t pending;
+    uint dims = Z zfp_field_dimensionality(zfld);
+    uint n[3];
+    size_t layer_blocks = 1, layer_elems = 4, layers, nblocks, min_blocks, dsize;
+    size_t t, nthreads = exec->nthreads;
+    int status = 1;
+
+/* swap, if set, requires h5z_zfp_can_fuse_swap() be true */
+#define H5Z_ZFP_DECOMPRESS_SERIAL(ZSTR, ZFLD) \
+    (swap ? h5z_zfp_decode_rows(ZSTR, ZFLD, 1) : Z zfp_decompress(ZSTR, ZFLD) != 0)
 
+#if defined(H5Z_ZFP_CUDA) && ZFP_VERSION_NO >= 0x0054
+    /* if the GPU fails, start over on the CPU */
+    if (h5z_zfp_use_cuda(zstr, zfld, exec))
+    {
+        status = Z zfp_decompress(zstr, zfld) != 0;
+        Z zfp_stream_set_execution(zstr, zfp_exec_serial);
+        if (status)
+        {
+            if (swap)
+                h5z_zfp_bswap(zfld->data, Z zfp_field_size(zfld, 0),
+                    (zfld->type == zfp_type_int32 || zfld->type == zfp_type_float) ? 4 : 8);
+            return status;
+        }
         Z zfp_stream_rewind(zstr);
-        if (0 == (Z zfp_read_header(zstr, zfld, ZFP_HEADER_FULL)))
-            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, 0, "reading header failed");
+        status = 1;
     }
+#endif
 
-    /* Get ZFP stream mode and field meta */
-    *zfp_mode = Z zfp_stream_mode(zstr);
-    *zfp_meta = Z zfp_field_metadata(zfld);
+    if (exec->policy == H5Z_ZFP_EXEC_SERIAL || zstr->minbits != zstr->maxbits ||
+        dims < 1 || dims > 3)
+        return H5Z_ZFP_DECOMPRESS_SERIAL(zstr, zfld);
 
-    /* cleanup */
-    Z zfp_field_free(zfld); zfld = 0;
-    Z zfp_stream_close(zstr); zstr = 0;
-    B stream_close(bstr); bstr = 0;
-    retval = 1;
+    n[0] = zfld->nx; n[1] = zfld->ny; n[2] = zfld->nz;
+    for (t = 0; t < dims-1; t++)
+    {
+        layer_blocks *= (n[t] + 3) / 4;
+        layer_elems *= n[t];
+    }
+    layers = (n[dims-1] + 3) / 4;
+    nblocks = layers * layer_blocks;
+    dsize = (zfld->type == zfp_type_int32 || zfld->type == zfp_type_float) ? 4 : 8;
 
-done:
-    if (zfld) Z zfp_field_free(zfld);
-    if (zstr) Z zfp_stream_close(zstr);
-    if (bstr) B stream_close(bstr);
+    /* don't bother with threads for small chunks */
+    min_blocks = exec->chunk_blocks ? exec->chunk_blocks : H5Z_ZFP_MIN_BLOCKS_PER_THREAD;
+    if (nthreads == 0)
+    {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 0 ? (size_t) ncpu : 1;
+    }
+    if (nthreads > H5Z_ZFP_MAX_THREADS) nthreads = H5Z_ZFP_MAX_THREADS;
+    if (nthreads > layers) nthreads = layers;
+    if (nthreads > nblocks / min_blocks) nthreads = nblocks / min_blocks;
+    if (nthreads < 2)
+        return H5Z_ZFP_DECOMPRESS_SERIAL(zstr, zfld);
+
+    if (0 == (tasks = (h5z_zfp_decode_task_t *) malloc(nthreads * sizeof(*tasks))))
+        return H5Z_ZFP_DECOMPRESS_SERIAL(zstr, zfld);
+
+    for (t = 0; t < nthreads; t++)
+    {
+        size_t l0 = layers * t / nthreads;
+        size_t l1 = layers * (t+1) / nthreads;
+        size_t e1 = 4 * l1 < n[dims-1] ? 4 * l1 : n[dims-1];
 
-    return retval;
-}
+        task = &tasks[t];
+        task->zbuf = zbuf;
+        task->zsize = zsize;
+        task->offset = l0 * layer_blocks * zstr->maxbits;
+        task->zfp_mode = Z zfp_stream_mode(zstr);
+        task->type = zfld->type;
+        task->dims = dims;
+        memcpy(task->n, n, sizeof(n));
+        task->n[dims-1] = (uint) (e1 - 4 * l0);
+        task->data = (char *) zfld->data + l0 * layer_elems * dsize;
+        task->swap = swap;
+        task->pending = &pending;
+        task->next = t+1 < nthreads ? &tasks[t+1] : 0;
+    }
 
-/* Decode cd_values for ZFP info for various versions of this filter */
-static int
-get_zfp_info_from_cd_values(size_t cd_nelmts, unsigned int const *cd_values,
-    uint64 *zfp_mode, uint64 *zfp_meta, H5T_order_t *swap)
-{
-    unsigned int const h5z_zfp_version_no = cd_values[0]&0x0000FFFF;
-    int retval = 0;
+    /* queue all but the first slab, which the calling thread decodes */
+    pthread_mutex_lock(&h5z_zfp_workers_mutex);
+    if (!h5z_zfp_workers_grow(nthreads - 1))
+    {
+        pthread_mutex_unlock(&h5z_zfp_workers_mutex);
+        free(tasks);
+        return -1;
+    }
+    pending = nthreads - 1;
+    if (h5z_zfp_queue_tail)
+        h5z_zfp_queue_tail->next = &tasks[1];
+    else
+        h5z_zfp_queue_head = &tasks[1];
+    h5z_zfp_queue_tail = &tasks[nthreads-1];
+    pthread_cond_broadcast(&h5z_zfp_workers_work);
+    pthread_mutex_unlock(&h5z_zfp_workers_mutex);
 
-    H5Z_zfp_init();
+    h5z_zfp_decode_task(&tasks[0]);
 
-    /* Pass &cd_values[1] here to strip off first entry holding version info */
-    if (0x0020 <= h5z_zfp_version_no && h5z_zfp_version_no <= 0x0080)
-        return get_zfp_info_from_cd_values_0x0030(cd_nelmts-1, &cd_values[1], zfp_mode, zfp_meta, swap);
+    pthread_mutex_lock(&h5z_zfp_workers_mutex);
+    while (pending)
+    {
+        if ((task = h5z_zfp_queue_pop()))
+            h5z_zfp_queue_run(task);
+        else
+            pthread_cond_wait(&h5z_zfp_workers_done, &h5z_zfp_workers_mutex);
+    }
+    pthread_mutex_unlock(&h5z_zfp_workers_mutex);
 
-    H5Epush(H5E_DEFAULT, __FILE__, "", __LINE__, H5Z_ZFP_ERRCLASS, H5E_PLINE, H5E_BADVALUE,
-        "version mismatch: (file) 0x0%x <-> 0x0%x (code)", h5z_zfp_version_no, H5Z_FILTER_ZFP_VERSION_NO);
+    for (t = 0; t < nthreads; t++)
+        status = status && tasks[t].status;
+    *mt = 1;
 
-    return 0;
+    free(tasks);
+    return status;
+
+#undef H5Z_ZFP_DECOMPRESS_SERIAL
 }
 
 static size_t
@@ -496,35 +3608,89 @@ H5Z_filter_zfp(unsigned int flags, size_t cd_nelmts,
 {
     static char const *_funcname_ = "H5Z_filter_zfp";
     void *newbuf = 0;
+    void *scratch = 0;
+    size_t scratch_size = 0;
     size_t retval = 0;
     int cd_vals_zfpver = (cd_values[0]>>16)&0x0000FFFF;
-    H5T_order_t swap = H5T_ORDER_NONE;
+    H5T_order_t swap;
     uint64 zfp_mode, zfp_meta;
+    h5z_zfp_info_t info;
+    h5z_zfp_execution_t exec;
+    h5z_zfp_context_t *ctx;
     bitstream *bstr = 0;
     zfp_stream *zstr = 0;
     zfp_field *zfld = 0;
+    void *pre = 0;
+    size_t pre_size = 0;
+    h5z_zfp_precond_t pc = {0, 0};
+    H5Z_zfp_chunk_stats_t cs;
+    int dir = (flags & H5Z_FLAG_REVERSE) ? 1 : 0;
+    int stats = h5z_zfp_stats_on();
+    int mt = 0; /* (de)compressed by more than one thread */
+    unsigned long long t0 = 0, t1 = 0;
+
+    /* With stats on, charge the time since the previous lap to field F */
+#define H5Z_ZFP_LAP(F)                                          \
+    do {                                                        \
+        if (stats)                                              \
+        {                                                       \
+            unsigned long long _t = h5z_zfp_now();              \
+            H5Z_ZFP_STATS_ADD(F, _t - t1);                      \
+            t1 = _t;                                            \
+        }                                                       \
+    } while(0)
 
-    if (0 == get_zfp_info_from_cd_values(cd_nelmts, cd_values, &zfp_mode, &zfp_meta, &swap))
+    if (stats) t0 = t1 = h5z_zfp_now();
+
+    if (0 == get_zfp_info_from_cd_values(cd_nelmts, cd_values, &info, 1))
         H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, 0, "can't get ZFP mode/meta");
+    zfp_mode = info.zfp_mode;
+    zfp_meta = info.zfp_meta;
+    swap = info.swap;
+
+    /* The dataset's policy, unless H5Z_ZFP_EXECUTION overrides it. Only reads
+       may use one bound to this thread instead. */
+    exec = info.exec;
+    h5z_zfp_env_execution(&exec);
+
+    /* ZFP field and stream objects are re-used from this thread's context */
+    if (0 == (ctx = h5z_zfp_context_get()))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "ZFP context alloc failed");
+    if (dir && ctx->access.have_exec)
+        exec = ctx->access.exec;
+    zfld = ctx->zfld;
+    zstr = ctx->zstr;
+    Z zfp_field_set_metadata(zfld, zfp_meta);
+    Z zfp_stream_set_mode(zstr, zfp_mode);
+#if ZFP_VERSION_NO >= 0x0053
+    Z zfp_stream_set_execution(zstr, zfp_exec_serial);
+#endif
+    H5Z_ZFP_LAP(setup_ns[dir]);
 
     if (flags & H5Z_FLAG_REVERSE) /* decompression */
     {
-        int status;
-        size_t bsize, dsize;
+        int status, fuse_swap, inplace = h5z_zfp_inplace_mode();
+        size_t bsize, dsize, zsize;
+        zfp_type ztype;
+        void *zbuf, *outbuf;
 
         /* Worry about zfp version and endian mismatch only for decompression */
         if (cd_vals_zfpver > ZFP_VERSION)
             H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_NOSPACE, 0, "ZFP lib version, "
                 ZFP_VERSION_STR ", too old to decompress this data");
 
-        /* Set up the ZFP field object */
-        if (0 == (zfld = Z zfp_field_alloc()))
-            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "field alloc failed");
-
-        Z zfp_field_set_metadata(zfld, zfp_meta);
+        /* a tuned chunk records the tolerance it was compressed with */
+        if (info.target)
+        {
+            int minexp;
+            if (!h5z_zfp_target_get(*buf, nbytes, &info, &minexp))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "missing or bad ZFP target record");
+            Z zfp_stream_set_params(zstr, zstr->minbits, zstr->maxbits, zstr->maxprec, minexp);
+        }
+        h5z_zfp_read_precision(zstr, ctx);
 
         bsize = Z zfp_field_size(zfld, 0);
-        switch (Z zfp_field_type(zfld))
+        switch (ztype = Z zfp_field_type(zfld))
         {
             case zfp_type_int32: case zfp_type_float:  dsize = 4; break;
             case zfp_type_int64: case zfp_type_double: dsize = 8; break;
@@ -532,109 +3698,846 @@ H5Z_filter_zfp(unsigned int flags, size_t cd_nelmts,
         }
         bsize *= dsize;
 
-        if (NULL == (newbuf = malloc(bsize)))
-            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
-                "memory allocation failed for ZFP decompression");
+        /* A narrowed chunk was compressed as int32. The trailer past the end
+           of the ZFP stream is simply never read by the decoder. */
+        if (info.precond)
+        {
+            if (!h5z_zfp_trailer_get(*buf, nbytes, &pc))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0,
+                    "missing or bad ZFP pre-conditioning trailer");
+            if (pc.flags & H5Z_ZFP_PRECOND_NARROW)
+                Z zfp_field_set_type(zfld, zfp_type_int32);
+        }
+
+        /* To decode directly into the chunk buffer, first move the compressed
+           bytes out of the way into scratch space. */
+        if ((inplace > 0 && *buf_size >= bsize) || inplace > 1)
+        {
+            if (NULL == (scratch = h5z_zfp_scratch_get(nbytes)))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
+                    "memory allocation failed for ZFP decompression");
+            scratch_size = nbytes;
+            memcpy(scratch, *buf, nbytes);
+
+            if (*buf_size < bsize)
+            {
+                void *p;
+                if (NULL == (p = H5Z_ZFP_REALLOC(*buf, bsize)))
+                    H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
+                        "memory reallocation failed for ZFP decompression");
+                *buf = p;
+                *buf_size = bsize;
+            }
+            outbuf = *buf;
+            zbuf = scratch;
+            zsize = nbytes;
+        }
+        else
+        {
+            if (NULL == (newbuf = H5Z_ZFP_MALLOC(bsize)))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
+                    "memory allocation failed for ZFP decompression");
+            outbuf = newbuf;
+            zbuf = *buf;
+            zsize = *buf_size;
+        }
 
-        Z zfp_field_set_pointer(zfld, newbuf);
+        Z zfp_field_set_pointer(zfld, outbuf);
 
         /* Setup the ZFP stream object */
-        if (0 == (bstr = B stream_open(*buf, *buf_size)))
+        if (0 == (bstr = B stream_open(zbuf, zsize)))
             H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "bitstream open failed");
 
-        if (0 == (zstr = Z zfp_stream_open(bstr)))
-            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "zfp stream open failed");
-
-        Z zfp_stream_set_mode(zstr, zfp_mode);
+        Z zfp_stream_set_bit_stream(zstr, bstr);
+        H5Z_ZFP_LAP(alloc_ns[1]);
 
-        /* Do the ZFP decompression operation */
-        status = Z zfp_decompress(zstr, zfld);
+        /* Do the ZFP decompression operation, un-swapping as we go if we can */
+        fuse_swap = swap != H5T_ORDER_NONE && !pc.flags && h5z_zfp_can_fuse_swap(zfld);
+        status = h5z_zfp_decompress(zstr, zfld, zbuf, zsize, &exec, fuse_swap, &mt);
+        H5Z_ZFP_LAP(zfp_ns[1]);
 
         /* clean up */
-        Z zfp_field_free(zfld); zfld = 0;
-        Z zfp_stream_close(zstr); zstr = 0;
+        Z zfp_stream_set_bit_stream(zstr, 0);
         B stream_close(bstr); bstr = 0;
 
+        if (status < 0)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_CANTINIT, 0,
+                "unable to start ZFP decompression threads");
         if (!status)
             H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTFILTER, 0, "decompression failed");
 
+        if (pc.flags)
+        {
+            Z zfp_field_set_type(zfld, ztype);
+            h5z_zfp_precond_undo(outbuf, bsize/dsize, ztype, &pc);
+        }
+
 	/* ZFP is an endian-independent format. It will produce correct endian-ness
            during decompress regardless of endian-ness differences between reader 
            and writer. However, the HDF5 library will not be expecting that. So,
-           we need to undue the correct endian-ness here. We use HDF5's built-in
-           byte-swapping here. Because we know we need only to endian-swap,
-           we treat the data as unsigned. */
-        if (swap != H5T_ORDER_NONE)
+           we need to undue the correct endian-ness here. Usually, that was done
+           above, block row by block row, as the data was decoded. Otherwise,
+           we byte-swap the whole chunk here, with the same kernels and without
+           calling into HDF5, so the filter stays reentrant. Because we know we
+           need only to endian-swap, we treat the data as unsigned. */
+        if (swap != H5T_ORDER_NONE && !fuse_swap)
         {
-            hid_t src = dsize == 4 ? H5T_STD_U32BE : H5T_STD_U64BE; 
-            hid_t dst = dsize == 4 ? H5T_NATIVE_UINT32 : H5T_NATIVE_UINT64;
-            if (swap == H5T_ORDER_BE)
-                src = dsize == 4 ? H5T_STD_U32LE : H5T_STD_U64LE; 
-            if (H5Tconvert(src, dst, bsize/dsize, newbuf, 0, H5P_DEFAULT) < 0)
-                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "endian-UN-swap failed");
+            h5z_zfp_bswap(outbuf, bsize/dsize, dsize);
+            H5Z_ZFP_LAP(swap_ns[1]);
         }
 
-        free(*buf);
-        *buf = newbuf;
-        newbuf = 0;
-        *buf_size = bsize; 
+        if (newbuf)
+        {
+            H5Z_ZFP_FREE(*buf);
+            *buf = newbuf;
+            newbuf = 0;
+            *buf_size = bsize; 
+        }
         retval = bsize;
     }
     else /* compression */
     {
-        size_t msize, zsize;
-
-        /* Set up the ZFP field object */
-        if (0 == (zfld = Z zfp_field_alloc()))
-            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "field alloc failed");
+        size_t msize, zsize, cap, tsize = 0, row_max_bits = 0;
+        size_t limit = h5z_zfp_memory_limit(), budget = 0;
+        h5z_zfp_rows_t rows;
+        int by_rows = 0, omp = 0;
+#if defined(H5Z_ZFP_CUDA) && ZFP_VERSION_NO >= 0x0054
+        int cuda = 0;
+#endif
 
         Z zfp_field_set_pointer(zfld, *buf);
-        Z zfp_field_set_metadata(zfld, zfp_meta);
+        tsize = h5z_zfp_tail_size(&info);
+        if (info.cstats)
+            h5z_zfp_cstats_scan(*buf, Z zfp_field_size(zfld, 0), Z zfp_field_type(zfld), &cs);
 
-        /* Set up the ZFP stream object for real compression now */
-        if (0 == (zstr = Z zfp_stream_open(0)))
-            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "zfp stream open failed");
+        /* Pre-condition a copy of the chunk, never the chunk buffer itself */
+        if (info.precond)
+        {
+            zfp_type zt = Z zfp_field_type(zfld);
+            size_t n = Z zfp_field_size(zfld, 0);
 
-        Z zfp_stream_set_mode(zstr, zfp_mode);
+            pre_size = n * (zt == zfp_type_int32 ? 4 : 8);
+            if (NULL == (pre = h5z_zfp_scratch_get(pre_size)))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
+                    "memory allocation failed for ZFP pre-conditioning");
+            pc.flags = h5z_zfp_precond_apply(*buf, n, &zt, info.precond, &pc.offset, pre);
+            if (pc.flags)
+            {
+                Z zfp_field_set_type(zfld, zt);
+                Z zfp_field_set_pointer(zfld, pre);
+            }
+        }
+        if (info.target)
+            h5z_zfp_target_tune(zstr, zfld);
         msize = Z zfp_stream_maximum_size(zstr, zfld);
 
-        /* Set up the bitstream object */
-        if (NULL == (newbuf = malloc(msize)))
+        /* Under a memory limit, what's left of it for the output buffer. Parallel
+           compression needs a worst case sized one, so only if that fits. */
+        if (limit)
+        {
+            if (pre_size + tsize >= limit)
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "ZFP memory limit exceeded");
+            budget = limit - pre_size - tsize;
+        }
+
+#if ZFP_VERSION_NO >= 0x0053
+        /* If zfp was built without OpenMP, this fails and we stay serial */
+        if (exec.policy == H5Z_ZFP_EXEC_OMP && (!limit || msize <= budget) &&
+            Z zfp_stream_set_execution(zstr, zfp_exec_omp))
+        {
+            Z zfp_stream_set_omp_threads(zstr, exec.nthreads);
+            Z zfp_stream_set_omp_chunk_size(zstr, exec.chunk_blocks);
+            omp = mt = 1;
+        }
+#endif
+#if defined(H5Z_ZFP_CUDA) && ZFP_VERSION_NO >= 0x0054
+        if (!limit || msize <= budget)
+            cuda = h5z_zfp_use_cuda(zstr, zfld, &exec);
+#endif
+
+        /* Size the output buffer. zfp's maximum size can be many times the
+           actual compressed size. In fixed-rate mode, every block is maxbits
+           and we know the size exactly. Otherwise, unless zfp is doing the
+           work in parallel, encode a row of blocks at a time into a buffer
+           sized by a sampled estimate, growing it when necessary. */
+        if (!h5z_zfp_stream_bytes(zstr, zfld, msize, &cap) &&
+            zstr->minbits != zstr->maxbits && !omp && h5z_zfp_rows_init(zfld, &rows))
+        {
+            size_t nblocks = h5z_zfp_field_blocks(zfld);
+            row_max_bits = rows.row_blocks * ((8 * msize + nblocks - 1) / nblocks);
+            cap = h5z_zfp_estimate_size(zstr, zfld, &rows, row_max_bits, msize);
+            by_rows = 1;
+        }
+        if (limit && cap > budget)
+        {
+            if (!by_rows)
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "ZFP memory limit exceeded");
+            cap = budget;
+        }
+        H5Z_ZFP_LAP(zfp_ns[0]);
+
+        /* Set up the bitstream object. With the pool, compress into scratch
+           space and copy the result out afterwards. The copy would count against
+           a memory limit, so not then. */
+        if (!limit && h5z_zfp_pool_use())
+        {
+            if (NULL == (scratch = h5z_zfp_scratch_get(cap)))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
+                    "memory allocation failed for ZFP compression");
+            scratch_size = cap;
+        }
+        else if (NULL == (newbuf = H5Z_ZFP_MALLOC(cap)))
             H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
                 "memory allocation failed for ZFP compression");
 
-        if (0 == (bstr = B stream_open(newbuf, msize)))
+        if (0 == (bstr = B stream_open(scratch ? scratch : newbuf, cap)))
             H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "bitstream open failed");
 
         Z zfp_stream_set_bit_stream(zstr, bstr);
+        H5Z_ZFP_LAP(alloc_ns[0]);
 
         /* Do the compression */
-        zsize = Z zfp_compress(zstr, zfld);
+        if (!by_rows)
+        {
+            zsize = Z zfp_compress(zstr, zfld);
+#if defined(H5Z_ZFP_CUDA) && ZFP_VERSION_NO >= 0x0054
+            if (cuda)
+            {
+                /* if the GPU fails, start over on the CPU */
+                Z zfp_stream_set_execution(zstr, zfp_exec_serial);
+                if (zsize == 0)
+                {
+                    Z zfp_stream_rewind(zstr);
+                    zsize = Z zfp_compress(zstr, zfld);
+                }
+            }
+#endif
+        }
+        else if (scratch)
+            zsize = h5z_zfp_encode_rows(zstr, zfld, &rows, row_max_bits, msize, 0,
+                        &bstr, &scratch, &scratch_size, 1);
+        else
+            zsize = h5z_zfp_encode_rows(zstr, zfld, &rows, row_max_bits, msize, budget,
+                        &bstr, &newbuf, &cap, 0);
+        if (scratch) cap = scratch_size;
+        H5Z_ZFP_LAP(zfp_ns[0]);
 
         /* clean up */
-        Z zfp_field_free(zfld); zfld = 0;
-        Z zfp_stream_close(zstr); zstr = 0;
-        B stream_close(bstr); bstr = 0;
+        Z zfp_stream_set_bit_stream(zstr, 0);
+        if (bstr) B stream_close(bstr);
+        bstr = 0;
+
+        if (zsize == 0 && by_rows && budget && budget < msize)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "ZFP memory limit exceeded");
 
         if (zsize == 0)
             H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTFILTER, 0, "compression failed");
 
-        if (zsize > msize)
+        if (zsize > cap)
             H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_OVERFLOW, 0, "uncompressed buffer overrun");
 
-        free(*buf);
+        /* compare what the chunk decodes to with what was compressed, unless
+           the decoded copy won't fit within a memory limit */
+        if ((info.cstats & H5Z_ZFP_CSTATS_ERROR) && cs.flags &&
+            (!limit || cap + Z zfp_field_size(zfld, 0) *
+                (Z zfp_field_type(zfld) == zfp_type_int32 ||
+                 Z zfp_field_type(zfld) == zfp_type_float ? 4 : 8) <= budget) &&
+            0 <= (cs.maxerr = h5z_zfp_cstats_maxerr(zstr, zfld, scratch ? scratch : newbuf, zsize)))
+            cs.flags |= H5Z_ZFP_CSTATS_ERROR;
+
+        /* Usually, the compressed result fits in the chunk buffer we were given */
+        if (scratch && zsize + tsize <= *buf_size)
+        {
+            memcpy(*buf, scratch, zsize);
+            if (tsize) h5z_zfp_tail_put((unsigned char *) *buf + zsize, &info, &cs, zstr->minexp, &pc);
+            retval = zsize + tsize;
+            goto done;
+        }
+
+        if (scratch)
+        {
+            if (NULL == (newbuf = H5Z_ZFP_MALLOC(zsize + tsize)))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
+                    "memory allocation failed for ZFP compression");
+            memcpy(newbuf, scratch, zsize);
+        }
+        else if (zsize + tsize > cap)
+        {
+            void *p;
+            if (NULL == (p = H5Z_ZFP_REALLOC(newbuf, zsize + tsize)))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
+                    "memory reallocation failed for ZFP compression");
+            newbuf = p;
+        }
+        if (tsize) h5z_zfp_tail_put((unsigned char *) newbuf + zsize, &info, &cs, zstr->minexp, &pc);
+
+        H5Z_ZFP_FREE(*buf);
         *buf = newbuf;
         newbuf = 0;
-        *buf_size = zsize;
-        retval = zsize;
+        *buf_size = zsize + tsize;
+        retval = zsize + tsize;
     }
 
 done:
-    if (zfld) Z zfp_field_free(zfld);
-    if (zstr) Z zfp_stream_close(zstr);
+    /* zfld and zstr belong to the thread's context; just unbind them */
+    if (zfld) Z zfp_field_set_pointer(zfld, 0);
+    if (zstr) Z zfp_stream_set_bit_stream(zstr, 0);
     if (bstr) B stream_close(bstr);
-    if (newbuf) free(newbuf);
+    if (newbuf) H5Z_ZFP_FREE(newbuf);
+    if (scratch) h5z_zfp_scratch_put(scratch, scratch_size);
+    if (pre) h5z_zfp_scratch_put(pre, pre_size);
+    if (stats)
+    {
+        H5Z_ZFP_LAP(alloc_ns[dir]);
+        h5z_zfp_stats_record(dir, dir ? retval : (retval ? nbytes : 0),
+            dir ? nbytes : retval, t1 - t0, mt);
+    }
     return retval ;
+#undef H5Z_ZFP_LAP
+}
+
+/* Decoding a region of a chunk, for H5Z_zfp_decode_region. The region is mapped,
+   like the chunk itself (see h5z_zfp_field_dims), onto ZFP field x, y and z. In
+   fixed-rate mode, every block is exactly maxbits long. So, the blocks covering
+   the region can be found by seeking and only those are decoded. */
+typedef struct _h5z_zfp_region_t {
+    int m;                      /* non-unity chunk dimensions, slowest first */
+    size_t d[H5S_MAX_RANK];     /* their sizes */
+    size_t o[H5S_MAX_RANK];     /* region offset in each */
+    size_t c[H5S_MAX_RANK];     /* region count in each */
+    size_t s[H5S_MAX_RANK];     /* output stride of each */
+    size_t n[3];                /* field size in x, y, z */
+    size_t lo[3], hi[3];        /* bounds of the region in field x, y, z */
+} h5z_zfp_region_t;
+
+static int
+h5z_zfp_region_init(int ndims, hsize_t const *chunk_dims, hsize_t const *offset,
+    hsize_t const *count, h5z_zfp_region_t *rg)
+{
+    int i, m = 0;
+
+    for (i = 0; i < ndims; i++)
+    {
+        if (count[i] == 0 || offset[i] + count[i] > chunk_dims[i])
+            return 0;
+        if (chunk_dims[i] <= 1) continue;
+        rg->d[m] = (size_t) chunk_dims[i];
+        rg->o[m] = (size_t) offset[i];
+        rg->c[m] = (size_t) count[i];
+        m++;
+    }
+    if (m == 0) return 0;
+    rg->m = m;
+
+    rg->s[m-1] = 1;
+    for (i = m-2; i >= 0; i--)
+        rg->s[i] = rg->s[i+1] * rg->c[i+1];
+
+    rg->n[0] = rg->d[m-1]; rg->lo[0] = rg->o[m-1]; rg->hi[0] = rg->o[m-1] + rg->c[m-1];
+    rg->n[1] = 1;          rg->lo[1] = 0;          rg->hi[1] = 1;
+    rg->n[2] = 1;          rg->lo[2] = 0;          rg->hi[2] = 1;
+    if (m > 1)
+    {
+        rg->n[1] = rg->d[m-2]; rg->lo[1] = rg->o[m-2]; rg->hi[1] = rg->o[m-2] + rg->c[m-2];
+    }
+    if (m > 2)
+    {
+        /* the slowest dimensions are (or would be) folded into z */
+        size_t zlast = 0;
+        rg->lo[2] = 0;
+        for (i = 0; i < m-2; i++)
+        {
+            rg->n[2] = i ? rg->n[2] * rg->d[i] : rg->d[i];
+            rg->lo[2] = rg->lo[2] * rg->d[i] + rg->o[i];
+            zlast = zlast * rg->d[i] + rg->o[i] + rg->c[i] - 1;
+        }
+        rg->hi[2] = zlast + 1;
+    }
+    return 1;
+}
+
+/* offset in the output of field plane z or (size_t) -1 if z is outside the region */
+static size_t
+h5z_zfp_region_zoff(h5z_zfp_region_t const *rg, size_t z)
+{
+    size_t off = 0;
+    int i;
+
+    for (i = rg->m-3; i >= 0; i--)
+    {
+        size_t zi = z % rg->d[i];
+        z /= rg->d[i];
+        if (zi < rg->o[i] || zi >= rg->o[i] + rg->c[i])
+            return (size_t) -1;
+        off += (zi - rg->o[i]) * rg->s[i];
+    }
+    return off;
+}
+
+/* copy the region out of a whole decoded field */
+static void
+h5z_zfp_region_copy(h5z_zfp_region_t const *rg, char const *src, size_t dsize, char *out)
+{
+    size_t const sy = rg->m > 1 ? rg->s[rg->m-2] : 0;
+    size_t const len = (rg->hi[0] - rg->lo[0]) * dsize;
+    size_t y, z, zo;
+
+    for (z = rg->lo[2]; z < rg->hi[2]; z++)
+    {
+        if ((size_t) -1 == (zo = h5z_zfp_region_zoff(rg, z))) continue;
+        for (y = rg->lo[1]; y < rg->hi[1]; y++)
+            memcpy(out + (zo + (y - rg->lo[1]) * sy) * dsize,
+                src + ((z * rg->n[1] + y) * rg->n[0] + rg->lo[0]) * dsize, len);
+    }
+}
+
+#define H5Z_ZFP_DECODE_BLOCK(T, S)                                  \
+    case zfp_type_##S:                                              \
+        if (dims == 1) return Z zfp_decode_block_##S##_1(zstr, (T *) blk); \
+        if (dims == 2) return Z zfp_decode_block_##S##_2(zstr, (T *) blk); \
+        return Z zfp_decode_block_##S##_3(zstr, (T *) blk);
+
+static uint
+h5z_zfp_decode_block(zfp_stream *zstr, zfp_type type, uint dims, void *blk)
+{
+    switch (type)
+    {
+        H5Z_ZFP_DECODE_BLOCK(int32, int32)
+        H5Z_ZFP_DECODE_BLOCK(int64, int64)
+        H5Z_ZFP_DECODE_BLOCK(float, float)
+        H5Z_ZFP_DECODE_BLOCK(double, double)
+        default: return 0;
+    }
+}
+
+/* decode, from a fixed-rate stream, only the blocks that cover the region */
+static void
+h5z_zfp_region_blocks(zfp_stream *zstr, bitstream *bstr, zfp_type type, uint dims,
+    h5z_zfp_region_t const *rg, size_t dsize, char *out)
+{
+    double blk[64]; /* a 3D block of 8 byte values */
+    size_t const sy = rg->m > 1 ? rg->s[rg->m-2] : 0;
+    size_t const nbx = (rg->n[0] + 3) / 4, nby = (rg->n[1] + 3) / 4;
+    size_t bx, by, bz;
+
+    for (bz = rg->lo[2] / 4; bz <= (rg->hi[2] - 1) / 4; bz++)
+    {
+        size_t z0 = 4*bz > rg->lo[2] ? 4*bz : rg->lo[2];
+        size_t z1 = 4*bz+4 < rg->hi[2] ? 4*bz+4 : rg->hi[2];
+        size_t zo[4], z;
+        int any = 0;
+
+        /* with folding, a row of blocks may hold no plane inside the region */
+        for (z = z0; z < z1; z++)
+            any |= (size_t) -1 != (zo[z-4*bz] = h5z_zfp_region_zoff(rg, z));
+        if (!any) continue;
+
+        for (by = rg->lo[1] / 4; by <= (rg->hi[1] - 1) / 4; by++)
+        {
+            size_t y0 = 4*by > rg->lo[1] ? 4*by : rg->lo[1];
+            size_t y1 = 4*by+4 < rg->hi[1] ? 4*by+4 : rg->hi[1];
+
+            for (bx = rg->lo[0] / 4; bx <= (rg->hi[0] - 1) / 4; bx++)
+            {
+                size_t x0 = 4*bx > rg->lo[0] ? 4*bx : rg->lo[0];
+                size_t x1 = 4*bx+4 < rg->hi[0] ? 4*bx+4 : rg->hi[0];
+                size_t y;
+
+                B stream_rseek(bstr, (bx + nbx * (by + nby * bz)) * zstr->maxbits);
+                h5z_zfp_decode_block(zstr, type, dims, blk);
+
+                for (z = z0; z < z1; z++)
+                {
+                    if (zo[z-4*bz] == (size_t) -1) continue;
+                    for (y = y0; y < y1; y++)
+                        memcpy(out + (zo[z-4*bz] + (y - rg->lo[1]) * sy + x0 - rg->lo[0]) * dsize,
+                            (char *) blk + (16*(z-4*bz) + 4*(y-4*by) + x0-4*bx) * dsize,
+                            (x1 - x0) * dsize);
+                }
+            }
+        }
+    }
+}
+
+int h5z_zfp_decode_region(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *zbuf, size_t zsize, int ndims, hsize_t const *chunk_dims,
+    hsize_t const *offset, hsize_t const *count, void *out, int push)
+{
+    static char const *_funcname_ = "H5Z_zfp_decode_region";
+    int i, nf, retval = -1;
+    uint dims;
+    size_t dsize;
+    hsize_t fdims[H5S_MAX_RANK];
+    zfp_type ztype;
+    h5z_zfp_precond_t pc = {0, 0};
+    h5z_zfp_info_t info;
+    h5z_zfp_region_t rg;
+    h5z_zfp_context_t *ctx;
+    bitstream *bstr = 0;
+    zfp_stream *zstr = 0;
+    zfp_field *zfld = 0;
+    void *full = 0;
+
+    H5Z_zfp_init();
+
+    if (!cd_values || !zbuf || !chunk_dims || !offset || !count || !out ||
+        ndims < 1 || ndims > H5S_MAX_RANK)
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+
+    if (0 == get_zfp_info_from_cd_values(cd_nelmts, cd_values, &info, push))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_CANTGET, -1, "can't get ZFP mode/meta");
+
+    if (0 == (nf = h5z_zfp_field_dims(ndims, chunk_dims, fdims)) ||
+        0 == h5z_zfp_region_init(ndims, chunk_dims, offset, count, &rg))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_ARGS, H5E_BADRANGE, -1, "region not within chunk");
+
+    if (0 == (ctx = h5z_zfp_context_get()))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, -1, "ZFP context alloc failed");
+    zfld = ctx->zfld;
+    zstr = ctx->zstr;
+    Z zfp_field_set_metadata(zfld, info.zfp_meta);
+    Z zfp_stream_set_mode(zstr, info.zfp_mode);
+#if ZFP_VERSION_NO >= 0x0053
+    Z zfp_stream_set_execution(zstr, zfp_exec_serial);
+#endif
+    if (info.target)
+    {
+        int minexp;
+        if (!h5z_zfp_target_get(zbuf, zsize, &info, &minexp))
+            H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_BADVALUE, -1, "missing or bad ZFP target record");
+        Z zfp_stream_set_params(zstr, zstr->minbits, zstr->maxbits, zstr->maxprec, minexp);
+    }
+    h5z_zfp_read_precision(zstr, ctx);
+
+    /* the header must describe a chunk of the dimensions we were given */
+    dims = Z zfp_field_dimensionality(zfld);
+    if (dims != (uint) nf || zfld->nx != fdims[nf-1] ||
+        (nf > 1 && zfld->ny != fdims[nf-2]) || (nf > 2 && zfld->nz != fdims[nf-3]))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_ARGS, H5E_BADSIZE, -1, "chunk dimensions don't match ZFP header");
+
+    switch (ztype = Z zfp_field_type(zfld))
+    {
+        case zfp_type_int32: case zfp_type_float:  dsize = 4; break;
+        case zfp_type_int64: case zfp_type_double: dsize = 8; break;
+        default: H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_BADTYPE, -1, "invalid datatype");
+    }
+
+    if (info.precond)
+    {
+        if (!h5z_zfp_trailer_get(zbuf, zsize, &pc))
+            H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_BADVALUE, -1,
+                "missing or bad ZFP pre-conditioning trailer");
+        zsize -= H5Z_ZFP_TRAILER_SIZE;
+    }
+
+    if (0 == (bstr = B stream_open((void *) zbuf, zsize)))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, -1, "bitstream open failed");
+    Z zfp_stream_set_bit_stream(zstr, bstr);
+
+    /* An offset chunk is undone value by value in the region. Narrowed or
+       differenced chunks are decoded whole. */
+    if (zstr->minbits == zstr->maxbits && dims <= 3 &&
+        !(pc.flags & (H5Z_ZFP_PRECOND_NARROW | H5Z_ZFP_PRECOND_DELTA)))
+    {
+        if (h5z_zfp_field_blocks(zfld) * zstr->maxbits > 8 * zsize)
+            H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_ARGS, H5E_BADSIZE, -1, "compressed chunk too small");
+        h5z_zfp_region_blocks(zstr, bstr, ztype, dims, &rg, dsize, (char *) out);
+        if (pc.flags)
+        {
+            size_t n = 1;
+            for (i = 0; i < ndims; i++)
+                n *= (size_t) count[i];
+            h5z_zfp_precond_undo(out, n, ztype, &pc);
+        }
+    }
+    else
+    {
+        /* no random access; decode the whole chunk and copy the region out */
+        if (0 == (full = malloc(Z zfp_field_size(zfld, 0) * dsize)))
+            H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, -1,
+                "memory allocation failed for ZFP decompression");
+        Z zfp_field_set_pointer(zfld, full);
+        if (pc.flags & H5Z_ZFP_PRECOND_NARROW)
+            Z zfp_field_set_type(zfld, zfp_type_int32);
+        if (0 == Z zfp_decompress(zstr, zfld))
+            H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_CANTFILTER, -1, "decompression failed");
+        if (pc.flags)
+            h5z_zfp_precond_undo(full, Z zfp_field_size(zfld, 0), ztype, &pc);
+        h5z_zfp_region_copy(&rg, (char const *) full, dsize, (char *) out);
+    }
+    retval = 1;
+
+done:
+    if (zfld) Z zfp_field_set_pointer(zfld, 0);
+    if (zstr) Z zfp_stream_set_bit_stream(zstr, 0);
+    if (bstr) B stream_close(bstr);
+    if (full) free(full);
+    return retval;
+}
+
+int H5Z_zfp_decode_region(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *zbuf, size_t zsize, int ndims, hsize_t const *chunk_dims,
+    hsize_t const *offset, hsize_t const *count, void *out)
+{
+    return h5z_zfp_decode_region(cd_nelmts, cd_values, zbuf, zsize, ndims, chunk_dims,
+               offset, count, out, 1);
+}
+
+/* Compress one chunk, exactly as H5Z_filter_zfp would, into *out, of *outsize bytes,
+   growing it with realloc as needed. Apart from pushing errors, which it does only
+   if push, it makes no HDF5 calls and so may be used from threads other than the
+   one using HDF5, once H5Z_zfp_init has run. Returns the compressed size or 0 on
+   failure. */
+size_t h5z_zfp_encode_chunk(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *in, size_t nbytes, void **out, size_t *outsize, int push)
+{
+    static char const *_funcname_ = "H5Z_zfp_encode_chunk";
+    size_t dsize, msize, cap, tsize = 0, retval = 0;
+    void *pre = 0;
+    h5z_zfp_precond_t pc = {0, 0};
+    H5Z_zfp_chunk_stats_t cs;
+    h5z_zfp_info_t info;
+    h5z_zfp_context_t *ctx;
+    bitstream *bstr = 0;
+    zfp_stream *zstr = 0;
+    zfp_field *zfld = 0;
+
+    H5Z_zfp_init();
+
+    if (!cd_values || !in || !out || !outsize)
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_ARGS, H5E_BADVALUE, 0, "invalid arguments");
+
+    if (0 == get_zfp_info_from_cd_values(cd_nelmts, cd_values, &info, push))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_CANTGET, 0, "can't get ZFP mode/meta");
+
+    if (0 == (ctx = h5z_zfp_context_get()))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, 0, "ZFP context alloc failed");
+    zfld = ctx->zfld;
+    zstr = ctx->zstr;
+    Z zfp_field_set_metadata(zfld, info.zfp_meta);
+    Z zfp_stream_set_mode(zstr, info.zfp_mode);
+#if ZFP_VERSION_NO >= 0x0053
+    Z zfp_stream_set_execution(zstr, zfp_exec_serial);
+#endif
+
+    switch (Z zfp_field_type(zfld))
+    {
+        case zfp_type_int32: case zfp_type_float:  dsize = 4; break;
+        case zfp_type_int64: case zfp_type_double: dsize = 8; break;
+        default: H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_BADTYPE, 0, "invalid datatype");
+    }
+    if (Z zfp_field_size(zfld, 0) * dsize != nbytes)
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_ARGS, H5E_BADSIZE, 0, "chunk size doesn't match ZFP header");
+
+    Z zfp_field_set_pointer(zfld, (void *) in);
+    tsize = h5z_zfp_tail_size(&info);
+    if (info.cstats)
+        h5z_zfp_cstats_scan(in, nbytes / dsize, Z zfp_field_type(zfld), &cs);
+    if (info.precond)
+    {
+        zfp_type zt = Z zfp_field_type(zfld);
+
+        if (0 == (pre = h5z_zfp_scratch_get(nbytes)))
+            H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, 0,
+                "memory allocation failed for ZFP pre-conditioning");
+        pc.flags = h5z_zfp_precond_apply(in, nbytes / dsize, &zt, info.precond, &pc.offset, pre);
+        if (pc.flags)
+        {
+            Z zfp_field_set_type(zfld, zt);
+            Z zfp_field_set_pointer(zfld, pre);
+        }
+    }
+
+    if (info.target)
+        h5z_zfp_target_tune(zstr, zfld);
+
+    /* as in the filter, fixed-rate mode needs exactly this much */
+    msize = Z zfp_stream_maximum_size(zstr, zfld);
+    h5z_zfp_stream_bytes(zstr, zfld, msize, &cap);
+    if (*outsize < cap + tsize)
+    {
+        void *p;
+        if (0 == (p = realloc(*out, cap + tsize)))
+            H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, 0,
+                "memory allocation failed for ZFP compression");
+        *out = p;
+        *outsize = cap + tsize;
+    }
+
+    if (0 == (bstr = B stream_open(*out, cap)))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_RESOURCE, H5E_NOSPACE, 0, "bitstream open failed");
+    Z zfp_stream_set_bit_stream(zstr, bstr);
+
+    if (0 == (retval = Z zfp_compress(zstr, zfld)))
+        H5Z_ZFP_PUSH_IF_AND_GOTO(push, H5E_PLINE, H5E_CANTFILTER, 0, "compression failed");
+    if ((info.cstats & H5Z_ZFP_CSTATS_ERROR) && cs.flags &&
+        0 <= (cs.maxerr = h5z_zfp_cstats_maxerr(zstr, zfld, *out, retval)))
+        cs.flags |= H5Z_ZFP_CSTATS_ERROR;
+    if (tsize)
+    {
+        h5z_zfp_tail_put((unsigned char *) *out + retval, &info, &cs, zstr->minexp, &pc);
+        retval += tsize;
+    }
+
+done:
+    if (zfld) Z zfp_field_set_pointer(zfld, 0);
+    if (zstr) Z zfp_stream_set_bit_stream(zstr, 0);
+    if (bstr) B stream_close(bstr);
+    if (pre) h5z_zfp_scratch_put(pre, nbytes);
+    return retval;
+}
+
+size_t H5Z_zfp_encode_chunk(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *in, size_t nbytes, void **out, size_t *outsize)
+{
+    return h5z_zfp_encode_chunk(cd_nelmts, cd_values, in, nbytes, out, outsize, 1);
+}
+
+/* Compress one chunk to the same bytes H5Z_zfp_encode_chunk would, but a row of
+   blocks at a time into a staging buffer of about slab_bytes, handing what has
+   been written to sink(sink_ctx, bytes, n) each time it fills, and then the
+   records and trailer its dataset's chunks carry. So, no more than a slab of
+   the compressed chunk is ever held in memory. The max error of per-chunk
+   statistics needs the whole stream to decode and is not recorded. Fields of
+   more than 3 dimensions have no rows and are compressed whole. The sink
+   returns non-zero on success. Returns the compressed size or 0 on failure. */
+size_t H5Z_zfp_encode_chunk_sink(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *in, size_t nbytes, H5Z_zfp_sink_t sink, void *sink_ctx, size_t slab_bytes)
+{
+    static char const *_funcname_ = "H5Z_zfp_encode_chunk_sink";
+    size_t r, dsize, msize, nblocks, row_max_bits, stage_size = 0, sent = 0, zsize, tsize, retval = 0;
+    unsigned char tail[H5Z_ZFP_CSTATS_SIZE + H5Z_ZFP_TARGET_SIZE + H5Z_ZFP_TRAILER_SIZE];
+    void *stage = 0, *pre = 0;
+    h5z_zfp_precond_t pc = {0, 0};
+    H5Z_zfp_chunk_stats_t cs;
+    h5z_zfp_info_t info;
+    h5z_zfp_context_t *ctx;
+    h5z_zfp_rows_t rows;
+    bitstream *bstr = 0;
+    zfp_stream *zstr = 0;
+    zfp_field *zfld = 0;
+
+    H5Z_zfp_init();
+
+    if (!cd_values || !in || !sink)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, 0, "invalid arguments");
+
+    if (0 == get_zfp_info_from_cd_values(cd_nelmts, cd_values, &info, 1))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTGET, 0, "can't get ZFP mode/meta");
+
+    if (0 == (ctx = h5z_zfp_context_get()))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "ZFP context alloc failed");
+    zfld = ctx->zfld;
+    zstr = ctx->zstr;
+    Z zfp_field_set_metadata(zfld, info.zfp_meta);
+    Z zfp_stream_set_mode(zstr, info.zfp_mode);
+#if ZFP_VERSION_NO >= 0x0053
+    Z zfp_stream_set_execution(zstr, zfp_exec_serial);
+#endif
+
+    if (!h5z_zfp_rows_init(zfld, &rows))
+    {
+        void *out = 0;
+        size_t outsize = 0;
+
+        zfld = 0; zstr = 0;
+        if (0 != (retval = H5Z_zfp_encode_chunk(cd_nelmts, cd_values, in, nbytes, &out, &outsize)) &&
+            !sink(sink_ctx, out, retval))
+            retval = 0;
+        free(out);
+        if (!retval)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTFILTER, 0, "compression failed");
+        goto done;
+    }
+
+    switch (Z zfp_field_type(zfld))
+    {
+        case zfp_type_int32: case zfp_type_float:  dsize = 4; break;
+        case zfp_type_int64: case zfp_type_double: dsize = 8; break;
+        default: H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADTYPE, 0, "invalid datatype");
+    }
+    if (Z zfp_field_size(zfld, 0) * dsize != nbytes)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADSIZE, 0, "chunk size doesn't match ZFP header");
+
+    Z zfp_field_set_pointer(zfld, (void *) in);
+    tsize = h5z_zfp_tail_size(&info);
+    if (info.cstats)
+        h5z_zfp_cstats_scan(in, nbytes / dsize, Z zfp_field_type(zfld), &cs);
+    if (info.precond)
+    {
+        zfp_type zt = Z zfp_field_type(zfld);
+
+        if (0 == (pre = h5z_zfp_scratch_get(nbytes)))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
+                "memory allocation failed for ZFP pre-conditioning");
+        pc.flags = h5z_zfp_precond_apply(in, nbytes / dsize, &zt, info.precond, &pc.offset, pre);
+        if (pc.flags)
+        {
+            Z zfp_field_set_type(zfld, zt);
+            Z zfp_field_set_pointer(zfld, pre);
+        }
+    }
+
+    if (info.target)
+        h5z_zfp_target_tune(zstr, zfld);
+
+    /* Room for a slab, one worst case row past it and flush padding */
+    msize = Z zfp_stream_maximum_size(zstr, zfld);
+    nblocks = h5z_zfp_field_blocks(zfld);
+    row_max_bits = rows.row_blocks * ((8 * msize + nblocks - 1) / nblocks);
+    stage_size = slab_bytes + row_max_bits / 8 + 24;
+    if (stage_size > msize + 24) stage_size = msize + 24;
+    if (0 == (stage = h5z_zfp_scratch_get(stage_size)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0,
+            "memory allocation failed for ZFP compression");
+    if (0 == (bstr = B stream_open(stage, stage_size)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "bitstream open failed");
+    Z zfp_stream_set_bit_stream(zstr, bstr);
+
+    for (r = 0; r < rows.nrows; r++)
+    {
+        size_t pos, keep;
+
+        h5z_zfp_encode_row(zstr, zfld, &rows, r);
+        if ((pos = B stream_wtell(bstr)) < 8 * slab_bytes || r + 1 == rows.nrows)
+            continue;
+
+        /* Hand off all but the last 64 bits, which hold a partial word of any
+           word size, get the partial word written to the buffer, move what's
+           kept to its start and re-open there, seeking to where we left off. */
+        B stream_flush(bstr);
+        keep = (pos / 64) * 8;
+        if (!sink(sink_ctx, stage, keep))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_WRITEERROR, 0, "ZFP chunk sink failed");
+        sent += keep;
+        memmove(stage, (unsigned char *) stage + keep, B stream_size(bstr) - keep);
+        Z zfp_stream_set_bit_stream(zstr, 0);
+        B stream_close(bstr);
+        if (0 == (bstr = B stream_open(stage, stage_size)))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "bitstream open failed");
+        Z zfp_stream_set_bit_stream(zstr, bstr);
+        B stream_wseek(bstr, pos - 8 * keep);
+    }
+
+    Z zfp_stream_flush(zstr);
+    zsize = B stream_size(bstr);
+    if (!sink(sink_ctx, stage, zsize))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_WRITEERROR, 0, "ZFP chunk sink failed");
+    if (tsize)
+    {
+        h5z_zfp_tail_put(tail, &info, &cs, zstr->minexp, &pc);
+        if (!sink(sink_ctx, tail, tsize))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_WRITEERROR, 0, "ZFP chunk sink failed");
+    }
+    retval = sent + zsize + tsize;
+
+done:
+    if (zfld) Z zfp_field_set_pointer(zfld, 0);
+    if (zstr) Z zfp_stream_set_bit_stream(zstr, 0);
+    if (bstr) B stream_close(bstr);
+    if (stage) h5z_zfp_scratch_put(stage, stage_size);
+    if (pre) h5z_zfp_scratch_put(pre, nbytes);
+    return retval;
 }
 
 #undef Z
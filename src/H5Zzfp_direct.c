@@ -0,0 +1,1292 @@
+#include "H5Zzfp_direct.h"
+#include "H5Zzfp_direct_private.h"
+#include "H5Zzfp_plugin.h"
+
+#include "hdf5.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define H5Z_ZFP_PUSH_AND_GOTO(MAJ, MIN, RET, MSG)     \
+do                                                    \
+{                                                     \
+    H5Epush(H5E_DEFAULT,__FILE__,_funcname_,__LINE__, \
+        h5z_zfp_errclass(),MAJ,MIN,MSG);              \
+    retval = RET;                                     \
+    goto done;                                        \
+} while(0)
+
+/* make *buf at least n bytes */
+static int
+h5z_zfp_grow(void **buf, size_t *cap, size_t n)
+{
+    void *p;
+    if (n <= *cap) return 1;
+    if (0 == (p = realloc(*buf, n))) return 0;
+    *buf = p;
+    *cap = n;
+    return 1;
+}
+
+/* Scatter the lcount values, row-major in src, of the box at lo into buf, which
+   holds the hyperslab at offset with strides bstride, a row at a time */
+static void
+h5z_zfp_scatter(int rank, hsize_t const *lo, hsize_t const *lcount, hsize_t const *offset,
+    hsize_t const *bstride, size_t dsize, char const *src, char *buf)
+{
+    hsize_t j[H5S_MAX_RANK];
+    size_t len = (size_t) lcount[rank-1] * dsize;
+    int i;
+
+    memset(j, 0, sizeof(j));
+    while (1)
+    {
+        size_t boff = 0;
+        for (i = 0; i < rank; i++)
+            boff += (size_t) ((lo[i] - offset[i] + j[i]) * bstride[i]);
+        memcpy(buf + boff * dsize, src, len);
+        src += len;
+
+        for (i = rank-2; i >= 0 && ++j[i] == lcount[i]; i--)
+            j[i] = 0;
+        if (i < 0) break;
+    }
+}
+
+/* Read the hyperslab [offset, offset+count) of a ZFP compressed dataset into buf,
+   row-major, in the dataset's type and native byte order. Rather than going through
+   the filter, which must decompress every chunk the hyperslab touches in its entirety,
+   this fetches the compressed chunks with H5Dread_chunk and decodes only the parts of
+   each that are needed with H5Z_zfp_decode_region. ZFP must be the only filter. */
+int H5Z_zfp_read_region(hid_t dset_id, hsize_t const *offset, hsize_t const *count, void *buf)
+{
+    static char const *_funcname_ = "H5Z_zfp_read_region";
+    int i, rank, whole, retval = -1;
+    unsigned int flags, filter_config;
+    unsigned int cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    size_t cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX;
+    size_t dsize, zcap = 0, tcap = 0;
+    hsize_t dims[H5S_MAX_RANK], cdims[H5S_MAX_RANK], bstride[H5S_MAX_RANK];
+    hsize_t idx[H5S_MAX_RANK], last[H5S_MAX_RANK];
+    hsize_t choff[H5S_MAX_RANK], lo[H5S_MAX_RANK], loff[H5S_MAX_RANK], lcount[H5S_MAX_RANK];
+    hid_t dcpl = -1, space = -1, type = -1, ntype = -1;
+    void *zbuf = 0, *tbuf = 0;
+    double fill;
+
+    H5Z_zfp_init();
+
+#if !H5_VERSION_GE(1,10,3)
+    H5Z_ZFP_PUSH_AND_GOTO(H5E_FUNC, H5E_UNSUPPORTED, -1, "H5Dread_chunk requires HDF5 1.10.3 or newer");
+#else
+    if (!offset || !count || !buf)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+
+    if (0 > (dcpl = H5Dget_create_plist(dset_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset creation property list");
+
+    if (H5D_CHUNKED != H5Pget_layout(dcpl))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_BADTYPE, -1, "dataset is not chunked");
+
+    if (1 != H5Pget_nfilters(dcpl) ||
+        H5Z_FILTER_ZFP != H5Pget_filter2(dcpl, 0, &flags, &cd_nelmts, cd_values, 0, 0, &filter_config) ||
+        cd_nelmts > H5Z_ZFP_CD_NELMTS_MAX)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "ZFP is not the dataset's only filter");
+
+    if (0 > (space = H5Dget_space(dset_id)) ||
+        0 > (rank = H5Sget_simple_extent_dims(space, dims, 0)) ||
+        rank != H5Pget_chunk(dcpl, rank, cdims))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset dimensions");
+
+    if (0 > (type = H5Dget_type(dset_id)) ||
+        0 > (ntype = H5Tget_native_type(type, H5T_DIR_ASCEND)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset type");
+
+    dsize = H5Tget_size(ntype);
+    if (dsize != 4 && dsize != 8)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATATYPE, H5E_BADTYPE, -1, "invalid datatype size");
+
+    if (0 > H5Pget_fill_value(dcpl, ntype, &fill))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLIST, H5E_CANTGET, -1, "can't get fill value");
+
+    for (i = rank-1; i >= 0; i--)
+    {
+        if (count[i] == 0 || offset[i] + count[i] > dims[i])
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADRANGE, -1, "region not within dataset");
+        bstride[i] = i == rank-1 ? 1 : bstride[i+1] * count[i+1];
+        idx[i] = offset[i] / cdims[i];
+        last[i] = (offset[i] + count[i] - 1) / cdims[i];
+    }
+
+    /* visit every chunk the region touches */
+    while (1)
+    {
+        size_t n = dsize;
+        hsize_t zsize;
+        uint32_t filter_mask = 0;
+        char *dst;
+
+        whole = 1;
+        for (i = 0; i < rank; i++)
+        {
+            hsize_t hi;
+            choff[i] = idx[i] * cdims[i];
+            lo[i] = offset[i] > choff[i] ? offset[i] : choff[i];
+            hi = offset[i] + count[i] < choff[i] + cdims[i] ? offset[i] + count[i] : choff[i] + cdims[i];
+            loff[i] = lo[i] - choff[i];
+            lcount[i] = hi - lo[i];
+            whole &= lcount[i] == count[i];
+            n *= (size_t) lcount[i];
+        }
+
+        /* when one chunk holds the whole region, decode straight into buf */
+        if (!whole && !h5z_zfp_grow(&tbuf, &tcap, n))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+        dst = whole ? (char *) buf : (char *) tbuf;
+
+        if (0 > H5Dget_chunk_storage_size(dset_id, choff, &zsize))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get chunk storage size");
+
+        if (zsize == 0) /* chunk never written */
+        {
+            size_t k;
+            for (k = 0; k < n; k += dsize)
+                memcpy(dst + k, &fill, dsize);
+        }
+        else
+        {
+            if (!h5z_zfp_grow(&zbuf, &zcap, (size_t) zsize))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+            if (0 > H5Dread_chunk(dset_id, H5P_DEFAULT, choff, &filter_mask, zbuf))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_READERROR, -1, "H5Dread_chunk failed");
+            if (filter_mask & 0x1)
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "chunk not ZFP compressed");
+            if (0 > H5Z_zfp_decode_region(cd_nelmts, cd_values, zbuf, (size_t) zsize,
+                        rank, cdims, loff, lcount, dst))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTFILTER, -1, "region decode failed");
+        }
+
+        if (!whole)
+            h5z_zfp_scatter(rank, lo, lcount, offset, bstride, dsize, (char const *) tbuf, (char *) buf);
+
+        for (i = rank-1; i >= 0 && ++idx[i] > last[i]; i--)
+            idx[i] = offset[i] / cdims[i];
+        if (i < 0) break;
+    }
+
+    retval = 1;
+#endif
+
+done:
+    if (tbuf) free(tbuf);
+    if (zbuf) free(zbuf);
+    if (ntype >= 0) H5Tclose(ntype);
+    if (type >= 0) H5Tclose(type);
+    if (space >= 0) H5Sclose(space);
+    if (dcpl >= 0) H5Pclose(dcpl);
+    return retval;
+}
+
+/* Write-behind compression. Chunks handed to H5Z_zfp_writer_put are queued for a
+   pool of threads which compress them with H5Z_zfp_encode_chunk, using the
+   cd_values set_local stored for the dataset. Compressed chunks are written with
+   H5Dwrite_chunk in the order they were put, always from the calling thread and
+   only within H5Z_zfp_writer_put and H5Z_zfp_writer_close, so the workers never
+   call into HDF5, not even to push errors; a job that fails is reported by the
+   call that comes to write it. The result reads back through the filter as usual.
+   At most H5Z_ZFP_WRITER_DEPTH chunks per thread are in flight. */
+#define H5Z_ZFP_WRITER_DEPTH 2
+
+enum { H5Z_ZFP_JOB_QUEUED, H5Z_ZFP_JOB_DONE, H5Z_ZFP_JOB_FAILED };
+
+typedef struct _h5z_zfp_job_t {
+    hsize_t offset[H5S_MAX_RANK];
+    void *raw;              /* chunk data */
+    void *z;                /* compressed chunk */
+    size_t zcap, zsize;
+    int state;
+} h5z_zfp_job_t;
+
+struct _H5Z_zfp_writer_t {
+    hid_t dset_id;
+    int rank;
+    hsize_t dims[H5S_MAX_RANK], cdims[H5S_MAX_RANK];
+    size_t cd_nelmts;
+    unsigned int cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    size_t nbytes;          /* bytes in a chunk */
+    size_t depth;           /* jobs in the ring */
+    h5z_zfp_job_t *jobs;
+    size_t head, next, tail;/* sequence numbers of next job to write, compress, fill */
+    int quit, nthreads;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;    /* job queued or quitting */
+    pthread_cond_t done;    /* job compressed */
+};
+
+static void *
+h5z_zfp_writer_work(void *arg)
+{
+    H5Z_zfp_writer_t *w = (H5Z_zfp_writer_t *) arg;
+
+    pthread_mutex_lock(&w->mutex);
+    while (1)
+    {
+        h5z_zfp_job_t *j;
+
+        while (!w->quit && w->next == w->tail)
+            pthread_cond_wait(&w->work, &w->mutex);
+        if (w->next == w->tail)
+            break;
+        j = &w->jobs[w->next++ % w->depth];
+        pthread_mutex_unlock(&w->mutex);
+
+        j->zsize = h5z_zfp_encode_chunk(w->cd_nelmts, w->cd_values, j->raw, w->nbytes, &j->z, &j->zcap, 0);
+
+        pthread_mutex_lock(&w->mutex);
+        j->state = j->zsize ? H5Z_ZFP_JOB_DONE : H5Z_ZFP_JOB_FAILED;
+        pthread_cond_broadcast(&w->done);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return 0;
+}
+
+/* Stop the workers, abandoning any queued jobs, and free everything */
+static void
+h5z_zfp_writer_free(H5Z_zfp_writer_t *w)
+{
+    size_t k;
+    int i;
+
+    pthread_mutex_lock(&w->mutex);
+    w->quit = 1;
+    w->next = w->tail;
+    pthread_cond_broadcast(&w->work);
+    pthread_mutex_unlock(&w->mutex);
+    for (i = 0; i < w->nthreads; i++)
+        pthread_join(w->threads[i], 0);
+
+    for (k = 0; w->jobs && k < w->depth; k++)
+    {
+        if (w->jobs[k].raw) free(w->jobs[k].raw);
+        if (w->jobs[k].z) free(w->jobs[k].z);
+    }
+    if (w->jobs) free(w->jobs);
+    if (w->threads) free(w->threads);
+    pthread_cond_destroy(&w->done);
+    pthread_cond_destroy(&w->work);
+    pthread_mutex_destroy(&w->mutex);
+    free(w);
+}
+
+/* Write compressed chunks from the head of the queue, in order. With wait, wait for
+   and write all of them. Otherwise, stop at the first not yet compressed. Called,
+   and returns, with the mutex held. */
+static int
+h5z_zfp_writer_flush(H5Z_zfp_writer_t *w, int wait)
+{
+    static char const *_funcname_ = "h5z_zfp_writer_flush";
+    int retval = 1;
+
+    while (w->head != w->tail)
+    {
+        h5z_zfp_job_t *j = &w->jobs[w->head % w->depth];
+        herr_t status = -1;
+
+        if (j->state == H5Z_ZFP_JOB_QUEUED)
+        {
+            if (!wait) break;
+            pthread_cond_wait(&w->done, &w->mutex);
+            continue;
+        }
+        if (j->state == H5Z_ZFP_JOB_FAILED)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTFILTER, -1, "chunk compression failed");
+
+        /* the workers are done with this job; nothing touches it until it is refilled */
+        pthread_mutex_unlock(&w->mutex);
+#if H5_VERSION_GE(1,10,3)
+        status = H5Dwrite_chunk(w->dset_id, H5P_DEFAULT, 0, j->offset, j->zsize, j->z);
+#endif
+        pthread_mutex_lock(&w->mutex);
+        w->head++;
+        if (status < 0)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_WRITEERROR, -1, "H5Dwrite_chunk failed");
+    }
+
+done:
+    return retval;
+}
+
+/* Start write-behind compression of dset_id, a chunked dataset with ZFP as its only
+   filter, on nthreads threads (<= 0 for one per processor). dset_id must remain open
+   until H5Z_zfp_writer_close. Returns 0 on failure. */
+H5Z_zfp_writer_t *H5Z_zfp_writer_open(hid_t dset_id, int nthreads)
+{
+    static char const *_funcname_ = "H5Z_zfp_writer_open";
+    H5Z_zfp_writer_t *w = 0, *retval = 0;
+    unsigned int flags, filter_config;
+    hid_t dcpl = -1, space = -1, type = -1, ntype = -1;
+    size_t k;
+    int i;
+
+    H5Z_zfp_init();
+
+#if !H5_VERSION_GE(1,10,3)
+    H5Z_ZFP_PUSH_AND_GOTO(H5E_FUNC, H5E_UNSUPPORTED, 0, "H5Dwrite_chunk requires HDF5 1.10.3 or newer");
+#else
+    if (0 == (w = (H5Z_zfp_writer_t *) calloc(1, sizeof(*w))))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "memory allocation failed");
+    pthread_mutex_init(&w->mutex, 0);
+    pthread_cond_init(&w->work, 0);
+    pthread_cond_init(&w->done, 0);
+    w->dset_id = dset_id;
+    w->cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX;
+
+    if (0 > (dcpl = H5Dget_create_plist(dset_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, 0, "can't get dataset creation property list");
+
+    if (H5D_CHUNKED != H5Pget_layout(dcpl))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_BADTYPE, 0, "dataset is not chunked");
+
+    if (1 != H5Pget_nfilters(dcpl) ||
+        H5Z_FILTER_ZFP != H5Pget_filter2(dcpl, 0, &flags, &w->cd_nelmts, w->cd_values, 0, 0, &filter_config) ||
+        w->cd_nelmts > H5Z_ZFP_CD_NELMTS_MAX)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "ZFP is not the dataset's only filter");
+
+    if (0 > (space = H5Dget_space(dset_id)) ||
+        0 > (w->rank = H5Sget_simple_extent_dims(space, w->dims, 0)) ||
+        w->rank != H5Pget_chunk(dcpl, w->rank, w->cdims))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, 0, "can't get dataset dimensions");
+
+    /* chunks go to the file as is, so they must already be in the dataset's type */
+    if (0 > (type = H5Dget_type(dset_id)) ||
+        0 > (ntype = H5Tget_native_type(type, H5T_DIR_ASCEND)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, 0, "can't get dataset type");
+    if (0 >= H5Tequal(type, ntype))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATATYPE, H5E_BADTYPE, 0, "dataset type is not native");
+
+    w->nbytes = H5Tget_size(type);
+    if (w->nbytes != 4 && w->nbytes != 8)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATATYPE, H5E_BADTYPE, 0, "invalid datatype size");
+    for (i = 0; i < w->rank; i++)
+        w->nbytes *= (size_t) w->cdims[i];
+
+    if (nthreads <= 0)
+        nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+        nthreads = 1;
+
+    w->depth = (size_t) nthreads * H5Z_ZFP_WRITER_DEPTH;
+    if (0 == (w->jobs = (h5z_zfp_job_t *) calloc(w->depth, sizeof(h5z_zfp_job_t))) ||
+        0 == (w->threads = (pthread_t *) calloc((size_t) nthreads, sizeof(pthread_t))))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "memory allocation failed");
+    for (k = 0; k < w->depth; k++)
+        if (0 == (w->jobs[k].raw = malloc(w->nbytes)))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "memory allocation failed");
+
+    for (; w->nthreads < nthreads; w->nthreads++)
+        if (pthread_create(&w->threads[w->nthreads], 0, h5z_zfp_writer_work, w))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_CANTINIT, 0, "can't start writer thread");
+
+    retval = w;
+    w = 0;
+#endif
+
+done:
+    if (w) h5z_zfp_writer_free(w);
+    if (ntype >= 0) H5Tclose(ntype);
+    if (type >= 0) H5Tclose(type);
+    if (space >= 0) H5Sclose(space);
+    if (dcpl >= 0) H5Pclose(dcpl);
+    return retval;
+}
+
+/* Queue the chunk at offset, a whole chunk in the dataset's type, for compression.
+   The data is copied; chunk may be re-used on return. Blocks only if all the
+   writer's jobs are in flight. Chunks already compressed are written first. */
+int H5Z_zfp_writer_put(H5Z_zfp_writer_t *w, hsize_t const *offset, void const *chunk)
+{
+    static char const *_funcname_ = "H5Z_zfp_writer_put";
+    h5z_zfp_job_t *j;
+    int i, retval = -1;
+
+    H5Z_zfp_init();
+
+    if (!w || !offset || !chunk)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+    for (i = 0; i < w->rank; i++)
+        if (offset[i] % w->cdims[i] || offset[i] >= w->dims[i])
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADRANGE, -1, "offset is not that of a chunk");
+
+    pthread_mutex_lock(&w->mutex);
+    retval = 1;
+    while (retval > 0 && w->tail - w->head == w->depth)
+    {
+        size_t head = w->head;
+        retval = h5z_zfp_writer_flush(w, 0);
+        if (retval > 0 && w->head == head)
+            pthread_cond_wait(&w->done, &w->mutex);
+    }
+    if (retval > 0)
+    {
+        /* the workers don't look at this job until tail moves past it */
+        j = &w->jobs[w->tail % w->depth];
+        pthread_mutex_unlock(&w->mutex);
+        memcpy(j->offset, offset, w->rank * sizeof(hsize_t));
+        memcpy(j->raw, chunk, w->nbytes);
+        j->state = H5Z_ZFP_JOB_QUEUED;
+        j->zsize = 0;
+        pthread_mutex_lock(&w->mutex);
+        w->tail++;
+        pthread_cond_signal(&w->work);
+        retval = h5z_zfp_writer_flush(w, 0);
+    }
+    pthread_mutex_unlock(&w->mutex);
+
+done:
+    return retval;
+}
+
+/* Wait for and write all queued chunks, then stop the workers and free w, even on
+   failure. */
+int H5Z_zfp_writer_close(H5Z_zfp_writer_t *w)
+{
+    static char const *_funcname_ = "H5Z_zfp_writer_close";
+    int retval = -1;
+
+    H5Z_zfp_init();
+
+    if (!w)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+
+    pthread_mutex_lock(&w->mutex);
+    retval = h5z_zfp_writer_flush(w, 1);
+    pthread_mutex_unlock(&w->mutex);
+    h5z_zfp_writer_free(w);
+
+done:
+    return retval;
+}
+
+/* Parallel whole-dataset reads. The calling thread fetches the compressed chunks
+   with H5Dread_chunk, in file address order, and hands them round-robin to the
+   queues of a pool of threads, which decode them with H5Z_zfp_decode_region. A
+   thread whose queue is empty steals from the back of the others'. As with the
+   writer, only the calling thread calls HDF5: a worker that fails to decode a
+   chunk only flags it, and the calling thread pushes the one error. At most
+   H5Z_ZFP_READER_DEPTH chunks per thread are read but not yet decoded. */
+#define H5Z_ZFP_READER_DEPTH 4
+
+typedef struct _h5z_zfp_rchunk_t {
+    hsize_t offset[H5S_MAX_RANK];
+    haddr_t addr;
+    hsize_t size;
+    void *z;
+} h5z_zfp_rchunk_t;
+
+typedef struct _h5z_zfp_reader_t h5z_zfp_reader_t;
+
+typedef struct _h5z_zfp_rworker_t {
+    h5z_zfp_reader_t *r;
+    int index;
+    size_t lo, hi;          /* sequence numbers of front and back of queue */
+    size_t *queue;          /* ring of depth chunk indices */
+    void *tbuf;             /* decoded chunk, when not decoded into buf */
+    size_t tcap;
+    pthread_t thread;
+} h5z_zfp_rworker_t;
+
+struct _h5z_zfp_reader_t {
+    hid_t dset_id;
+    int rank;
+    hsize_t dims[H5S_MAX_RANK], cdims[H5S_MAX_RANK], bstride[H5S_MAX_RANK];
+    size_t cd_nelmts;
+    unsigned int cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    size_t dsize, depth;
+    char *buf;
+    h5z_zfp_rchunk_t *chunks;
+    h5z_zfp_rworker_t *workers;
+    int nworkers;
+    size_t inflight;        /* chunks read but not yet decoded */
+    int eof, failed;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;    /* chunk queued, eof or failed */
+    pthread_cond_t room;    /* chunk decoded */
+};
+
+static int
+h5z_zfp_rchunk_cmp(void const *a, void const *b)
+{
+    haddr_t x = ((h5z_zfp_rchunk_t const *) a)->addr, y = ((h5z_zfp_rchunk_t const *) b)->addr;
+    return x < y ? -1 : x > y;
+}
+
+/* Decode chunk c into its place in buf. When that place is contiguous, which it is
+   when every dimension is either whole or outside the first one that isn't and
+   of count 1, decode straight into buf. Errors are pushed only if push. */
+static int
+h5z_zfp_reader_decode(h5z_zfp_reader_t const *r, h5z_zfp_rchunk_t const *c,
+    void **tbuf, size_t *tcap, int push)
+{
+    hsize_t zero[H5S_MAX_RANK], lcount[H5S_MAX_RANK];
+    size_t n = r->dsize, boff = 0;
+    int i, part = 0, contig = 1;
+
+    for (i = r->rank-1; i >= 0; i--)
+    {
+        zero[i] = 0;
+        lcount[i] = r->dims[i] - c->offset[i] < r->cdims[i] ? r->dims[i] - c->offset[i] : r->cdims[i];
+        if (part && lcount[i] != 1) contig = 0;
+        if (lcount[i] != r->dims[i]) part = 1;
+        n *= (size_t) lcount[i];
+        boff += (size_t) (c->offset[i] * r->bstride[i]);
+    }
+
+    if (contig)
+        return 0 < h5z_zfp_decode_region(r->cd_nelmts, r->cd_values, c->z, (size_t) c->size,
+                       r->rank, r->cdims, zero, lcount, r->buf + boff * r->dsize, push);
+
+    if (n > *tcap)
+    {
+        void *p;
+        if (0 == (p = realloc(*tbuf, n))) return 0;
+        *tbuf = p;
+        *tcap = n;
+    }
+    if (0 > h5z_zfp_decode_region(r->cd_nelmts, r->cd_values, c->z, (size_t) c->size,
+                r->rank, r->cdims, zero, lcount, *tbuf, push))
+        return 0;
+    h5z_zfp_scatter(r->rank, c->offset, lcount, zero, r->bstride, r->dsize,
+        (char const *) *tbuf, r->buf);
+    return 1;
+}
+
+/* Take the next chunk from the front of this worker's queue or, failing that,
+   steal one from the back of another's. Called with the mutex held. */
+static int
+h5z_zfp_reader_take(h5z_zfp_reader_t *r, h5z_zfp_rworker_t *me, size_t *id)
+{
+    int k;
+
+    if (r->failed) return 0;
+    if (me->lo != me->hi)
+    {
+        *id = me->queue[me->lo++ % r->depth];
+        return 1;
+    }
+    for (k = 1; k < r->nworkers; k++)
+    {
+        h5z_zfp_rworker_t *v = &r->workers[(me->index + k) % r->nworkers];
+        if (v->lo != v->hi)
+        {
+            *id = v->queue[--v->hi % r->depth];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *
+h5z_zfp_reader_work(void *arg)
+{
+    h5z_zfp_rworker_t *me = (h5z_zfp_rworker_t *) arg;
+    h5z_zfp_reader_t *r = me->r;
+
+    pthread_mutex_lock(&r->mutex);
+    while (1)
+    {
+        size_t id;
+        int ok;
+
+        if (!h5z_zfp_reader_take(r, me, &id))
+        {
+            if (r->eof || r->failed) break;
+            pthread_cond_wait(&r->work, &r->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&r->mutex);
+
+        ok = h5z_zfp_reader_decode(r, &r->chunks[id], &me->tbuf, &me->tcap, 0);
+        free(r->chunks[id].z);
+        r->chunks[id].z = 0;
+
+        pthread_mutex_lock(&r->mutex);
+        if (!ok) r->failed = 1;
+        r->inflight--;
+        pthread_cond_broadcast(&r->room);
+        if (!ok) pthread_cond_broadcast(&r->work);
+    }
+    pthread_mutex_unlock(&r->mutex);
+    return 0;
+}
+
+/* Read all of dset_id, a chunked dataset with ZFP as its only filter, into buf,
+   row-major, in the dataset's type and native byte order, decoding chunks on
+   nthreads threads (<= 0 for one per processor). memspace must be H5S_ALL or select
+   all of a space with as many elements as the dataset. */
+int H5Z_zfp_read_parallel(hid_t dset_id, hid_t memspace, void *buf, int nthreads)
+{
+    static char const *_funcname_ = "H5Z_zfp_read_parallel";
+    h5z_zfp_reader_t r;
+    unsigned int flags, filter_config;
+    hid_t dcpl = -1, space = -1, type = -1, ntype = -1;
+    hsize_t k, nchunks = 0, total = 1, npoints = 1;
+    double fill;
+    int i, started = 0, retval = -1;
+
+    H5Z_zfp_init();
+
+    memset(&r, 0, sizeof(r));
+    pthread_mutex_init(&r.mutex, 0);
+    pthread_cond_init(&r.work, 0);
+    pthread_cond_init(&r.room, 0);
+
+#if !H5_VERSION_GE(1,10,5)
+    H5Z_ZFP_PUSH_AND_GOTO(H5E_FUNC, H5E_UNSUPPORTED, -1, "H5Dget_chunk_info requires HDF5 1.10.5 or newer");
+#else
+    if (!buf)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+    r.dset_id = dset_id;
+    r.buf = (char *) buf;
+    r.cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX;
+
+    if (0 > (dcpl = H5Dget_create_plist(dset_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset creation property list");
+
+    if (H5D_CHUNKED != H5Pget_layout(dcpl))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_BADTYPE, -1, "dataset is not chunked");
+
+    if (1 != H5Pget_nfilters(dcpl) ||
+        H5Z_FILTER_ZFP != H5Pget_filter2(dcpl, 0, &flags, &r.cd_nelmts, r.cd_values, 0, 0, &filter_config) ||
+        r.cd_nelmts > H5Z_ZFP_CD_NELMTS_MAX)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "ZFP is not the dataset's only filter");
+
+    if (0 > (space = H5Dget_space(dset_id)) ||
+        0 > (r.rank = H5Sget_simple_extent_dims(space, r.dims, 0)) ||
+        r.rank != H5Pget_chunk(dcpl, r.rank, r.cdims))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset dimensions");
+
+    for (i = r.rank-1; i >= 0; i--)
+    {
+        r.bstride[i] = i == r.rank-1 ? 1 : r.bstride[i+1] * r.dims[i+1];
+        total *= (r.dims[i] + r.cdims[i] - 1) / r.cdims[i];
+        npoints *= r.dims[i];
+    }
+
+    if (memspace != H5S_ALL &&
+        (H5S_SEL_ALL != H5Sget_select_type(memspace) || npoints != (hsize_t) H5Sget_select_npoints(memspace)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADSELECT, -1, "memspace must select as many elements as the dataset");
+
+    if (0 > (type = H5Dget_type(dset_id)) ||
+        0 > (ntype = H5Tget_native_type(type, H5T_DIR_ASCEND)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset type");
+
+    r.dsize = H5Tget_size(ntype);
+    if (r.dsize != 4 && r.dsize != 8)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATATYPE, H5E_BADTYPE, -1, "invalid datatype size");
+
+    /* list the chunks written, in the order they are in the file */
+    if (0 > H5Dget_num_chunks(dset_id, space, &nchunks))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get number of chunks");
+    if (nchunks && 0 == (r.chunks = (h5z_zfp_rchunk_t *) calloc((size_t) nchunks, sizeof(h5z_zfp_rchunk_t))))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+    for (k = 0; k < nchunks; k++)
+    {
+        unsigned int filter_mask = 0;
+        if (0 > H5Dget_chunk_info(dset_id, space, k, r.chunks[k].offset, &filter_mask,
+                    &r.chunks[k].addr, &r.chunks[k].size))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get chunk info");
+        if (filter_mask & 0x1)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "chunk not ZFP compressed");
+    }
+    qsort(r.chunks, (size_t) nchunks, sizeof(h5z_zfp_rchunk_t), h5z_zfp_rchunk_cmp);
+
+    /* chunks never written hold the fill value */
+    if (nchunks < total)
+    {
+        if (0 > H5Pget_fill_value(dcpl, ntype, &fill))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLIST, H5E_CANTGET, -1, "can't get fill value");
+        for (k = 0; k < npoints; k++)
+            memcpy(r.buf + k * r.dsize, &fill, r.dsize);
+    }
+    if (nchunks == 0)
+    {
+        retval = 1;
+        goto done;
+    }
+
+    if (nthreads <= 0)
+        nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+        nthreads = 1;
+    r.depth = (size_t) nthreads * H5Z_ZFP_READER_DEPTH;
+    if (0 == (r.workers = (h5z_zfp_rworker_t *) calloc((size_t) nthreads, sizeof(h5z_zfp_rworker_t))))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+    for (i = 0; i < nthreads; i++)
+    {
+        r.workers[i].r = &r;
+        r.workers[i].index = i;
+        if (0 == (r.workers[i].queue = (size_t *) malloc(r.depth * sizeof(size_t))))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+    }
+    r.nworkers = nthreads;
+
+    /* Read the chunks in file order and queue them. The first is decoded here before
+       the workers start. That sets up the filter's header cache from this thread,
+       so the workers needn't call HDF5 to do it. */
+    for (k = 0; k < nchunks; k++)
+    {
+        h5z_zfp_rchunk_t *c = &r.chunks[k];
+        uint32_t filter_mask = 0;
+
+        pthread_mutex_lock(&r.mutex);
+        while (!r.failed && r.inflight == r.depth)
+            pthread_cond_wait(&r.room, &r.mutex);
+        pthread_mutex_unlock(&r.mutex);
+        if (r.failed)
+            break;
+
+        if (0 == (c->z = malloc((size_t) c->size)))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+        if (0 > H5Dread_chunk(dset_id, H5P_DEFAULT, c->offset, &filter_mask, c->z))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_READERROR, -1, "H5Dread_chunk failed");
+
+        if (k == 0)
+        {
+            if (!h5z_zfp_reader_decode(&r, c, &r.workers[0].tbuf, &r.workers[0].tcap, 1))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_CANTFILTER, -1, "chunk decode failed");
+            free(c->z);
+            c->z = 0;
+            for (; started < nthreads; started++)
+                if (pthread_create(&r.workers[started].thread, 0, h5z_zfp_reader_work, &r.workers[started]))
+                    H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_CANTINIT, -1, "can't start reader thread");
+            continue;
+        }
+
+        pthread_mutex_lock(&r.mutex);
+        {
+            h5z_zfp_rworker_t *v = &r.workers[k % nthreads];
+            v->queue[v->hi++ % r.depth] = (size_t) k;
+        }
+        r.inflight++;
+        pthread_cond_broadcast(&r.work);
+        pthread_mutex_unlock(&r.mutex);
+    }
+
+    retval = 1;
+#endif
+
+done:
+    pthread_mutex_lock(&r.mutex);
+    r.eof = 1;
+    if (retval < 0) r.failed = 1;
+    pthread_cond_broadcast(&r.work);
+    pthread_mutex_unlock(&r.mutex);
+    for (i = 0; i < started; i++)
+        pthread_join(r.workers[i].thread, 0);
+    if (r.failed && retval > 0)
+    {
+        H5Epush(H5E_DEFAULT, __FILE__, _funcname_, __LINE__, h5z_zfp_errclass(),
+            H5E_PLINE, H5E_CANTFILTER, "chunk decode failed");
+        retval = -1;
+    }
+
+    for (i = 0; r.workers && i < nthreads; i++)
+    {
+        if (r.workers[i].queue) free(r.workers[i].queue);
+        if (r.workers[i].tbuf) free(r.workers[i].tbuf);
+    }
+    if (r.workers) free(r.workers);
+    for (k = 0; r.chunks && k < nchunks; k++)
+        if (r.chunks[k].z) free(r.chunks[k].z);
+    if (r.chunks) free(r.chunks);
+    pthread_cond_destroy(&r.room);
+    pthread_cond_destroy(&r.work);
+    pthread_mutex_destroy(&r.mutex);
+    if (ntype >= 0) H5Tclose(ntype);
+    if (type >= 0) H5Tclose(type);
+    if (space >= 0) H5Sclose(space);
+    if (dcpl >= 0) H5Pclose(dcpl);
+    return retval;
+}
+
+/* 1 if dcpl is chunked with ZFP as its only filter, filling in chunk dims and cd_values */
+static int
+h5z_zfp_only_filter(hid_t dcpl, int rank, hsize_t *cdims, size_t *cd_nelmts, unsigned int *cd_values)
+{
+    unsigned int flags, filter_config;
+
+    *cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX;
+    return H5D_CHUNKED == H5Pget_layout(dcpl) &&
+           rank == H5Pget_chunk(dcpl, rank, cdims) &&
+           1 == H5Pget_nfilters(dcpl) &&
+           H5Z_FILTER_ZFP == H5Pget_filter2(dcpl, 0, &flags, cd_nelmts, cd_values, 0, 0, &filter_config) &&
+           *cd_nelmts <= H5Z_ZFP_CD_NELMTS_MAX;
+}
+
+/* Copy src_id to a new dataset, dst_name in dst_loc, created with dcpl_id. With
+   H5P_DEFAULT, the copy has the source's creation properties and is made with
+   H5Ocopy, which copies chunks without filtering them. Otherwise, when the new
+   dataset ends up with the same chunk dims and ZFP cd_values as the source, chunks
+   are moved with H5Dread_chunk/H5Dwrite_chunk and never decompressed. Only when
+   they differ is the data read and written, and so recompressed, a slab at a time.
+   A ZFP dcpl_id must be set with H5Pset_zfp_* or the H5Pset_zfp_*_cdata macros; the
+   cd_values of an existing ZFP dataset are not re-usable. Only H5Ocopy copies the
+   source's attributes. Returns 1 if chunks were copied as is, 0 if the data was
+   recompressed and -1 on failure, which may leave a partial destination dataset. */
+int H5Z_zfp_copy(hid_t src_id, hid_t dst_loc, char const *dst_name, hid_t dcpl_id)
+{
+    static char const *_funcname_ = "H5Z_zfp_copy";
+    int i, rank, retval = -1;
+    unsigned int src_cd_values[H5Z_ZFP_CD_NELMTS_MAX], dst_cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    size_t src_cd_nelmts, dst_cd_nelmts, bcap = 0;
+    hsize_t dims[H5S_MAX_RANK], src_cdims[H5S_MAX_RANK], dst_cdims[H5S_MAX_RANK];
+    hid_t src_dcpl = -1, dst_dcpl = -1, space = -1, mspace = -1, type = -1, dst_id = -1;
+    void *buf = 0;
+
+    H5Z_zfp_init();
+
+    if (!dst_name)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+
+    if (dcpl_id == H5P_DEFAULT)
+    {
+        if (0 > H5Ocopy(src_id, ".", dst_loc, dst_name, H5P_DEFAULT, H5P_DEFAULT))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTCOPY, -1, "H5Ocopy failed");
+        retval = 1;
+        goto done;
+    }
+
+    if (0 > (space = H5Dget_space(src_id)) ||
+        0 > (rank = H5Sget_simple_extent_dims(space, dims, 0)) ||
+        0 > (type = H5Dget_type(src_id)) ||
+        0 > (src_dcpl = H5Dget_create_plist(src_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get source dataset info");
+
+    if (0 > (dst_id = H5Dcreate(dst_loc, dst_name, type, space, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTCREATE, -1, "can't create destination dataset");
+
+    /* compare what set_local made of dcpl_id with what it made of the source's */
+    if (0 > (dst_dcpl = H5Dget_create_plist(dst_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset creation property list");
+
+#if H5_VERSION_GE(1,10,3)
+    if (rank > 0 &&
+        h5z_zfp_only_filter(src_dcpl, rank, src_cdims, &src_cd_nelmts, src_cd_values) &&
+        h5z_zfp_only_filter(dst_dcpl, rank, dst_cdims, &dst_cd_nelmts, dst_cd_values) &&
+        !memcmp(src_cdims, dst_cdims, rank * sizeof(hsize_t)) &&
+        src_cd_nelmts == dst_cd_nelmts &&
+        !memcmp(src_cd_values, dst_cd_values, src_cd_nelmts * sizeof(unsigned int)))
+    {
+        hsize_t idx[H5S_MAX_RANK], choff[H5S_MAX_RANK];
+
+        memset(idx, 0, sizeof(idx));
+        while (1)
+        {
+            hsize_t zsize;
+            uint32_t filter_mask = 0;
+
+            for (i = 0; i < rank; i++)
+                choff[i] = idx[i] * src_cdims[i];
+
+            if (0 > H5Dget_chunk_storage_size(src_id, choff, &zsize))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get chunk storage size");
+
+            /* chunks never written are left unwritten */
+            if (zsize)
+            {
+                if (!h5z_zfp_grow(&buf, &bcap, (size_t) zsize))
+                    H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+                if (0 > H5Dread_chunk(src_id, H5P_DEFAULT, choff, &filter_mask, buf))
+                    H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_READERROR, -1, "H5Dread_chunk failed");
+                if (0 > H5Dwrite_chunk(dst_id, H5P_DEFAULT, filter_mask, choff, (size_t) zsize, buf))
+                    H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_WRITEERROR, -1, "H5Dwrite_chunk failed");
+            }
+
+            for (i = rank-1; i >= 0 && ++idx[i] * src_cdims[i] >= dims[i]; i--)
+                idx[i] = 0;
+            if (i < 0) break;
+        }
+
+        retval = 1;
+        goto done;
+    }
+#endif
+
+    if (rank == 0 || dims[0] == 0)
+    {
+        size_t n = H5Tget_size(type) * (size_t) H5Sget_simple_extent_npoints(space);
+        if (!h5z_zfp_grow(&buf, &bcap, n ? n : 1))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+        if (n && (0 > H5Dread(src_id, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf) ||
+                  0 > H5Dwrite(dst_id, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf)))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_WRITEERROR, -1, "can't copy data");
+    }
+    else
+    {
+        hsize_t start[H5S_MAX_RANK], count[H5S_MAX_RANK], rows = dims[0];
+        size_t rowsize = H5Tget_size(type);
+
+        /* Slabs are whole rows of destination chunks, at least as thick
+           as source chunks, so no chunk on either side is touched more than twice */
+        if (H5D_CHUNKED == H5Pget_layout(dst_dcpl) && rank == H5Pget_chunk(dst_dcpl, rank, dst_cdims))
+        {
+            rows = dst_cdims[0];
+            if (H5D_CHUNKED == H5Pget_layout(src_dcpl) && rank == H5Pget_chunk(src_dcpl, rank, src_cdims))
+                rows *= (src_cdims[0] + dst_cdims[0] - 1) / dst_cdims[0];
+        }
+        if (rows > dims[0])
+            rows = dims[0];
+        for (i = 0; i < rank; i++)
+        {
+            start[i] = 0;
+            count[i] = dims[i];
+            if (i) rowsize *= (size_t) dims[i];
+        }
+        if (!h5z_zfp_grow(&buf, &bcap, (size_t) rows * rowsize))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+
+        for (start[0] = 0; start[0] < dims[0]; start[0] += rows)
+        {
+            count[0] = dims[0] - start[0] < rows ? dims[0] - start[0] : rows;
+            if (0 > (mspace = H5Screate_simple(rank, count, 0)) ||
+                0 > H5Sselect_hyperslab(space, H5S_SELECT_SET, start, 0, count, 0))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASPACE, H5E_CANTSELECT, -1, "can't select slab");
+            if (0 > H5Dread(src_id, type, mspace, space, H5P_DEFAULT, buf) ||
+                0 > H5Dwrite(dst_id, type, mspace, space, H5P_DEFAULT, buf))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_WRITEERROR, -1, "can't copy data");
+            H5Sclose(mspace);
+            mspace = -1;
+        }
+    }
+
+    retval = 0;
+
+done:
+    if (buf) free(buf);
+    if (dst_id >= 0) H5Dclose(dst_id);
+    if (dst_dcpl >= 0) H5Pclose(dst_dcpl);
+    if (src_dcpl >= 0) H5Pclose(src_dcpl);
+    if (mspace >= 0) H5Sclose(mspace);
+    if (type >= 0) H5Tclose(type);
+    if (space >= 0) H5Sclose(space);
+    return retval;
+}
+
+#if H5_VERSION_GE(1,10,5)
+/* The offsets, file addresses and stored sizes of the nchunks chunks of dset_id,
+   in the order HDF5 indexes them, into rows and, from the records the filter left
+   in them, their statistics when stats is nonzero. Chunks are read with H5Dread_chunk and never decompressed. */
+static int
+h5z_zfp_chunk_rows(hid_t dset_id, hid_t space, size_t cd_nelmts, unsigned int const *cd_values,
+    hsize_t nchunks, int stats, H5Z_zfp_chunk_stats_t *rows)
+{
+    static char const *_funcname_ = "h5z_zfp_chunk_rows";
+    int retval = 0;
+    size_t zcap = 0;
+    void *zbuf = 0;
+    hsize_t k;
+
+    for (k = 0; k < nchunks; k++)
+    {
+        unsigned int filter_mask = 0;
+        hsize_t zsize;
+
+        if (0 > H5Dget_chunk_info(dset_id, space, k, rows[k].offset, &filter_mask, &rows[k].addr, &zsize))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, 0, "can't get chunk info");
+        if (filter_mask & 0x1)
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "chunk not ZFP compressed");
+        rows[k].size = zsize;
+        if (!stats)
+            continue;
+        if (!h5z_zfp_grow(&zbuf, &zcap, (size_t) zsize))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, 0, "memory allocation failed");
+        if (0 > H5Dread_chunk(dset_id, H5P_DEFAULT, rows[k].offset, &filter_mask, zbuf))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_READERROR, 0, "H5Dread_chunk failed");
+        if (1 != H5Z_zfp_chunk_stats_get(cd_nelmts, cd_values, zbuf, (size_t) zsize, &rows[k]))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, 0, "dataset doesn't record ZFP chunk statistics");
+    }
+    retval = 1;
+
+done:
+    if (zbuf) free(zbuf);
+    return retval;
+}
+
+/* The default name of dset_id's chunk statistics index, to be freed */
+static char *
+h5z_zfp_index_name(hid_t dset_id)
+{
+    ssize_t len;
+    char *name;
+
+    if (0 >= (len = H5Iget_name(dset_id, 0, 0)) ||
+        0 == (name = (char *) malloc((size_t) len + sizeof("_zfp_index"))))
+        return 0;
+    if (0 >= H5Iget_name(dset_id, name, (size_t) len + 1))
+    {
+        free(name);
+        return 0;
+    }
+    return strcat(name, "_zfp_index");
+}
+
+/* Compound type of the index rows for a dataset of rank rank; the type covers
+   only the first rank entries of offset. Closes *atype, its offset array type,
+   on failure. */
+static hid_t
+h5z_zfp_index_type(int rank, hid_t *atype)
+{
+    hsize_t adim = (hsize_t) rank;
+    hid_t mtype = -1;
+
+    if (0 > (*atype = H5Tarray_create2(H5T_NATIVE_HSIZE, 1, &adim)))
+        return -1;
+    if (0 > (mtype = H5Tcreate(H5T_COMPOUND, sizeof(H5Z_zfp_chunk_stats_t))) ||
+        0 > H5Tinsert(mtype, "offset", HOFFSET(H5Z_zfp_chunk_stats_t, offset), *atype) ||
+        0 > H5Tinsert(mtype, "addr", HOFFSET(H5Z_zfp_chunk_stats_t, addr), H5T_NATIVE_HADDR) ||
+        0 > H5Tinsert(mtype, "size", HOFFSET(H5Z_zfp_chunk_stats_t, size), H5T_NATIVE_HSIZE) ||
+        0 > H5Tinsert(mtype, "min", HOFFSET(H5Z_zfp_chunk_stats_t, min), H5T_NATIVE_DOUBLE) ||
+        0 > H5Tinsert(mtype, "max", HOFFSET(H5Z_zfp_chunk_stats_t, max), H5T_NATIVE_DOUBLE) ||
+        0 > H5Tinsert(mtype, "mean", HOFFSET(H5Z_zfp_chunk_stats_t, mean), H5T_NATIVE_DOUBLE) ||
+        0 > H5Tinsert(mtype, "maxerr", HOFFSET(H5Z_zfp_chunk_stats_t, maxerr), H5T_NATIVE_DOUBLE) ||
+        0 > H5Tinsert(mtype, "flags", HOFFSET(H5Z_zfp_chunk_stats_t, flags), H5T_NATIVE_UINT))
+    {
+        if (mtype >= 0) H5Tclose(mtype);
+        H5Tclose(*atype);
+        *atype = -1;
+        return -1;
+    }
+    return mtype;
+}
+#endif
+
+/* Index the per-chunk statistics (H5Pset_zfp_chunk_stats) of a ZFP compressed
+   dataset in a companion dataset, index_name or, if 0, the dataset's own path
+   with "_zfp_index" appended, which is replaced if it exists. It is a 1D dataset
+   of compound rows, offset (the chunk's logical offset), addr and size (where it
+   is stored in the file), min, max, mean, maxerr and flags, one per chunk written in the order HDF5 indexes them. A filter can't
+   write a dataset of its own, so this is done afterwards, from the records the
+   filter left in each chunk, read with H5Dread_chunk and never decompressed.
+   Returns the number of chunks indexed or -1 on failure. */
+hssize_t H5Z_zfp_write_chunk_index(hid_t dset_id, char const *index_name)
+{
+    static char const *_funcname_ = "H5Z_zfp_write_chunk_index";
+    hssize_t retval = -1;
+    int rank;
+    unsigned int cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    size_t cd_nelmts;
+    hsize_t nchunks = 0, dims[H5S_MAX_RANK], cdims[H5S_MAX_RANK];
+    hid_t dcpl = -1, space = -1, file = -1, atype = -1, mtype = -1, ispace = -1, idset = -1;
+    H5Z_zfp_chunk_stats_t *rows = 0;
+    char *name = 0;
+
+    H5Z_zfp_init();
+
+#if !H5_VERSION_GE(1,10,5)
+    H5Z_ZFP_PUSH_AND_GOTO(H5E_FUNC, H5E_UNSUPPORTED, -1, "H5Dget_chunk_info requires HDF5 1.10.5 or newer");
+#else
+    if (0 > (dcpl = H5Dget_create_plist(dset_id)) ||
+        0 > (space = H5Dget_space(dset_id)) ||
+        0 > (rank = H5Sget_simple_extent_dims(space, dims, 0)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset info");
+
+    if (rank < 1 || !h5z_zfp_only_filter(dcpl, rank, cdims, &cd_nelmts, cd_values))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "ZFP is not the dataset's only filter");
+
+    if (0 > H5Dget_num_chunks(dset_id, space, &nchunks))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get number of chunks");
+    if (0 == (rows = (H5Z_zfp_chunk_stats_t *) calloc(nchunks ? (size_t) nchunks : 1, sizeof(*rows))))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+    if (!h5z_zfp_chunk_rows(dset_id, space, cd_nelmts, cd_values, nchunks, 1, rows))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_READERROR, -1, "can't get ZFP chunk statistics");
+
+    if (!index_name && 0 == (index_name = name = h5z_zfp_index_name(dset_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset name");
+
+    if (0 > (mtype = h5z_zfp_index_type(rank, &atype)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATATYPE, H5E_CANTCREATE, -1, "can't create index datatype");
+
+    if (0 > (file = H5Iget_file_id(dset_id)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset's file");
+    if (0 < H5Lexists(file, index_name, H5P_DEFAULT) && 0 > H5Ldelete(file, index_name, H5P_DEFAULT))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTDELETE, -1, "can't replace existing index");
+    if (0 > (ispace = H5Screate_simple(1, &nchunks, 0)) ||
+        0 > (idset = H5Dcreate(file, index_name, mtype, ispace, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTCREATE, -1, "can't create index dataset");
+    if (nchunks && 0 > H5Dwrite(idset, mtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, rows))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_WRITEERROR, -1, "can't write index dataset");
+
+    retval = (hssize_t) nchunks;
+#endif
+
+done:
+    if (idset >= 0) H5Dclose(idset);
+    if (ispace >= 0) H5Sclose(ispace);
+    if (file >= 0) H5Fclose(file);
+    if (mtype >= 0) H5Tclose(mtype);
+    if (atype >= 0) H5Tclose(atype);
+    if (space >= 0) H5Sclose(space);
+    if (dcpl >= 0) H5Pclose(dcpl);
+    if (name) free(name);
+    if (rows) free(rows);
+    return retval;
+}
+
+/* Offsets of the chunks of a ZFP compressed dataset with per-chunk statistics
+   whose values may lie in [lo, hi], so that a search for values in that range
+   can skip all other chunks. Where the max error was recorded, each chunk's range
+   is widened by it, so that no chunk whose decompressed values are in range is
+   missed. Without it, the ranges are of the values written. Statistics come from
+   the dataset's default index (H5Z_zfp_write_chunk_index) when it agrees with
+   where the chunks now in the dataset are stored and, otherwise, from the chunks themselves, which
+   are read but not decompressed. Chunks never written read as the fill value
+   and are listed, after those written, only if it is in [lo, hi] or undefined.
+   *offsets is set to an array, to be freed with free(), of the rank offsets of
+   each matching chunk, those written in the order HDF5 indexes them and then
+   those not in row-major order. Returns the number of matching chunks or -1 on
+   failure. */
+hssize_t H5Z_zfp_query_chunks(hid_t dset_id, double lo, double hi, hsize_t **offsets)
+{
+    static char const *_funcname_ = "H5Z_zfp_query_chunks";
+    hssize_t retval = -1;
+    int i, rank, indexed = 0;
+    unsigned int cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    size_t cd_nelmts, nmatch = 0;
+    hsize_t k, nchunks = 0, total = 1, dims[H5S_MAX_RANK], cdims[H5S_MAX_RANK];
+    hsize_t gdims[H5S_MAX_RANK], gstride[H5S_MAX_RANK];
+    hid_t dcpl = -1, space = -1, file = -1, atype = -1, mtype = -1, ispace = -1, idset = -1;
+    H5Z_zfp_chunk_stats_t *rows = 0, *irows = 0;
+    hsize_t *out = 0;
+    unsigned char *written = 0;
+    char *name = 0;
+
+    H5Z_zfp_init();
+
+#if !H5_VERSION_GE(1,10,5)
+    H5Z_ZFP_PUSH_AND_GOTO(H5E_FUNC, H5E_UNSUPPORTED, -1, "H5Dget_chunk_info requires HDF5 1.10.5 or newer");
+#else
+    if (!offsets)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "invalid arguments");
+    *offsets = 0;
+
+    if (0 > (dcpl = H5Dget_create_plist(dset_id)) ||
+        0 > (space = H5Dget_space(dset_id)) ||
+        0 > (rank = H5Sget_simple_extent_dims(space, dims, 0)))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get dataset info");
+
+    if (rank < 1 || !h5z_zfp_only_filter(dcpl, rank, cdims, &cd_nelmts, cd_values))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_PLINE, H5E_BADVALUE, -1, "ZFP is not the dataset's only filter");
+
+    if (0 > H5Dget_num_chunks(dset_id, space, &nchunks))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't get number of chunks");
+    if (0 == (rows = (H5Z_zfp_chunk_stats_t *) calloc(nchunks ? (size_t) nchunks : 1, sizeof(*rows))) ||
+        0 == (out = (hsize_t *) malloc((nchunks ? (size_t) nchunks : 1) * rank * sizeof(hsize_t))))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+
+    /* The chunk offsets, addresses and sizes are metadata and cheap to list. Use
+       the index only if it has a row for each chunk, stored where it is now, so one
+       made before the dataset was extended or written to more isn't. That catches
+       a chunk re-written to another size but not one HDF5 re-wrote in place. */
+    if (!h5z_zfp_chunk_rows(dset_id, space, cd_nelmts, cd_values, nchunks, 0, rows))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_CANTGET, -1, "can't list chunks");
+    if (nchunks &&
+        0 != (name = h5z_zfp_index_name(dset_id)) &&
+        0 <= (file = H5Iget_file_id(dset_id)) &&
+        0 < H5Lexists(file, name, H5P_DEFAULT) &&
+        0 <= (mtype = h5z_zfp_index_type(rank, &atype)) &&
+        0 != (irows = (H5Z_zfp_chunk_stats_t *) calloc((size_t) nchunks, sizeof(*irows))))
+    {
+        H5E_BEGIN_TRY
+        {
+            idset = H5Dopen(file, name, H5P_DEFAULT);
+            if (idset >= 0 &&
+                0 <= (ispace = H5Dget_space(idset)) &&
+                1 == H5Sget_simple_extent_ndims(ispace) &&
+                nchunks == (hsize_t) H5Sget_simple_extent_npoints(ispace) &&
+                0 <= H5Dread(idset, mtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, irows))
+                indexed = 1;
+        }
+        H5E_END_TRY;
+        for (k = 0; indexed && k < nchunks; k++)
+        {
+            if (irows[k].addr != rows[k].addr || irows[k].size != rows[k].size)
+                indexed = 0;
+            for (i = 0; i < rank; i++)
+                if (irows[k].offset[i] != rows[k].offset[i])
+                    indexed = 0;
+        }
+    }
+    if (indexed)
+        memcpy(rows, irows, (size_t) nchunks * sizeof(*rows));
+    else if (!h5z_zfp_chunk_rows(dset_id, space, cd_nelmts, cd_values, nchunks, 1, rows))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_DATASET, H5E_READERROR, -1, "can't get ZFP chunk statistics");
+
+    for (k = 0; k < nchunks; k++)
+    {
+        double err = (rows[k].flags & H5Z_ZFP_CSTATS_ERROR) ? rows[k].maxerr : 0;
+        if (rows[k].max + err < lo || rows[k].min - err > hi)
+            continue;
+        memcpy(&out[nmatch * rank], rows[k].offset, rank * sizeof(hsize_t));
+        nmatch++;
+    }
+
+    /* chunks never written read as the fill value or, with none defined, anything */
+    for (i = rank-1; i >= 0; i--)
+    {
+        gdims[i] = (dims[i] + cdims[i] - 1) / cdims[i];
+        gstride[i] = i == rank-1 ? 1 : gstride[i+1] * gdims[i+1];
+        total *= gdims[i];
+    }
+    if (nchunks < total)
+    {
+        H5D_fill_value_t fstatus;
+        double fill = 0;
+        hsize_t j, *p;
+
+        if (0 > H5Pfill_value_defined(dcpl, &fstatus) ||
+            (fstatus != H5D_FILL_VALUE_UNDEFINED && 0 > H5Pget_fill_value(dcpl, H5T_NATIVE_DOUBLE, &fill)))
+            H5Z_ZFP_PUSH_AND_GOTO(H5E_PLIST, H5E_CANTGET, -1, "can't get fill value");
+        if (fstatus == H5D_FILL_VALUE_UNDEFINED || (lo <= fill && fill <= hi))
+        {
+            if (0 == (written = (unsigned char *) calloc((size_t) total, 1)) ||
+                0 == (p = (hsize_t *) realloc(out, (nmatch + (size_t) (total - nchunks)) * rank * sizeof(hsize_t))))
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_RESOURCE, H5E_NOSPACE, -1, "memory allocation failed");
+            out = p;
+            for (k = 0; k < nchunks; k++)
+            {
+                for (j = 0, i = 0; i < rank; i++)
+                    j += rows[k].offset[i] / cdims[i] * gstride[i];
+                written[j] = 1;
+            }
+            for (j = 0; j < total; j++)
+            {
+                if (written[j]) continue;
+                for (i = 0; i < rank; i++)
+                    out[nmatch * rank + i] = j / gstride[i] % gdims[i] * cdims[i];
+                nmatch++;
+            }
+        }
+    }
+
+    *offsets = out;
+    out = 0;
+    retval = (hssize_t) nmatch;
+#endif
+
+done:
+    if (idset >= 0) H5Dclose(idset);
+    if (ispace >= 0) H5Sclose(ispace);
+    if (file >= 0) H5Fclose(file);
+    if (mtype >= 0) H5Tclose(mtype);
+    if (atype >= 0) H5Tclose(atype);
+    if (space >= 0) H5Sclose(space);
+    if (dcpl >= 0) H5Pclose(dcpl);
+    if (name) free(name);
+    if (irows) free(irows);
+    if (rows) free(rows);
+    if (out) free(out);
+    if (written) free(written);
+    return retval;
+}
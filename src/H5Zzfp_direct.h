@@ -0,0 +1,51 @@
+#ifndef H5Z_ZFP_DIRECT_H
+#define H5Z_ZFP_DIRECT_H
+
+#include "hdf5.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int H5Z_zfp_decode_region(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *zbuf, size_t zsize, int ndims, hsize_t const *chunk_dims,
+    hsize_t const *offset, hsize_t const *count, void *out);
+extern int H5Z_zfp_read_region(hid_t dset_id, hsize_t const *offset,
+    hsize_t const *count, void *buf);
+extern int H5Z_zfp_read_parallel(hid_t dset_id, hid_t memspace, void *buf, int nthreads);
+extern int H5Z_zfp_copy(hid_t src_id, hid_t dst_loc, char const *dst_name, hid_t dcpl_id);
+extern size_t H5Z_zfp_encode_chunk(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *in, size_t nbytes, void **out, size_t *outsize);
+
+/* Receives compressed bytes in order; returns non-zero on success */
+typedef int (*H5Z_zfp_sink_t)(void *ctx, void const *bytes, size_t n);
+
+extern size_t H5Z_zfp_encode_chunk_sink(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *in, size_t nbytes, H5Z_zfp_sink_t sink, void *sink_ctx, size_t slab_bytes);
+
+/* Per-chunk statistics (see H5Pset_zfp_chunk_stats) */
+typedef struct _H5Z_zfp_chunk_stats_t {
+    hsize_t offset[H5S_MAX_RANK]; /* logical offset of the chunk, set by H5Z_zfp_write_chunk_index */
+    haddr_t addr;                 /* file address of the chunk, likewise */
+    hsize_t size;                 /* stored size of the chunk, likewise */
+    double min, max, mean;        /* of the chunk's values, including any fill in edge chunks */
+    double maxerr;                /* max absolute error, if flags has H5Z_ZFP_CSTATS_ERROR */
+    unsigned int flags;           /* H5Z_ZFP_CSTATS_* actually recorded */
+} H5Z_zfp_chunk_stats_t;
+
+extern int H5Z_zfp_chunk_stats_get(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *zbuf, size_t zsize, H5Z_zfp_chunk_stats_t *stats);
+extern hssize_t H5Z_zfp_write_chunk_index(hid_t dset_id, char const *index_name);
+extern hssize_t H5Z_zfp_query_chunks(hid_t dset_id, double lo, double hi, hsize_t **offsets);
+
+typedef struct _H5Z_zfp_writer_t H5Z_zfp_writer_t;
+
+extern H5Z_zfp_writer_t *H5Z_zfp_writer_open(hid_t dset_id, int nthreads);
+extern int H5Z_zfp_writer_put(H5Z_zfp_writer_t *w, hsize_t const *offset, void const *chunk);
+extern int H5Z_zfp_writer_close(H5Z_zfp_writer_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef H5Z_ZFP_DIRECT_PRIVATE_H
+#define H5Z_ZFP_DIRECT_PRIVATE_H
+
+#include "hdf5.h"
+
+/* Registers the filter's error class and reads the environment. Every entry
+   point calls this first and, in particular, before starting any threads. */
+extern void H5Z_zfp_init(void);
+
+/* The error class the filter pushes errors under, valid once H5Z_zfp_init has
+   been called. The direct interface pushes its errors under it too. */
+extern hid_t h5z_zfp_errclass(void);
+
+/* H5Z_zfp_decode_region and H5Z_zfp_encode_chunk, pushing errors only if push.
+   The direct interface's worker threads pass 0 so they never call HDF5, and
+   the calling thread reports their failure. */
+extern int h5z_zfp_decode_region(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *zbuf, size_t zsize, int ndims, hsize_t const *chunk_dims,
+    hsize_t const *offset, hsize_t const *count, void *out, int push);
+extern size_t h5z_zfp_encode_chunk(size_t cd_nelmts, unsigned int const cd_values[],
+    void const *in, size_t nbytes, void **out, size_t *outsize, int push);
+
+#endif
@@ -3,12 +3,31 @@
 
 #include "H5Zzfp_plugin.h"
 
+#include "hdf5.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* The filter's class, as H5Z_zfp_initialize registers it */
+extern const H5Z_class2_t H5Z_ZFP[1];
+
 extern int H5Z_zfp_initialize(void);
 extern int H5Z_zfp_finalize(void);
+extern int H5Z_zfp_cache_stats(unsigned long long *hits, unsigned long long *misses);
+extern int H5Z_zfp_memo_stats(unsigned long long *hits, unsigned long long *misses);
+extern int H5Z_zfp_set_buffer_pool(int enable);
+extern int H5Z_zfp_pool_stats(unsigned long long *resident, unsigned long long *peak);
+extern size_t H5Z_zfp_set_memory_limit(size_t nbytes);
+extern int H5Z_zfp_set_stats(int enable);
+extern int H5Z_zfp_get_stats(H5Z_zfp_stats_t *stats);
+extern int H5Z_zfp_reset_stats(void);
+extern int H5Z_zfp_set_read_precision(unsigned int bits);
+extern int H5Z_zfp_set_access(hid_t dapl_id);
+extern int H5Z_zfp_predict_chunk_bytes(hid_t dcpl_id, hid_t type_id, hid_t chunk_space_id,
+    size_t *nbytes);
+extern int H5Z_zfp_suggest_chunk(int ndims, hsize_t const *dims, hid_t type_id,
+    size_t target_bytes, hsize_t *chunk);
 
 #ifdef __cplusplus
 }
@@ -12,9 +12,41 @@
 #define H5Z_ZFP_MODE_PRECISION 2
 #define H5Z_ZFP_MODE_ACCURACY  3
 #define H5Z_ZFP_MODE_EXPERT    4
+#define H5Z_ZFP_MODE_REVERSIBLE 5 /* lossless; requires ZFP 0.5.4 or newer */
+#define H5Z_ZFP_MODE_TARGET     6 /* target ratio and/or error, resolved at dataset creation */
+
+#define H5Z_ZFP_EXEC_SERIAL    0 /* single-threaded (default) */
+#define H5Z_ZFP_EXEC_OMP       1 /* zfp OpenMP compression, threaded decompression */
+#define H5Z_ZFP_EXEC_CUDA      2 /* zfp CUDA, fixed-rate only; others as serial */
+
+/* Integer pre-conditioning (see H5Pset_zfp_int_precondition), applied per chunk */
+#define H5Z_ZFP_PRECOND_OFFSET 0x1 /* subtract the chunk's mid-range value */
+#define H5Z_ZFP_PRECOND_NARROW 0x2 /* compress int64 chunks whose range fits as int32; implies OFFSET */
+#define H5Z_ZFP_PRECOND_DELTA  0x4 /* difference consecutive values first; reversible mode only */
+
+/* Per-chunk statistics (see H5Pset_zfp_chunk_stats), computed as each chunk is compressed */
+#define H5Z_ZFP_CSTATS_RANGE 0x1 /* min, max and mean of the chunk's values */
+#define H5Z_ZFP_CSTATS_ERROR 0x2 /* max absolute error of the compressed chunk; implies RANGE */
+
+/* Filter instrumentation (see H5Z_zfp_get_stats). Index 0 of each pair is compression, 1 is decompression. */
+#define H5Z_ZFP_STATS_BINS 40 /* bin i counts calls taking [2^i,2^(i+1)) ns, last bin the rest */
+
+typedef struct _H5Z_zfp_stats_t {
+    unsigned long long calls[2];
+    unsigned long long errors[2];
+    unsigned long long raw_bytes[2];   /* uncompressed bytes */
+    unsigned long long zfp_bytes[2];   /* compressed bytes */
+    unsigned long long total_ns[2];    /* overall time in the filter */
+    unsigned long long setup_ns[2];    /* decoding header from cd_values, setting up ZFP objects */
+    unsigned long long alloc_ns[2];    /* allocating and copying buffers */
+    unsigned long long zfp_ns[2];      /* ZFP (de)compression, including any fused endian un-swap */
+    unsigned long long swap_ns[2];     /* separate endian un-swap after decompression */
+    unsigned long long threaded[2];    /* calls that (de)compressed with more than one thread */
+    unsigned long long latency[2][H5Z_ZFP_STATS_BINS];
+} H5Z_zfp_stats_t;
 
 #define H5Z_ZFP_CD_NELMTS_MEM ((size_t) 6) /* used in public API to filter */
-#define H5Z_ZFP_CD_NELMTS_MAX ((size_t) 6) /* max, over all versions, used in dataset header */
+#define H5Z_ZFP_CD_NELMTS_MAX ((size_t) 8) /* max, over all versions, used in dataset header */
 
 /* HDF5 filter cd_vals[] layout (6 unsigned ints)
 cd_vals    0       1        2         3         4         5    
@@ -23,12 +55,15 @@ rate:      1    unused    rateA     rateB     unused    unused
 precision: 2    unused    prec      unused    unused    unused
 accuracy:  3    unused    accA      accB      unused    unused
 expert:    4    unused    minbits   maxbits   maxprec   minexp
+reversible:5    unused    unused    unused    unused    unused
+target:    6    unused    ratioA    ratioB    errA      errB
 
 A/B are high/low words of a double.
 
 Note: This is *NOT* the same layout that is ultimately stored
 to the file. A wholly different, cd_vals is stored in the file
-using zfp_write_header.
+using zfp_write_header or, with H5Pset_zfp_compact_header, as
+ZFP mode and meta words.
 */
 
 #define H5Pset_zfp_rate_cdata(R, N, CD)          \
@@ -73,4 +108,27 @@ do {                                                    \
     }                                                   \
 } while(0)
 
+#define H5Pset_zfp_reversible_cdata(N, CD)    \
+do { if (N>=1) {                               \
+CD[0]=H5Z_ZFP_MODE_REVERSIBLE; N=1;}} while(0)
+
+#define H5Pget_zfp_reversible_cdata(N, CD) \
+((int)((N>=1)&&(CD[0]==H5Z_ZFP_MODE_REVERSIBLE)))
+
+#define H5Pset_zfp_target_cdata(R, E, N, CD)                  \
+do { if (N>=6) {double *p = (double *) &CD[2];                \
+double *q = (double *) &CD[4];                                \
+CD[0]=CD[1]=CD[2]=CD[3]=CD[4]=CD[5]=0;                        \
+CD[0]=H5Z_ZFP_MODE_TARGET; *p=R; *q=E; N=6;}} while(0)
+
+#define H5Pget_zfp_target_cdata(N, CD, R, E)                  \
+do {                                                          \
+    if ((N>=6)&&(CD[0] == H5Z_ZFP_MODE_TARGET))               \
+    {                                                         \
+        double *p = R, *q = E;                                \
+        *p = *((double *) &CD[2]);                            \
+        *q = *((double *) &CD[4]);                            \
+    }                                                         \
+} while(0)
+
 #endif
@@ -65,6 +65,22 @@ static herr_t H5Pset_zfp(hid_t plist, int mode, ...)
             ctrls_p->details.expert.minexp  = va_arg(ap, int);
             break;
         }
+        case H5Z_ZFP_MODE_REVERSIBLE:
+        {
+            break;
+        }
+        case H5Z_ZFP_MODE_TARGET:
+        {
+            ctrls_p->details.target.ratio = va_arg(ap, double);
+            ctrls_p->details.target.err = va_arg(ap, double);
+            if (0 > ctrls_p->details.target.err)
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "target error out of range.");
+            if (0 != ctrls_p->details.target.ratio && 1 > ctrls_p->details.target.ratio)
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "target ratio out of range.");
+            if (0 == ctrls_p->details.target.ratio && 0 == ctrls_p->details.target.err)
+                H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "no target ratio or error.");
+            break;
+        }
         default:
         {
             H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "bad ZFP mode.");
@@ -127,3 +143,213 @@ herr_t H5Pset_zfp_expert(hid_t plist, unsigned int minbits, unsigned int maxbits
 {
     return H5Pset_zfp(plist, H5Z_ZFP_MODE_EXPERT, minbits, maxbits, maxprec, minexp);
 }
+
+herr_t H5Pset_zfp_reversible(hid_t plist)
+{
+    return H5Pset_zfp(plist, H5Z_ZFP_MODE_REVERSIBLE);
+}
+
+/* Target ratio and error may be combined. So, each keeps the other's setting
+   from a preceding call. */
+static void H5Pget_zfp_target(hid_t plist, double *ratio, double *err)
+{
+    h5z_zfp_controls_t ctrls;
+
+    *ratio = *err = 0;
+    if (0 < H5Pexist(plist, "zfp_controls") && 0 <= H5Pget(plist, "zfp_controls", &ctrls) &&
+        ctrls.mode == H5Z_ZFP_MODE_TARGET)
+    {
+        *ratio = ctrls.details.target.ratio;
+        *err = ctrls.details.target.err;
+    }
+}
+
+herr_t H5Pset_zfp_target_ratio(hid_t plist, double ratio)
+{
+    double old_ratio, err;
+    H5Pget_zfp_target(plist, &old_ratio, &err);
+    return H5Pset_zfp(plist, H5Z_ZFP_MODE_TARGET, ratio, err);
+}
+
+herr_t H5Pset_zfp_target_error(hid_t plist, double err)
+{
+    double ratio, old_err;
+    H5Pget_zfp_target(plist, &ratio, &old_err);
+    return H5Pset_zfp(plist, H5Z_ZFP_MODE_TARGET, ratio, err);
+}
+
+herr_t H5Pset_zfp_execution(hid_t plist, int policy, unsigned int nthreads,
+    unsigned int chunk_blocks)
+{
+    static char const *_funcname_ = "H5Pset_zfp_execution";
+    static size_t exec_sz = sizeof(h5z_zfp_execution_t);
+    h5z_zfp_execution_t exec;
+    herr_t retval;
+
+    if (0 >= H5Pisa_class(plist, H5P_DATASET_CREATE))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a dataset creation property list class");
+
+    if (policy != H5Z_ZFP_EXEC_SERIAL && policy != H5Z_ZFP_EXEC_OMP &&
+        policy != H5Z_ZFP_EXEC_CUDA)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "bad ZFP execution policy.");
+
+    if (nthreads > H5Z_ZFP_EXEC_NTHREADS_MAX || chunk_blocks > H5Z_ZFP_EXEC_BLOCKS_MAX)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "ZFP nthreads or chunk_blocks too large.");
+
+    exec.policy = policy;
+    exec.nthreads = nthreads;
+    exec.chunk_blocks = chunk_blocks;
+
+    /* Unlike H5Pset_zfp, this does not touch the filter pipeline. It is used in
+       conjunction with one of the mode setting functions above. Unless serial,
+       the setting is recorded in the dataset's cd_values. */
+    if (0 == H5Pexist(plist, "zfp_execution"))
+        retval = H5Pinsert2(plist, "zfp_execution", exec_sz, &exec, 0, 0, 0, 0, 0, 0);
+    else
+        retval = H5Pset(plist, "zfp_execution", &exec);
+
+done:
+
+    return retval;
+}
+
+herr_t H5Pset_zfp_int_precondition(hid_t plist, unsigned int flags)
+{
+    static char const *_funcname_ = "H5Pset_zfp_int_precondition";
+    static size_t flags_sz = sizeof(unsigned int);
+    herr_t retval;
+
+    if (0 >= H5Pisa_class(plist, H5P_DATASET_CREATE))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a dataset creation property list class");
+
+    if (flags & ~(H5Z_ZFP_PRECOND_OFFSET | H5Z_ZFP_PRECOND_NARROW | H5Z_ZFP_PRECOND_DELTA))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "bad ZFP pre-conditioning flags.");
+
+    /* Like H5Pset_zfp_execution, this does not touch the filter pipeline and
+       the setting is recorded in the dataset's cd_values. */
+    if (0 == H5Pexist(plist, "zfp_precond"))
+        retval = H5Pinsert2(plist, "zfp_precond", flags_sz, &flags, 0, 0, 0, 0, 0, 0);
+    else
+        retval = H5Pset(plist, "zfp_precond", &flags);
+
+done:
+
+    return retval;
+}
+
+herr_t H5Pset_zfp_chunk_stats(hid_t plist, unsigned int flags)
+{
+    static char const *_funcname_ = "H5Pset_zfp_chunk_stats";
+    static size_t flags_sz = sizeof(unsigned int);
+    herr_t retval;
+
+    if (0 >= H5Pisa_class(plist, H5P_DATASET_CREATE))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a dataset creation property list class");
+
+    if (flags & ~(H5Z_ZFP_CSTATS_RANGE | H5Z_ZFP_CSTATS_ERROR))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "bad ZFP chunk statistics flags.");
+
+    /* Like pre-conditioning, recorded in the dataset's cd_values */
+    if (flags & H5Z_ZFP_CSTATS_ERROR)
+        flags |= H5Z_ZFP_CSTATS_RANGE;
+    if (0 == H5Pexist(plist, "zfp_cstats"))
+        retval = H5Pinsert2(plist, "zfp_cstats", flags_sz, &flags, 0, 0, 0, 0, 0, 0);
+    else
+        retval = H5Pset(plist, "zfp_cstats", &flags);
+
+done:
+
+    return retval;
+}
+
+herr_t H5Pset_zfp_compact_header(hid_t plist, int enable)
+{
+    static char const *_funcname_ = "H5Pset_zfp_compact_header";
+    static size_t enable_sz = sizeof(int);
+    herr_t retval;
+
+    if (0 >= H5Pisa_class(plist, H5P_DATASET_CREATE))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a dataset creation property list class");
+
+    /* Chooses the cd_values layout set_local stores; 0 is ZFP's own header */
+    enable = enable ? 1 : 0;
+    if (0 == H5Pexist(plist, "zfp_compact_header"))
+        retval = H5Pinsert2(plist, "zfp_compact_header", enable_sz, &enable, 0, 0, 0, 0, 0, 0);
+    else
+        retval = H5Pset(plist, "zfp_compact_header", &enable);
+
+done:
+
+    return retval;
+}
+
+/* Dataset access properties. None touch the filter pipeline or the file. The
+   filter sees them only once H5Z_zfp_set_access binds the list to a thread.
+   The execution policy then governs only that thread's reads. */
+herr_t H5Pset_zfp_access(hid_t plist, int policy, unsigned int nthreads,
+    unsigned int chunk_blocks)
+{
+    static char const *_funcname_ = "H5Pset_zfp_access";
+    static size_t exec_sz = sizeof(h5z_zfp_execution_t);
+    h5z_zfp_execution_t exec;
+    herr_t retval;
+
+    if (0 >= H5Pisa_class(plist, H5P_DATASET_ACCESS))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a dataset access property list class");
+
+    if (policy != H5Z_ZFP_EXEC_SERIAL && policy != H5Z_ZFP_EXEC_OMP &&
+        policy != H5Z_ZFP_EXEC_CUDA)
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADVALUE, -1, "bad ZFP execution policy.");
+
+    exec.policy = policy;
+    exec.nthreads = nthreads;
+    exec.chunk_blocks = chunk_blocks;
+
+    if (0 == H5Pexist(plist, "zfp_access_exec"))
+        retval = H5Pinsert2(plist, "zfp_access_exec", exec_sz, &exec, 0, 0, 0, 0, 0, 0);
+    else
+        retval = H5Pset(plist, "zfp_access_exec", &exec);
+
+done:
+
+    return retval;
+}
+
+herr_t H5Pset_zfp_access_read_precision(hid_t plist, unsigned int bits)
+{
+    static char const *_funcname_ = "H5Pset_zfp_access_read_precision";
+    static size_t bits_sz = sizeof(unsigned int);
+    herr_t retval;
+
+    if (0 >= H5Pisa_class(plist, H5P_DATASET_ACCESS))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a dataset access property list class");
+
+    if (0 == H5Pexist(plist, "zfp_access_prec"))
+        retval = H5Pinsert2(plist, "zfp_access_prec", bits_sz, &bits, 0, 0, 0, 0, 0, 0);
+    else
+        retval = H5Pset(plist, "zfp_access_prec", &bits);
+
+done:
+
+    return retval;
+}
+
+herr_t H5Pset_zfp_access_buffer_pool(hid_t plist, int enable)
+{
+    static char const *_funcname_ = "H5Pset_zfp_access_buffer_pool";
+    static size_t pool_sz = sizeof(int);
+    herr_t retval;
+
+    if (0 >= H5Pisa_class(plist, H5P_DATASET_ACCESS))
+        H5Z_ZFP_PUSH_AND_GOTO(H5E_ARGS, H5E_BADTYPE, -1, "not a dataset access property list class");
+
+    enable = enable ? 1 : 0;
+    if (0 == H5Pexist(plist, "zfp_access_pool"))
+        retval = H5Pinsert2(plist, "zfp_access_pool", pool_sz, &enable, 0, 0, 0, 0, 0, 0);
+    else
+        retval = H5Pset(plist, "zfp_access_pool", &enable);
+
+done:
+
+    return retval;
+}
@@ -12,6 +12,18 @@ extern herr_t H5Pset_zfp_precision(hid_t plist, unsigned int prec);
 extern herr_t H5Pset_zfp_accuracy(hid_t plist, double acc); 
 extern herr_t H5Pset_zfp_expert(hid_t plist, unsigned int minbits, unsigned int maxbits,
     unsigned int maxprec, int minexp); 
+extern herr_t H5Pset_zfp_reversible(hid_t plist); 
+extern herr_t H5Pset_zfp_target_ratio(hid_t plist, double ratio);
+extern herr_t H5Pset_zfp_target_error(hid_t plist, double err);
+extern herr_t H5Pset_zfp_execution(hid_t plist, int policy, unsigned int nthreads,
+    unsigned int chunk_blocks);
+extern herr_t H5Pset_zfp_int_precondition(hid_t plist, unsigned int flags);
+extern herr_t H5Pset_zfp_chunk_stats(hid_t plist, unsigned int flags);
+extern herr_t H5Pset_zfp_compact_header(hid_t plist, int enable);
+extern herr_t H5Pset_zfp_access(hid_t plist, int policy, unsigned int nthreads,
+    unsigned int chunk_blocks);
+extern herr_t H5Pset_zfp_access_read_precision(hid_t plist, unsigned int bits);
+extern herr_t H5Pset_zfp_access_buffer_pool(hid_t plist, int enable);
 
 #ifdef __cplusplus
 }
@@ -13,7 +13,21 @@ typedef struct _h5z_zfp_controls_t {
             unsigned int maxprec;
             int minexp;
         } expert;
+        struct target_ {
+            double ratio; /* 0 if not set */
+            double err;   /* 0 if not set */
+        } target;
     } details;
 } h5z_zfp_controls_t;
 
+typedef struct _h5z_zfp_execution_t {
+    int policy;
+    unsigned int nthreads;     /* 0 means let zfp/the system decide */
+    unsigned int chunk_blocks; /* blocks per unit of work; 0 means default */
+} h5z_zfp_execution_t;
+
+/* largest nthreads and chunk_blocks that fit where cd_values record them */
+#define H5Z_ZFP_EXEC_NTHREADS_MAX 0x0FFF
+#define H5Z_ZFP_EXEC_BLOCKS_MAX   0xFFFF
+
 #endif
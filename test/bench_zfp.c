@@ -0,0 +1,512 @@
+/*
+Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+Produced at the Lawrence Livermore National Laboratory
+Written by Mark C. Miller, miller86@llnl.gov
+LLNL-CODE-707197. All rights reserved.
+
+This file is part of H5Z-ZFP. Please also read the BSD license
+https://raw.githubusercontent.com/LLNL/H5Z-ZFP/master/LICENSE
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hdf5.h"
+
+#include "H5Zzfp_lib.h"
+#include "H5Zzfp_props.h"
+
+#define NAME_LEN 256
+#define MAX_LIST 32
+#define MAX_RANK 8
+
+/* convenience macro to handle command-line args and help */
+#define HANDLE_ARG(A,PARSEA,PRINTA,HELPSTR)                     \
+{                                                               \
+    int i;                                                      \
+    char tmpstr[64];                                            \
+    int len;                                                    \
+    int len2 = strlen(#A)+1;                                    \
+    for (i = 0; i < argc; i++)                                  \
+    {                                                           \
+        if (!strncmp(argv[i], #A"=", len2))                     \
+        {                                                       \
+            A = PARSEA;                                         \
+            break;                                              \
+        }                                                       \
+        else if (!strncasecmp(argv[i], "help", 4))              \
+        {                                                       \
+            return 0;                                           \
+        }                                                       \
+    }                                                           \
+    len = snprintf(tmpstr, sizeof(tmpstr), "%s=" PRINTA, #A, A);\
+    printf("    %s%*s\n",tmpstr,60-len,#HELPSTR);               \
+}
+
+/* convenience macro to handle errors */
+#define ERROR(FNAME)                                              \
+do {                                                              \
+    int _errno = errno;                                           \
+    fprintf(stderr, #FNAME " failed at line %d, errno=%d (%s)\n", \
+        __LINE__, _errno, _errno?strerror(_errno):"ok");          \
+    return 1;                                                     \
+} while(0)
+
+typedef struct _bench_result_t {
+    char key[NAME_LEN];   /* mode,param,type,chunk,threads */
+    double raw_bytes;
+    double stored_bytes;
+    double write_mbs;
+    double read_mbs;
+    double write_us[3];   /* per-chunk latency percentiles 50, 90, 99 */
+    double read_us[3];
+} bench_result_t;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+/* Split a comma separated list into at most MAX_LIST items */
+static int split_list(char const *s, char items[MAX_LIST][64])
+{
+    int n = 0;
+    while (s && *s && n < MAX_LIST)
+    {
+        size_t len = strcspn(s, ",");
+        if (len > 63) len = 63;
+        strncpy(items[n], s, len);
+        items[n++][len] = '\0';
+        s += len;
+        if (*s == ',') s++;
+    }
+    return n;
+}
+
+/* Parse a shape of the form 64x64x32 (slowest varying first) */
+static int parse_shape(char const *s, hsize_t *shape)
+{
+    int n = 0;
+    while (s && *s && n < MAX_RANK)
+    {
+        char *end;
+        shape[n++] = (hsize_t) strtoull(s, &end, 10);
+        if (end == s) return 0;
+        s = *end == 'x' ? end + 1 : end;
+    }
+    return n;
+}
+
+/* Resolve a chunk list entry to a shape. Besides an explicit shape, "auto"
+   asks H5Z_zfp_suggest_chunk for one sized to the L2 cache and "auto:BYTES"
+   for one of at most BYTES. The resolved shape is written back to str. */
+static int chunk_shape(char *str, size_t len, int rank, hsize_t const *dims,
+    hid_t type, hsize_t *chunk)
+{
+    int n, k;
+
+    if (strncmp(str, "auto", 4))
+        return parse_shape(str, chunk);
+
+    if (0 > H5Z_zfp_suggest_chunk(rank, dims, type,
+            (size_t) (str[4] == ':' ? strtoull(str+5, 0, 10) : 0), chunk))
+        return 0;
+    for (n = 0, k = 0; n < rank; n++)
+        k += snprintf(str + k, len - k, "%s%llu", n ? "x" : "", (unsigned long long) chunk[n]);
+    return rank;
+}
+
+static int cmp_dbl(void const *a, void const *b)
+{
+    double x = *((double const *) a), y = *((double const *) b);
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Fill pct[] with 50th, 90th and 99th percentiles (in microseconds) of t[] */
+static void percentiles(double *t, size_t n, double pct[3])
+{
+    double const p[3] = {0.50, 0.90, 0.99};
+    int i;
+    qsort(t, n, sizeof(double), cmp_dbl);
+    for (i = 0; i < 3; i++)
+        pct[i] = 1e6 * t[(size_t) (p[i] * (double) (n - 1) + 0.5)];
+}
+
+/* Like test_write's gen_data but a separable sinusoid in each of the dimensions */
+static double *gen_data(int rank, hsize_t const *dims, double noise, double amp)
+{
+    size_t i, npoints = 1;
+    double *buf;
+    int d;
+
+    for (d = 0; d < rank; d++)
+        npoints *= dims[d];
+
+    if (0 == (buf = (double *) malloc(npoints * sizeof(double))))
+        return 0;
+
+    srandom(0xDeadBeef);
+    for (i = 0; i < npoints; i++)
+    {
+        size_t j = i;
+        double v = 1;
+        double n = noise * ((double) random() / ((double)(1<<31)-1) - 0.5);
+        for (d = rank-1; d >= 0; d--)
+        {
+            double x = 2 * M_PI * (double) (j % dims[d]) / (double) dims[d];
+            v *= 1 + 0.5 * sin(x + d);
+            j /= dims[d];
+        }
+        buf[i] = amp * v + n;
+    }
+
+    return buf;
+}
+
+/* Convert generated data to the given type in a new buffer */
+static void *convert_data(double const *dbuf, size_t npoints, hid_t type)
+{
+    size_t i, dsize = H5Tget_size(type);
+    void *buf = malloc(npoints * dsize);
+
+    if (!buf) return 0;
+    for (i = 0; i < npoints; i++)
+    {
+        if (H5Tequal(type, H5T_NATIVE_FLOAT) > 0) ((float *) buf)[i] = (float) dbuf[i];
+        else if (H5Tequal(type, H5T_NATIVE_DOUBLE) > 0) ((double *) buf)[i] = dbuf[i];
+        else if (H5Tequal(type, H5T_NATIVE_INT32) > 0) ((int *) buf)[i] = (int) dbuf[i];
+        else ((long long *) buf)[i] = (long long) dbuf[i];
+    }
+    return buf;
+}
+
+/* Write then read one dataset a chunk at a time, timing each chunk. The chunk
+   cache is disabled so that every call passes through the filter. */
+static int bench_one(char const *fname, int rank, hsize_t const *dims, hsize_t const *chunk,
+    hid_t type, void *buf, int zfpmode, double param, int threads, bench_result_t *res)
+{
+    hid_t fid, sid, cpid, apid, dsid;
+    hsize_t nchunks = 1, c, start[MAX_RANK], count[MAX_RANK];
+    size_t npoints = 1, dsize = H5Tget_size(type);
+    double *wt, *rt, t0, twrite = 0, tread = 0;
+    void *rbuf;
+    int d;
+
+    for (d = 0; d < rank; d++)
+    {
+        nchunks *= (dims[d] + chunk[d] - 1) / chunk[d];
+        npoints *= dims[d];
+    }
+    wt = (double *) malloc(nchunks * sizeof(double));
+    rt = (double *) malloc(nchunks * sizeof(double));
+    rbuf = malloc(npoints * dsize);
+    if (!wt || !rt || !rbuf) ERROR(malloc);
+
+    if (0 > (cpid = H5Pcreate(H5P_DATASET_CREATE))) ERROR(H5Pcreate);
+    if (0 > H5Pset_chunk(cpid, rank, chunk)) ERROR(H5Pset_chunk);
+    if (zfpmode == H5Z_ZFP_MODE_RATE) H5Pset_zfp_rate(cpid, param);
+    else if (zfpmode == H5Z_ZFP_MODE_PRECISION) H5Pset_zfp_precision(cpid, (unsigned int) param);
+    else if (zfpmode == H5Z_ZFP_MODE_ACCURACY) H5Pset_zfp_accuracy(cpid, param);
+    else if (zfpmode == H5Z_ZFP_MODE_REVERSIBLE) H5Pset_zfp_reversible(cpid);
+    else ERROR(zfpmode);
+    if (threads > 1)
+        H5Pset_zfp_execution(cpid, H5Z_ZFP_EXEC_OMP, (unsigned int) threads, 0);
+
+    if (0 > (apid = H5Pcreate(H5P_DATASET_ACCESS))) ERROR(H5Pcreate);
+    if (0 > H5Pset_chunk_cache(apid, 0, 0, 1.0)) ERROR(H5Pset_chunk_cache);
+
+    if (0 > (fid = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT))) ERROR(H5Fcreate);
+    if (0 > (sid = H5Screate_simple(rank, dims, 0))) ERROR(H5Screate_simple);
+    if (0 > (dsid = H5Dcreate(fid, "bench", type, sid, H5P_DEFAULT, cpid, apid))) ERROR(H5Dcreate);
+
+    /* write, a chunk at a time */
+    for (c = 0; c < nchunks; c++)
+    {
+        hsize_t r = c;
+        for (d = rank-1; d >= 0; d--)
+        {
+            hsize_t nc = (dims[d] + chunk[d] - 1) / chunk[d];
+            start[d] = (r % nc) * chunk[d];
+            count[d] = start[d] + chunk[d] > dims[d] ? dims[d] - start[d] : chunk[d];
+            r /= nc;
+        }
+        if (0 > H5Sselect_hyperslab(sid, H5S_SELECT_SET, start, 0, count, 0)) ERROR(H5Sselect_hyperslab);
+        t0 = now();
+        if (0 > H5Dwrite(dsid, type, sid, sid, H5P_DEFAULT, buf)) ERROR(H5Dwrite);
+        wt[c] = now() - t0;
+        twrite += wt[c];
+    }
+    t0 = now();
+    if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
+    if (0 > H5Fflush(fid, H5F_SCOPE_LOCAL)) ERROR(H5Fflush);
+    twrite += now() - t0;
+
+    /* read, a chunk at a time */
+    if (0 > (dsid = H5Dopen(fid, "bench", apid))) ERROR(H5Dopen);
+    res->stored_bytes = (double) H5Dget_storage_size(dsid);
+    for (c = 0; c < nchunks; c++)
+    {
+        hsize_t r = c;
+        for (d = rank-1; d >= 0; d--)
+        {
+            hsize_t nc = (dims[d] + chunk[d] - 1) / chunk[d];
+            start[d] = (r % nc) * chunk[d];
+            count[d] = start[d] + chunk[d] > dims[d] ? dims[d] - start[d] : chunk[d];
+            r /= nc;
+        }
+        if (0 > H5Sselect_hyperslab(sid, H5S_SELECT_SET, start, 0, count, 0)) ERROR(H5Sselect_hyperslab);
+        t0 = now();
+        if (0 > H5Dread(dsid, type, sid, sid, H5P_DEFAULT, rbuf)) ERROR(H5Dread);
+        rt[c] = now() - t0;
+        tread += rt[c];
+    }
+
+    if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
+    if (0 > H5Sclose(sid)) ERROR(H5Sclose);
+    if (0 > H5Pclose(apid)) ERROR(H5Pclose);
+    if (0 > H5Pclose(cpid)) ERROR(H5Pclose);
+    if (0 > H5Fclose(fid)) ERROR(H5Fclose);
+
+    res->raw_bytes = (double) (npoints * dsize);
+    res->write_mbs = res->raw_bytes / (1 << 20) / twrite;
+    res->read_mbs = res->raw_bytes / (1 << 20) / tread;
+    percentiles(wt, nchunks, res->write_us);
+    percentiles(rt, nchunks, res->read_us);
+
+    free(wt);
+    free(rt);
+    free(rbuf);
+    return 0;
+}
+
+static void print_result(FILE *f, bench_result_t const *r, int json, int first)
+{
+    double ratio = r->stored_bytes > 0 ? r->raw_bytes / r->stored_bytes : 0;
+
+    if (json)
+    {
+        char k[5][64];
+        sscanf(r->key, "%63[^,],%63[^,],%63[^,],%63[^,],%63s", k[0], k[1], k[2], k[3], k[4]);
+        fprintf(f, "%s  {\"mode\": %s, \"param\": \"%s\", \"type\": \"%s\", \"chunk\": \"%s\", \"threads\": %s,\n"
+            "   \"raw_bytes\": %.0f, \"stored_bytes\": %.0f, \"ratio\": %.4g,\n"
+            "   \"write_mbs\": %.4g, \"read_mbs\": %.4g,\n"
+            "   \"write_us\": {\"p50\": %.4g, \"p90\": %.4g, \"p99\": %.4g},\n"
+            "   \"read_us\": {\"p50\": %.4g, \"p90\": %.4g, \"p99\": %.4g}}",
+            first ? "" : ",\n", k[0], k[1], k[2], k[3], k[4],
+            r->raw_bytes, r->stored_bytes, ratio, r->write_mbs, r->read_mbs,
+            r->write_us[0], r->write_us[1], r->write_us[2],
+            r->read_us[0], r->read_us[1], r->read_us[2]);
+    }
+    else
+    {
+        fprintf(f, "%s,%.0f,%.0f,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g,%.4g\n",
+            r->key, r->raw_bytes, r->stored_bytes, ratio, r->write_mbs, r->read_mbs,
+            r->write_us[0], r->write_us[1], r->write_us[2],
+            r->read_us[0], r->read_us[1], r->read_us[2]);
+    }
+}
+
+/* Compare a result against the matching entry of a baseline CSV file produced
+   by an earlier run. Returns 1 if throughput or compression ratio dropped by
+   more than the tolerance (a fraction). */
+static int check_baseline(char const *bfile, bench_result_t const *r, double tol)
+{
+    FILE *f = fopen(bfile, "r");
+    char line[1024];
+    size_t klen = strlen(r->key);
+    int regressed = 0, found = 0;
+
+    if (!f)
+    {
+        fprintf(stderr, "unable to open baseline \"%s\"\n", bfile);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), f))
+    {
+        double raw, stored, ratio, wmbs, rmbs;
+        double cur_ratio = r->stored_bytes > 0 ? r->raw_bytes / r->stored_bytes : 0;
+
+        if (strncmp(line, r->key, klen) || line[klen] != ',')
+            continue;
+        if (5 != sscanf(line + klen + 1, "%lf,%lf,%lf,%lf,%lf", &raw, &stored, &ratio, &wmbs, &rmbs))
+            continue;
+        found = 1;
+        if (r->write_mbs < (1 - tol) * wmbs)
+        {
+            fprintf(stderr, "REGRESSION %s: write %.4g MB/s, baseline %.4g MB/s\n", r->key, r->write_mbs, wmbs);
+            regressed = 1;
+        }
+        if (r->read_mbs < (1 - tol) * rmbs)
+        {
+            fprintf(stderr, "REGRESSION %s: read %.4g MB/s, baseline %.4g MB/s\n", r->key, r->read_mbs, rmbs);
+            regressed = 1;
+        }
+        if (cur_ratio < (1 - tol) * ratio)
+        {
+            fprintf(stderr, "REGRESSION %s: ratio %.4g, baseline %.4g\n", r->key, cur_ratio, ratio);
+            regressed = 1;
+        }
+        break;
+    }
+    fclose(f);
+
+    if (!found)
+        fprintf(stderr, "no baseline for %s\n", r->key);
+
+    return regressed;
+}
+
+int main(int argc, char **argv)
+{
+    int m, p, t, c, n, nmodes, nchunks, ntypes, nthreads, rank, help = 0, first = 1, regressed = 0;
+    char items[MAX_LIST][64], chunks_list[MAX_LIST][64], types_list[MAX_LIST][64], threads_list[MAX_LIST][64];
+    hsize_t dims[MAX_RANK];
+    double *dbuf;
+    size_t npoints = 1;
+    FILE *of;
+
+    /* file arguments */
+    char *ofile = strdup("bench_zfp.csv");
+    char *tfile = strdup("bench_zfp.h5");
+    char *baseline = strdup("");
+    char *format = strdup("csv");
+
+    /* sweep arguments; each is a comma separated list */
+    char *sdims = strdup("128x128x128");
+    char *modes = strdup("1,2,3");
+    char *rates = strdup("4,8,16");
+    char *precs = strdup("12,20");
+    char *accs = strdup("0.01,0.0001");
+    char *chunks = strdup("32x32x32,128x128x8");
+    char *types = strdup("float,double,int32,int64");
+    char *threads = strdup("1");
+    double noise = 0.001;
+    double amp = 1000;
+    double tolerance = 0.1;
+
+    HANDLE_ARG(ofile,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",set results filename);
+    HANDLE_ARG(format,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",results format (csv or json));
+    HANDLE_ARG(tfile,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",set scratch HDF5 filename);
+    HANDLE_ARG(baseline,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",compare to baseline csv results);
+    HANDLE_ARG(tolerance,(double) strtod(argv[i]+len2,0),"%g",allowed fractional drop from baseline);
+    HANDLE_ARG(sdims,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",dataset shape);
+    HANDLE_ARG(noise,(double) strtod(argv[i]+len2,0),"%g",amount of random noise in dataset);
+    HANDLE_ARG(amp,(double) strtod(argv[i]+len2,0),"%g",amplitude of dataset);
+    HANDLE_ARG(modes,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",zfp modes (1=rate,2=prec,3=acc,5=rev));
+    HANDLE_ARG(rates,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",rates for rate mode);
+    HANDLE_ARG(precs,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",precisions for precision mode);
+    HANDLE_ARG(accs,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",accuracies for accuracy mode);
+    HANDLE_ARG(chunks,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",chunk shapes (or auto[:bytes]));
+    HANDLE_ARG(types,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",data types);
+    HANDLE_ARG(threads,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",thread counts (1=serial));
+    HANDLE_ARG(help,(int)strtol(argv[i]+len2,0,10),"%d",this help message);
+
+    if (0 == (rank = parse_shape(sdims, dims))) ERROR(parse_shape);
+    for (n = 0; n < rank; n++)
+        npoints *= dims[n];
+    if (0 == (dbuf = gen_data(rank, dims, noise, amp))) ERROR(gen_data);
+
+    nmodes = split_list(modes, items);
+    nchunks = split_list(chunks, chunks_list);
+    ntypes = split_list(types, types_list);
+    nthreads = split_list(threads, threads_list);
+
+    if (0 == (of = fopen(ofile, "w"))) ERROR(fopen);
+    if (!strcmp(format, "json"))
+        fprintf(of, "[\n");
+    else
+        fprintf(of, "mode,param,type,chunk,threads,raw_bytes,stored_bytes,ratio,write_mbs,read_mbs,"
+            "write_p50_us,write_p90_us,write_p99_us,read_p50_us,read_p90_us,read_p99_us\n");
+
+    H5Z_zfp_initialize();
+
+    for (m = 0; m < nmodes; m++)
+    {
+        int zfpmode = (int) strtol(items[m], 0, 10);
+        char params[MAX_LIST][64];
+        int nparams;
+
+        switch (zfpmode)
+        {
+            case H5Z_ZFP_MODE_RATE:      nparams = split_list(rates, params); break;
+            case H5Z_ZFP_MODE_PRECISION: nparams = split_list(precs, params); break;
+            case H5Z_ZFP_MODE_ACCURACY:  nparams = split_list(accs, params); break;
+            case H5Z_ZFP_MODE_REVERSIBLE: nparams = 1; strcpy(params[0], "-"); break;
+            default: ERROR(zfpmode);
+        }
+
+        for (p = 0; p < nparams; p++)
+        for (t = 0; t < ntypes; t++)
+        for (c = 0; c < nchunks; c++)
+        for (n = 0; n < nthreads; n++)
+        {
+            hsize_t chunk[MAX_RANK];
+            char shape[64];
+            hid_t type;
+            void *buf;
+            bench_result_t res;
+
+            if (!strcmp(types_list[t], "float")) type = H5T_NATIVE_FLOAT;
+            else if (!strcmp(types_list[t], "double")) type = H5T_NATIVE_DOUBLE;
+            else if (!strcmp(types_list[t], "int32")) type = H5T_NATIVE_INT32;
+            else if (!strcmp(types_list[t], "int64")) type = H5T_NATIVE_INT64;
+            else ERROR(types);
+
+            strcpy(shape, chunks_list[c]);
+            if (rank != chunk_shape(shape, sizeof(shape), rank, dims, type, chunk))
+                ERROR(chunk_shape);
+
+            memset(&res, 0, sizeof(res));
+            snprintf(res.key, sizeof(res.key), "%d,%s,%s,%s,%s", zfpmode, params[p],
+                types_list[t], shape, threads_list[n]);
+
+            if (0 == (buf = convert_data(dbuf, npoints, type))) ERROR(convert_data);
+            if (bench_one(tfile, rank, dims, chunk, type, buf, zfpmode, strtod(params[p], 0),
+                    (int) strtol(threads_list[n], 0, 10), &res)) ERROR(bench_one);
+            free(buf);
+
+            print_result(of, &res, !strcmp(format, "json"), first);
+            first = 0;
+            printf("%-40s ratio %8.4g  write %8.4g MB/s  read %8.4g MB/s\n", res.key,
+                res.stored_bytes > 0 ? res.raw_bytes / res.stored_bytes : 0,
+                res.write_mbs, res.read_mbs);
+
+            if (baseline[0])
+                regressed |= check_baseline(baseline, &res, tolerance);
+        }
+    }
+
+    H5Z_zfp_finalize();
+
+    if (!strcmp(format, "json"))
+        fprintf(of, "\n]\n");
+    fclose(of);
+    unlink(tfile);
+
+    free(dbuf);
+    free(ofile);
+    free(tfile);
+    free(baseline);
+    free(format);
+    free(sdims);
+    free(modes);
+    free(rates);
+    free(precs);
+    free(accs);
+    free(chunks);
+    free(types);
+    free(threads);
+
+    H5close();
+
+    return regressed;
+}
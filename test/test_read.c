@@ -103,16 +103,210 @@ do {                                                            \
     return 1;                                                   \
 } while(0)
 
+#ifndef H5Z_ZFP_USE_PLUGIN
+/* Read a few hyperslabs of dsid with H5Z_zfp_read_region and compare
+   them to the same hyperslabs of buf, the whole dataset read with H5Dread.
+   Returns the number of hyperslabs that did not match exactly. */
+static int check_regions(hid_t dsid, double const *buf)
+{
+    int i, r, rank, nbad = 0;
+    hid_t space_id;
+    hsize_t dims[H5S_MAX_RANK], off[H5S_MAX_RANK], cnt[H5S_MAX_RANK], j[H5S_MAX_RANK];
+
+    if (0 > (space_id = H5Dget_space(dsid))) return 1;
+    rank = H5Sget_simple_extent_dims(space_id, dims, 0);
+    H5Sclose(space_id);
+
+    for (r = 0; r < 3; r++)
+    {
+        size_t k, n = 1;
+        double *rbuf;
+
+        for (i = 0; i < rank; i++)
+        {
+            switch (r)
+            {
+                case 0: off[i] = 0; cnt[i] = dims[i]; break;              /* everything */
+                case 1: off[i] = dims[i]/3; cnt[i] = dims[i]/3; break;    /* a box in the middle */
+                case 2: off[i] = i ? 0 : dims[i]/2; cnt[i] = i ? dims[i] : 1; break; /* a slice */
+            }
+            if (cnt[i] == 0) cnt[i] = 1;
+            n *= cnt[i];
+        }
+
+        if (0 == (rbuf = (double *) malloc(n * sizeof(double)))) return nbad+1;
+        if (0 > H5Z_zfp_read_region(dsid, off, cnt, rbuf))
+        {
+            nbad++;
+            free(rbuf);
+            continue;
+        }
+
+        memset(j, 0, sizeof(j));
+        for (k = 0; k < n; k++)
+        {
+            size_t idx = 0;
+            for (i = 0; i < rank; i++)
+                idx = idx * dims[i] + off[i] + j[i];
+            if (rbuf[k] != buf[idx])
+            {
+                nbad++;
+                break;
+            }
+            for (i = rank-1; i >= 0 && ++j[i] == cnt[i]; i--)
+                j[i] = 0;
+        }
+        free(rbuf);
+    }
+
+    return nbad;
+}
+
+/* Read all of dsid with H5Z_zfp_read_parallel on nthreads threads and compare
+   it to buf, the whole dataset read with H5Dread. Returns 0 if they match. */
+static int check_parallel(hid_t dsid, double const *buf, hsize_t npoints, int nthreads)
+{
+    int nbad;
+    double *pbuf;
+
+    if (0 == (pbuf = (double *) malloc(npoints * sizeof(double)))) return 1;
+    nbad = 0 > H5Z_zfp_read_parallel(dsid, H5S_ALL, pbuf, nthreads) ||
+           memcmp(pbuf, buf, npoints * sizeof(double));
+    free(pbuf);
+    return nbad;
+}
+
+/* Read all of dataset name in fid into buf. Returns 0 on success. */
+static int read_copy(hid_t fid, char const *name, double *buf)
+{
+    int nbad;
+    hid_t dsid;
+
+    if (0 > (dsid = H5Dopen(fid, name, H5P_DEFAULT))) return 1;
+    nbad = 0 > H5Dread(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf);
+    H5Dclose(dsid);
+    return nbad;
+}
+
+/* Copy dsid to test_zfp_copy.h5 with H5Z_zfp_copy, first as is, then into
+   near-lossless expert mode and then that copy again with the same settings.
+   The first and last must copy chunks as is and read back exactly as their
+   sources. Returns 0 if all is well. */
+static int check_copy(hid_t dsid, double const *buf, hsize_t npoints)
+{
+    int nbad = 0;
+    hsize_t k;
+    hid_t fid, edsid = -1, dcpl = -1;
+    double *cpbuf, *epbuf;
+
+    if (0 > (fid = H5Fcreate("test_zfp_copy.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT))) return 1;
+    cpbuf = (double *) malloc(npoints * sizeof(double));
+    epbuf = (double *) malloc(npoints * sizeof(double));
+    if (!cpbuf || !epbuf) nbad++;
+
+    /* with the source's settings (via H5Ocopy) */
+    if (!nbad && (1 != H5Z_zfp_copy(dsid, fid, "compressed", H5P_DEFAULT) ||
+                  read_copy(fid, "compressed", cpbuf) ||
+                  memcmp(cpbuf, buf, npoints * sizeof(double))))
+        nbad++;
+
+    /* with different settings, so recompressed */
+    if (!nbad && (0 > (dcpl = H5Dget_create_plist(dsid)) ||
+                  0 > H5Premove_filter(dcpl, H5Z_FILTER_ZFP) ||
+                  0 > H5Pset_zfp_expert(dcpl, 0, 16658, 64, -1074) ||
+                  0 != H5Z_zfp_copy(dsid, fid, "expert", dcpl) ||
+                  read_copy(fid, "expert", epbuf)))
+        nbad++;
+    for (k = 0; !nbad && k < npoints; k++)
+        if (fabs(epbuf[k] - buf[k]) > 1e-12 * fabs(buf[k])) nbad++;
+
+    /* with the same settings as the source */
+    if (!nbad && (0 > (edsid = H5Dopen(fid, "expert", H5P_DEFAULT)) ||
+                  1 != H5Z_zfp_copy(edsid, fid, "expert_again", dcpl) ||
+                  read_copy(fid, "expert_again", cpbuf) ||
+                  memcmp(cpbuf, epbuf, npoints * sizeof(double))))
+        nbad++;
+
+    if (edsid >= 0) H5Dclose(edsid);
+    if (dcpl >= 0) H5Pclose(dcpl);
+    free(cpbuf);
+    free(epbuf);
+    H5Fclose(fid);
+    return nbad;
+}
+
+/* Query the 1D dataset name in fid, with per-chunk statistics, for chunks that may
+   hold values in the top tenth of its range with H5Z_zfp_query_chunks. Every chunk
+   holding such a value, as read back with H5Dread, must be listed. Returns 0 if so. */
+static int check_query(hid_t fid, char const *name)
+{
+    int nbad = 0;
+    hid_t dsid, dcpl, space;
+    hsize_t k, j, chunk, npoints, *offsets = 0;
+    hssize_t nmatch;
+    double *rbuf, lo, mn, mx;
+    char *listed;
+
+    if (0 > (dsid = H5Dopen(fid, name, H5P_DEFAULT))) return 1;
+    dcpl = H5Dget_create_plist(dsid);
+    space = H5Dget_space(dsid);
+    npoints = (hsize_t) H5Sget_simple_extent_npoints(space);
+    if (1 != H5Pget_chunk(dcpl, 1, &chunk) || 0 == (rbuf = (double *) malloc(npoints * sizeof(double))))
+        nbad = 1;
+    else if (0 > H5Dread(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, rbuf))
+        nbad = 1;
+    H5Sclose(space);
+    H5Pclose(dcpl);
+    if (nbad)
+    {
+        H5Dclose(dsid);
+        return 1;
+    }
+
+    mn = mx = rbuf[0];
+    for (k = 0; k < npoints; k++)
+    {
+        if (rbuf[k] < mn) mn = rbuf[k];
+        if (rbuf[k] > mx) mx = rbuf[k];
+    }
+    lo = mn + 0.9 * (mx - mn);
+
+    listed = (char *) calloc((size_t) ((npoints + chunk - 1) / chunk), 1);
+    if (0 > (nmatch = H5Z_zfp_query_chunks(dsid, lo, mx, &offsets)))
+        nbad = 1;
+    for (k = 0; k < (hsize_t) (nmatch > 0 ? nmatch : 0); k++)
+        listed[offsets[k] / chunk] = 1;
+    for (k = 0; !nbad && k < npoints; k += chunk)
+        for (j = k; j < npoints && j < k + chunk; j++)
+            if (rbuf[j] >= lo && !listed[k / chunk])
+            {
+                fprintf(stderr, "%s: chunk at %llu holds %g but wasn't listed\n",
+                    name, (unsigned long long) k, rbuf[j]);
+                nbad = 1;
+                break;
+            }
+    if (!nbad)
+        printf("Query %s: %lld of %llu chunks may hold values in [%g, %g]\n", name, (long long) nmatch,
+            (unsigned long long) ((npoints + chunk - 1) / chunk), lo, mx);
+
+    free(offsets);
+    free(listed);
+    free(rbuf);
+    H5Dclose(dsid);
+    return nbad;
+}
+#endif
+
 int main(int argc, char **argv)
 {
-    int i, help=0;
+    int i, pass, highd=0, region=0, parallel=0, readprec=0, copy=0, access=0, query=0, stats=0, help=0;
     double *obuf, *cbuf;
 
     /* filename variables */
     char *ifile = (char *) calloc(NAME_LEN,sizeof(char));
 
     /* HDF5 dataset info */
-    hid_t fid, dsid, dcpl_id, space_id;
+    hid_t fid, dsid, dcpl_id, space_id, dapl_id = H5P_DEFAULT;
     hsize_t npoints;
 
     /* absolute and relative differencing thresholds */
@@ -130,60 +324,120 @@ int main(int argc, char **argv)
     HANDLE_ARG(ifile,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",set input filename);
     HANDLE_ARG(max_absdiff,strtod(argv[i]+len2,0),"%g",set maximum absolute diff);
     HANDLE_ARG(max_reldiff,strtod(argv[i]+len2,0),"%g",set maximum relative diff);
+    HANDLE_ARG(highd,(int)strtol(argv[i]+len2,0,10),"%d",also check high-dimensional case);
+    HANDLE_ARG(region,(int)strtol(argv[i]+len2,0,10),"%d",check direct region reads (lib only));
+    HANDLE_ARG(parallel,(int)strtol(argv[i]+len2,0,10),"%d",check parallel reads on N threads (lib only));
+    HANDLE_ARG(readprec,(int)strtol(argv[i]+len2,0,10),"%d",set read precision (lib only));
+    HANDLE_ARG(copy,(int)strtol(argv[i]+len2,0,10),"%d",check copies with H5Z_zfp_copy (lib only));
+    HANDLE_ARG(access,(int)strtol(argv[i]+len2,0,10),"%d",use access properties with N threads (lib only));
+    HANDLE_ARG(query,(int)strtol(argv[i]+len2,0,10),"%d",check chunk queries on statistics (lib only));
+    HANDLE_ARG(stats,(int)strtol(argv[i]+len2,0,10),"%d",enable filter stats via H5Z_zfp_set_stats (lib only));
     HANDLE_ARG(help,(int)strtol(argv[i]+len2,0,10),"%d",this help message);
 
 #ifndef H5Z_ZFP_USE_PLUGIN
     H5Z_zfp_initialize();
+    if (stats) H5Z_zfp_set_stats(1);
+    if (access)
+    {
+        /* decode threads, read precision and buffer pool for this reader only */
+        if (0 > (dapl_id = H5Pcreate(H5P_DATASET_ACCESS))) ERROR(H5Pcreate);
+        if (0 > H5Pset_zfp_access(dapl_id, H5Z_ZFP_EXEC_OMP, (unsigned int) access, 16)) ERROR(H5Pset_zfp_access);
+        if (readprec && 0 > H5Pset_zfp_access_read_precision(dapl_id, readprec)) ERROR(H5Pset_zfp_access_read_precision);
+        if (0 > H5Pset_zfp_access_buffer_pool(dapl_id, 1)) ERROR(H5Pset_zfp_access_buffer_pool);
+        if (0 > H5Z_zfp_set_access(dapl_id)) ERROR(H5Z_zfp_set_access);
+    }
+    else if (readprec) H5Z_zfp_set_read_precision(readprec);
 #endif
 
     /* open the HDF5 file */
     if (0 > (fid = H5Fopen(ifile, H5F_ACC_RDONLY, H5P_DEFAULT))) ERROR(H5Fopen);
 
-    /* read the original dataset */
-    if (0 > (dsid = H5Dopen(fid, "original", H5P_DEFAULT))) ERROR(H5Dopen);
-    if (0 > (space_id = H5Dget_space(dsid))) ERROR(H5Dget_space);
-    if (0 == (npoints = H5Sget_simple_extent_npoints(space_id))) ERROR(H5Sget_simple_extent_npoints);
-    if (0 > H5Sclose(space_id)) ERROR(H5Sclose);
-    if (0 == (obuf = (double *) malloc(npoints * sizeof(double)))) ERROR(malloc);
-    if (0 > H5Dread(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, obuf)) ERROR(H5Dread);
-    if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
-    
-    /* read the compressed dataset */
-    if (0 > (dsid = H5Dopen(fid, "compressed", H5P_DEFAULT))) ERROR(H5Dopen);
-    if (0 > (dcpl_id = H5Dget_create_plist(dsid))) ERROR(H5Dget_create_plist);
-    if (0 == (cbuf = (double *) malloc(npoints * sizeof(double)))) ERROR(malloc);
-    if (0 > H5Dread(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, cbuf)) ERROR(H5Dread);
-    if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
+    /* compare original to compressed for each pair of datasets */
+    for (pass = 0; pass < (highd ? 2 : 1); pass++)
+    {
+        char const *oname = pass ? "highD_original" : "original";
+        char const *cname = pass ? "highD_compressed" : "compressed";
 
-    /* clean up */
-    if (0 > H5Pclose(dcpl_id)) ERROR(H5Pclose);
-    if (0 > H5Fclose(fid)) ERROR(H5Fclose);
+        /* read the original dataset */
+        if (0 > (dsid = H5Dopen(fid, oname, H5P_DEFAULT))) ERROR(H5Dopen);
+        if (0 > (space_id = H5Dget_space(dsid))) ERROR(H5Dget_space);
+        if (0 == (npoints = H5Sget_simple_extent_npoints(space_id))) ERROR(H5Sget_simple_extent_npoints);
+        if (0 > H5Sclose(space_id)) ERROR(H5Sclose);
+        if (0 == (obuf = (double *) malloc(npoints * sizeof(double)))) ERROR(malloc);
+        if (0 > H5Dread(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, obuf)) ERROR(H5Dread);
+        if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
 
-    /* compare original to compressed */
-    for (i = 0; i < npoints; i++)
-    {
-        double absdiff = obuf[i] - cbuf[i];
-        if (absdiff < 0) absdiff = -absdiff;
-        if (absdiff > 0)
+        /* read the compressed dataset */
+        if (0 > (dsid = H5Dopen(fid, cname, dapl_id))) ERROR(H5Dopen);
+        if (0 > (dcpl_id = H5Dget_create_plist(dsid))) ERROR(H5Dget_create_plist);
+        if (0 == (cbuf = (double *) malloc(npoints * sizeof(double)))) ERROR(malloc);
+        if (0 > H5Dread(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, cbuf)) ERROR(H5Dread);
+#ifndef H5Z_ZFP_USE_PLUGIN
+        if (region && check_regions(dsid, cbuf)) ERROR(H5Z_zfp_read_region);
+        if (parallel && check_parallel(dsid, cbuf, npoints, parallel)) ERROR(H5Z_zfp_read_parallel);
+        if (copy && !pass && check_copy(dsid, cbuf, npoints)) ERROR(H5Z_zfp_copy);
+#endif
+        if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
+        if (0 > H5Pclose(dcpl_id)) ERROR(H5Pclose);
+
+        /* compare original to compressed */
+        for (i = 0; i < npoints; i++)
         {
-            double reldiff = 0;
-            if (obuf[i] != 0) reldiff = absdiff / obuf[i];
-
-            if (absdiff > actual_max_absdiff) actual_max_absdiff = absdiff;
-            if (reldiff > actual_max_reldiff) actual_max_reldiff = reldiff;
-            if (absdiff > max_absdiff)
-                num_absdiffs++;
-            if (reldiff > max_reldiff)
-                num_reldiffs++;
+            double absdiff = obuf[i] - cbuf[i];
+            if (absdiff < 0) absdiff = -absdiff;
+            if (absdiff > 0)
+            {
+                double reldiff = 0;
+                if (obuf[i] != 0) reldiff = absdiff / obuf[i];
+
+                if (absdiff > actual_max_absdiff) actual_max_absdiff = absdiff;
+                if (reldiff > actual_max_reldiff) actual_max_reldiff = reldiff;
+                if (absdiff > max_absdiff)
+                    num_absdiffs++;
+                if (reldiff > max_reldiff)
+                    num_reldiffs++;
+            }
         }
+
+        free(obuf);
+        free(cbuf);
     }
+
+#ifndef H5Z_ZFP_USE_PLUGIN
+    /* with an index and, for the integer data, from the chunks themselves */
+    if (query && check_query(fid, "compressed")) ERROR(H5Z_zfp_query_chunks);
+    if (query && 0 < H5Lexists(fid, "int_compressed", H5P_DEFAULT) &&
+        check_query(fid, "int_compressed")) ERROR(H5Z_zfp_query_chunks);
+    if (query && 0 < H5Lexists(fid, "sparse_compressed", H5P_DEFAULT) &&
+        check_query(fid, "sparse_compressed")) ERROR(H5Z_zfp_query_chunks);
+    if (query && 0 < H5Lexists(fid, "rewritten_compressed", H5P_DEFAULT) &&
+        check_query(fid, "rewritten_compressed")) ERROR(H5Z_zfp_query_chunks);
+#endif
+
+    /* clean up */
+    if (0 > H5Fclose(fid)) ERROR(H5Fclose);
+    if (dapl_id != H5P_DEFAULT && 0 > H5Pclose(dapl_id)) ERROR(H5Pclose);
+
     printf("Absolute Diffs: %d values are different; actual-max-absdiff = %g\n",
         num_absdiffs, actual_max_absdiff);
     printf("Relative Diffs: %d values are different; actual-max-reldiff = %g\n",
         num_reldiffs, actual_max_reldiff);
 
-    free(obuf);
-    free(cbuf);
+#ifndef H5Z_ZFP_USE_PLUGIN
+    {
+        unsigned long long hits, misses, resident, peak;
+        H5Z_zfp_stats_t stats;
+        H5Z_zfp_cache_stats(&hits, &misses);
+        printf("Header cache: %llu hits, %llu misses\n", hits, misses);
+        H5Z_zfp_pool_stats(&resident, &peak);
+        printf("Buffer pool: %llu bytes resident, %llu bytes peak\n", resident, peak);
+        H5Z_zfp_get_stats(&stats);
+        if (stats.calls[1])
+            printf("Filter stats: %llu decompress calls, %llu -> %llu bytes, %llu ns in zfp\n",
+                stats.calls[1], stats.zfp_bytes[1], stats.raw_bytes[1], stats.zfp_ns[1]);
+    }
+#endif
+
     free(ifile);
 
     if (max_absdiff != 0) return num_absdiffs>0;
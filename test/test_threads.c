@@ -0,0 +1,339 @@
+/*
+Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+Produced at the Lawrence Livermore National Laboratory
+Written by Mark C. Miller, miller86@llnl.gov
+LLNL-CODE-707197. All rights reserved.
+
+This file is part of H5Z-ZFP. Please also read the BSD license
+https://raw.githubusercontent.com/LLNL/H5Z-ZFP/master/LICENSE
+*/
+
+/* Stress test of concurrent calls to the filter function. The cd_values of a
+   handful of datasets, of different types and ZFP modes, are taken from HDF5
+   after it has run the filter's set_local callback. Each chunk is compressed
+   and decompressed once, serially, for reference. Then, nthreads threads,
+   released together, call the filter function directly, round robin over the
+   datasets, and check every result is byte for byte the reference. */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "hdf5.h"
+
+#ifdef H5Z_ZFP_USE_PLUGIN
+#include <dlfcn.h>
+#include "H5Zzfp_plugin.h"
+#else
+#include "H5Zzfp_lib.h"
+#endif
+
+#define NAME_LEN 256
+#define MAX_CONFIGS 8
+
+/* the datasets; typ is 'd'ouble, 'f'loat or 'i'nt */
+static struct { char const *name; char typ; int zfpmode; double param; } const specs[] = {
+    {"double_rate",       'd', H5Z_ZFP_MODE_RATE,       16},
+    {"double_accuracy",   'd', H5Z_ZFP_MODE_ACCURACY,   0.01},
+    {"double_reversible", 'd', H5Z_ZFP_MODE_REVERSIBLE, 0},
+    {"float_rate",        'f', H5Z_ZFP_MODE_RATE,       8},
+    {"float_accuracy",    'f', H5Z_ZFP_MODE_ACCURACY,   0.1},
+    {"int_precision",     'i', H5Z_ZFP_MODE_PRECISION,  20},
+    {"int_reversible",    'i', H5Z_ZFP_MODE_REVERSIBLE, 0}
+};
+
+/* convenience macro to handle command-line args and help */
+#define HANDLE_ARG(A,PARSEA,PRINTA,HELPSTR)                     \
+{                                                               \
+    int i;                                                      \
+    char tmpstr[64];                                            \
+    int len;                                                    \
+    int len2 = strlen(#A)+1;                                    \
+    for (i = 0; i < argc; i++)                                  \
+    {                                                           \
+        if (!strncmp(argv[i], #A"=", len2))                     \
+        {                                                       \
+            A = PARSEA;                                         \
+            break;                                              \
+        }                                                       \
+        else if (!strncasecmp(argv[i], "help", 4))              \
+        {                                                       \
+            return 0;                                           \
+        }                                                       \
+    }                                                           \
+    len = snprintf(tmpstr, sizeof(tmpstr), "%s=" PRINTA, #A, A);\
+    printf("    %s%*s\n",tmpstr,60-len,#HELPSTR);               \
+}
+
+/* convenience macro to handle errors */
+#define ERROR(FNAME)                                              \
+do {                                                              \
+    int _errno = errno;                                           \
+    fprintf(stderr, #FNAME " failed at line %d, errno=%d (%s)\n", \
+        __LINE__, _errno, _errno?strerror(_errno):"ok");          \
+    return 1;                                                     \
+} while(0)
+
+typedef size_t (*filter_func_t)(unsigned int flags, size_t cd_nelmts, const unsigned int cd_values[],
+    size_t nbytes, size_t *buf_size, void **buf);
+
+/* One dataset's cd_values, uncompressed chunk and reference results */
+typedef struct _config_t {
+    char const *name;
+    size_t cd_nelmts;
+    unsigned int cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    void *raw;
+    size_t nbytes;
+    void *zref;
+    size_t zsize;
+    void *dref;
+} config_t;
+
+typedef struct _worker_t {
+    int index;
+    int iters;
+    int nconfigs;
+    int failed;
+    config_t *configs;
+    pthread_t thread;
+} worker_t;
+
+static filter_func_t filter;
+
+/* start gate so all threads contend for the filter from the start */
+static pthread_mutex_t gate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_open = 0;
+
+/* Compress a copy of c's chunk with the filter, then decompress the result, as
+   HDF5 would, in a buffer from H5allocate_memory. Results are compared to the
+   reference unless c has none yet, in which case they become it. Returns 0 if
+   all is well. */
+static int round_trip(config_t *c, int check)
+{
+    size_t buf_size = c->nbytes, zsize, dsize;
+    void *buf = H5allocate_memory(c->nbytes, 0);
+    int retval = 1;
+
+    if (!buf) return 1;
+    memcpy(buf, c->raw, c->nbytes);
+
+    if (0 == (zsize = filter(0, c->cd_nelmts, c->cd_values, c->nbytes, &buf_size, &buf)))
+        goto done;
+    if (!check)
+    {
+        if (0 == (c->zref = malloc(zsize))) goto done;
+        memcpy(c->zref, buf, zsize);
+        c->zsize = zsize;
+    }
+    else if (zsize != c->zsize || memcmp(buf, c->zref, zsize))
+        goto done;
+
+    if (c->nbytes != (dsize = filter(H5Z_FLAG_REVERSE, c->cd_nelmts, c->cd_values, zsize, &buf_size, &buf)))
+        goto done;
+    if (!check)
+    {
+        if (0 == (c->dref = malloc(dsize))) goto done;
+        memcpy(c->dref, buf, dsize);
+    }
+    else if (memcmp(buf, c->dref, dsize))
+        goto done;
+    retval = 0;
+
+done:
+    H5free_memory(buf);
+    return retval;
+}
+
+static void *worker(void *arg)
+{
+    worker_t *w = (worker_t *) arg;
+    int i;
+
+    pthread_mutex_lock(&gate_mutex);
+    while (!gate_open)
+        pthread_cond_wait(&gate_cond, &gate_mutex);
+    pthread_mutex_unlock(&gate_mutex);
+
+    for (i = 0; i < w->iters; i++)
+    {
+        config_t *c = &w->configs[(w->index + i) % w->nconfigs];
+        if (round_trip(c, 1))
+        {
+            fprintf(stderr, "thread %d, iteration %d: %s differs from serial result\n", w->index, i, c->name);
+            w->failed++;
+        }
+    }
+    return 0;
+}
+
+/* Smooth 3D samples, with a little noise, in the given type */
+static void *gen_data(hid_t type, size_t n, hsize_t const *dims)
+{
+    size_t i, dsize = H5Tget_size(type);
+    void *buf = malloc(n * dsize);
+
+    if (!buf) return 0;
+    for (i = 0; i < n; i++)
+    {
+        size_t x = i % dims[2], y = (i / dims[2]) % dims[1], z = i / (dims[2] * dims[1]);
+        double v = 1000 * sin(0.1 * x) * cos(0.13 * y) + 10 * z + (double) (rand() % 1000) / 1000;
+        if (H5Tequal(type, H5T_NATIVE_DOUBLE) > 0) ((double *) buf)[i] = v;
+        else if (H5Tequal(type, H5T_NATIVE_FLOAT) > 0) ((float *) buf)[i] = (float) v;
+        else ((int *) buf)[i] = (int) v;
+    }
+    return buf;
+}
+
+/* Create a dataset with the given generic cd_values in fid, so HDF5 runs the
+   filter's set_local callback, and keep the cd_values it produces */
+static int setup_config(hid_t fid, config_t *c, char const *name, hid_t type, hsize_t const *dims,
+    size_t cd_nelmts, unsigned int const *cd_values)
+{
+    hid_t cpid, sid, dsid, dcpl;
+    unsigned int flags;
+    size_t n = (size_t) (dims[0] * dims[1] * dims[2]);
+
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    if (0 > (cpid = H5Pcreate(H5P_DATASET_CREATE))) ERROR(H5Pcreate);
+    if (0 > H5Pset_chunk(cpid, 3, dims)) ERROR(H5Pset_chunk);
+    if (0 > H5Pset_filter(cpid, H5Z_FILTER_ZFP, H5Z_FLAG_MANDATORY, cd_nelmts, cd_values)) ERROR(H5Pset_filter);
+    if (0 > (sid = H5Screate_simple(3, dims, 0))) ERROR(H5Screate_simple);
+    if (0 > (dsid = H5Dcreate(fid, name, type, sid, H5P_DEFAULT, cpid, H5P_DEFAULT))) ERROR(H5Dcreate);
+    if (0 > (dcpl = H5Dget_create_plist(dsid))) ERROR(H5Dget_create_plist);
+    c->cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX;
+    if (0 > H5Pget_filter_by_id(dcpl, H5Z_FILTER_ZFP, &flags, &c->cd_nelmts, c->cd_values, 0, 0, 0))
+        ERROR(H5Pget_filter_by_id);
+    H5Pclose(dcpl);
+    H5Dclose(dsid);
+    H5Sclose(sid);
+    H5Pclose(cpid);
+
+    c->nbytes = n * H5Tget_size(type);
+    if (0 == (c->raw = gen_data(type, n, dims))) ERROR(gen_data);
+    if (round_trip(c, 0)) ERROR(round_trip);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int t, nconfigs, failed = 0, help = 0;
+    config_t configs[MAX_CONFIGS];
+    worker_t *workers;
+    hsize_t dims[3] = {16, 16, 16};
+    hid_t fapl, fid;
+    hbool_t threadsafe = 0;
+    struct timespec t0, t1;
+    double secs;
+
+    int nthreads = 8;
+    int iters = 200;
+    int chunk = 16;
+#ifdef H5Z_ZFP_USE_PLUGIN
+    char *plugin = strdup("../src/plugin/libh5zzfp.so");
+    void *handle;
+    H5Z_class2_t const *zclass;
+#endif
+
+    HANDLE_ARG(nthreads,(int) strtol(argv[i]+len2,0,10), "%d",number of threads);
+    HANDLE_ARG(iters,(int) strtol(argv[i]+len2,0,10), "%d",round trips per thread);
+    HANDLE_ARG(chunk,(int) strtol(argv[i]+len2,0,10), "%d",chunk size along each of 3 dims);
+#ifdef H5Z_ZFP_USE_PLUGIN
+    HANDLE_ARG(plugin,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",filter plugin shared library);
+#endif
+    HANDLE_ARG(help,(int)strtol(argv[i]+len2,0,10),"%d",this help message);
+
+    if (nthreads < 1 || iters < 1 || chunk < 1) ERROR(nthreads);
+    dims[0] = dims[1] = dims[2] = (hsize_t) chunk;
+
+#ifdef H5Z_ZFP_USE_PLUGIN
+    /* the same plugin HDF5 loads from HDF5_PLUGIN_PATH, sharing its state */
+    if (0 == (handle = dlopen(plugin, RTLD_NOW)))
+    {
+        fprintf(stderr, "%s\n", dlerror());
+        ERROR(dlopen);
+    }
+    zclass = ((H5Z_class2_t const *(*)(void)) dlsym(handle, "H5PLget_plugin_info"))();
+    filter = zclass->filter;
+#else
+    H5Z_zfp_initialize();
+    filter = H5Z_ZFP->filter;
+#endif
+
+    H5is_library_threadsafe(&threadsafe);
+    printf("HDF5 is%s threadsafe\n", threadsafe ? "" : " not");
+
+    /* datasets in memory only */
+    if (0 > (fapl = H5Pcreate(H5P_FILE_ACCESS))) ERROR(H5Pcreate);
+    if (0 > H5Pset_fapl_core(fapl, 1 << 20, 0)) ERROR(H5Pset_fapl_core);
+    if (0 > (fid = H5Fcreate("test_threads.h5", H5F_ACC_TRUNC, H5P_DEFAULT, fapl))) ERROR(H5Fcreate);
+
+    for (nconfigs = 0; nconfigs < (int) (sizeof(specs) / sizeof(specs[0])); nconfigs++)
+    {
+        hid_t type = specs[nconfigs].typ == 'd' ? H5T_NATIVE_DOUBLE :
+                     specs[nconfigs].typ == 'f' ? H5T_NATIVE_FLOAT : H5T_NATIVE_INT;
+        size_t cd_nelmts = H5Z_ZFP_CD_NELMTS_MEM;
+        unsigned int cd_values[H5Z_ZFP_CD_NELMTS_MEM];
+
+        switch (specs[nconfigs].zfpmode)
+        {
+            case H5Z_ZFP_MODE_RATE: H5Pset_zfp_rate_cdata(specs[nconfigs].param, cd_nelmts, cd_values); break;
+            case H5Z_ZFP_MODE_PRECISION: H5Pset_zfp_precision_cdata((unsigned int) specs[nconfigs].param, cd_nelmts, cd_values); break;
+            case H5Z_ZFP_MODE_ACCURACY: H5Pset_zfp_accuracy_cdata(specs[nconfigs].param, cd_nelmts, cd_values); break;
+            default: H5Pset_zfp_reversible_cdata(cd_nelmts, cd_values); break;
+        }
+        if (setup_config(fid, &configs[nconfigs], specs[nconfigs].name, type, dims, cd_nelmts, cd_values))
+            ERROR(setup_config);
+    }
+
+    if (0 == (workers = (worker_t *) calloc((size_t) nthreads, sizeof(worker_t)))) ERROR(calloc);
+    for (t = 0; t < nthreads; t++)
+    {
+        workers[t].index = t;
+        workers[t].iters = iters;
+        workers[t].nconfigs = nconfigs;
+        workers[t].configs = configs;
+        if (pthread_create(&workers[t].thread, 0, worker, &workers[t])) ERROR(pthread_create);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_mutex_lock(&gate_mutex);
+    gate_open = 1;
+    pthread_cond_broadcast(&gate_cond);
+    pthread_mutex_unlock(&gate_mutex);
+
+    for (t = 0; t < nthreads; t++)
+    {
+        pthread_join(workers[t].thread, 0);
+        failed += workers[t].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (double) (t1.tv_sec - t0.tv_sec) + 1e-9 * (double) (t1.tv_nsec - t0.tv_nsec);
+
+    printf("%d threads, %d round trips over %d datasets in %g s, %d failed\n",
+        nthreads, nthreads * iters, nconfigs, secs, failed);
+
+    for (t = 0; t < nconfigs; t++)
+    {
+        free(configs[t].raw);
+        free(configs[t].zref);
+        free(configs[t].dref);
+    }
+    free(workers);
+    H5Fclose(fid);
+    H5Pclose(fapl);
+
+#ifdef H5Z_ZFP_USE_PLUGIN
+    free(plugin);
+#else
+    H5Z_zfp_finalize();
+#endif
+
+    return failed ? 1 : 0;
+}
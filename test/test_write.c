@@ -22,6 +22,7 @@ https://raw.githubusercontent.com/LLNL/H5Z-ZFP/master/LICENSE
 #ifdef H5Z_ZFP_USE_PLUGIN
 #include "H5Zzfp_plugin.h"
 #else
+#include "H5Zzfp_direct.h"
 #include "H5Zzfp_lib.h"
 #include "H5Zzfp_props.h"
 #endif
@@ -245,9 +246,35 @@ static int read_data(char const *fname, size_t npoints, double **_buf)
     return 0;
 }
 
+#ifndef H5Z_ZFP_USE_PLUGIN
+/* Write 1D buf a chunk at a time through the write-behind writer. The last chunk
+   is zero padded to a whole chunk. */
+static int write_chunks(hid_t dsid, void const *buf, size_t dsize,
+    hsize_t npoints, hsize_t chunk, int nthreads)
+{
+    H5Z_zfp_writer_t *w;
+    char *cbuf;
+    hsize_t off;
+
+    if (0 == (cbuf = (char *) malloc((size_t) chunk * dsize))) ERROR(malloc);
+    if (0 == (w = H5Z_zfp_writer_open(dsid, nthreads))) ERROR(H5Z_zfp_writer_open);
+    for (off = 0; off < npoints; off += chunk)
+    {
+        size_t n = (size_t) (npoints - off < chunk ? npoints - off : chunk);
+        memset(cbuf, 0, (size_t) chunk * dsize);
+        memcpy(cbuf, (char const *) buf + off * dsize, n * dsize);
+        if (0 > H5Z_zfp_writer_put(w, &off, cbuf)) ERROR(H5Z_zfp_writer_put);
+    }
+    if (0 > H5Z_zfp_writer_close(w)) ERROR(H5Z_zfp_writer_close);
+    free(cbuf);
+    return 0;
+}
+#endif
+
 static hid_t setup_filter(int n, hsize_t *chunk, int zfpmode,
-    double rate, double acc, uint prec,
-    uint minbits, uint maxbits, uint maxprec, int minexp)
+    double rate, double acc, double ratio, uint prec,
+    uint minbits, uint maxbits, uint maxprec, int minexp,
+    int exec, uint nthreads)
 {
     hid_t cpid;
     unsigned int cd_values[10];
@@ -267,6 +294,10 @@ static hid_t setup_filter(int n, hsize_t *chunk, int zfpmode,
         H5Pset_zfp_accuracy_cdata(acc, cd_nelmts, cd_values);
     else if (zfpmode == H5Z_ZFP_MODE_EXPERT)
         H5Pset_zfp_expert_cdata(minbits, maxbits, maxprec, minexp, cd_nelmts, cd_values);
+    else if (zfpmode == H5Z_ZFP_MODE_REVERSIBLE)
+        H5Pset_zfp_reversible_cdata(cd_nelmts, cd_values);
+    else if (zfpmode == H5Z_ZFP_MODE_TARGET)
+        H5Pset_zfp_target_cdata(ratio, acc, cd_nelmts, cd_values);
     else
         cd_nelmts = 0; /* causes default behavior of ZFP library */
 
@@ -294,12 +325,229 @@ static hid_t setup_filter(int n, hsize_t *chunk, int zfpmode,
         H5Pset_zfp_accuracy(cpid, acc);
     else if (zfpmode == H5Z_ZFP_MODE_EXPERT)
         H5Pset_zfp_expert(cpid, minbits, maxbits, maxprec, minexp);
+    else if (zfpmode == H5Z_ZFP_MODE_REVERSIBLE)
+        H5Pset_zfp_reversible(cpid);
+    else if (zfpmode == H5Z_ZFP_MODE_TARGET)
+    {
+        if (ratio > 0) H5Pset_zfp_target_ratio(cpid, ratio);
+        if (acc > 0) H5Pset_zfp_target_error(cpid, acc);
+    }
+
+    /* Execution policy is available only via properties interface */
+    if (exec != H5Z_ZFP_EXEC_SERIAL)
+        H5Pset_zfp_execution(cpid, exec, nthreads, 0);
 
 #endif
 
     return cpid;
 }
 
+#ifndef H5Z_ZFP_USE_PLUGIN
+/* Compare the size H5Z_zfp_predict_chunk_bytes predicts, from the creation
+   properties used and from those of the dataset, to the size actually stored */
+static int check_predicted_size(hid_t dsid, hid_t cpid, hsize_t chunk, hsize_t npoints)
+{
+    size_t nbytes, nbytes2;
+    hsize_t nchunks = (npoints + chunk - 1) / chunk, stored = H5Dget_storage_size(dsid);
+    hid_t csid = H5Screate_simple(1, &chunk, 0), dcpl = H5Dget_create_plist(dsid);
+    int exact = H5Z_zfp_predict_chunk_bytes(cpid, H5T_NATIVE_DOUBLE, csid, &nbytes);
+    int exact2 = H5Z_zfp_predict_chunk_bytes(dcpl, H5T_NATIVE_DOUBLE, csid, &nbytes2);
+
+    H5Pclose(dcpl);
+    H5Sclose(csid);
+    if (exact < 0 || exact2 != exact || nbytes2 != nbytes)
+        return 1;
+    printf("Predicted chunk: %zu bytes (%s), stored %llu bytes in %llu chunks\n", nbytes,
+        exact ? "exact" : "bound", (unsigned long long) stored, (unsigned long long) nchunks);
+    if (exact ? stored != nchunks * nbytes : stored > nchunks * nbytes)
+        return 1;
+    return 0;
+}
+
+/* Index the chunk statistics of 1D dataset dsid and check them against buf and,
+   with H5Z_ZFP_CSTATS_ERROR, against what the dataset reads back as */
+static int check_chunk_stats(hid_t dsid, double const *buf, hsize_t chunk, hsize_t npoints, uint cstats)
+{
+    H5Z_zfp_chunk_stats_t st;
+    hsize_t k, nchunks = (npoints + chunk - 1) / chunk;
+    hsize_t adim = 1;
+    hssize_t nindexed;
+    double *rbuf;
+    hid_t fid, idsid, atype, mtype;
+
+    if (0 > (nindexed = H5Z_zfp_write_chunk_index(dsid, 0))) ERROR(H5Z_zfp_write_chunk_index);
+    if ((hsize_t) nindexed != nchunks) ERROR(H5Z_zfp_write_chunk_index);
+    if (0 == (rbuf = (double *) malloc(npoints * sizeof(double)))) ERROR(malloc);
+    if (0 > H5Dread(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, rbuf)) ERROR(H5Dread);
+
+    /* read the index back a row at a time */
+    if (0 > (fid = H5Iget_file_id(dsid))) ERROR(H5Iget_file_id);
+    if (0 > (idsid = H5Dopen(fid, "/compressed_zfp_index", H5P_DEFAULT))) ERROR(H5Dopen);
+    atype = H5Tarray_create2(H5T_NATIVE_HSIZE, 1, &adim);
+    mtype = H5Tcreate(H5T_COMPOUND, sizeof(st));
+    H5Tinsert(mtype, "offset", HOFFSET(H5Z_zfp_chunk_stats_t, offset), atype);
+    H5Tinsert(mtype, "min", HOFFSET(H5Z_zfp_chunk_stats_t, min), H5T_NATIVE_DOUBLE);
+    H5Tinsert(mtype, "max", HOFFSET(H5Z_zfp_chunk_stats_t, max), H5T_NATIVE_DOUBLE);
+    H5Tinsert(mtype, "mean", HOFFSET(H5Z_zfp_chunk_stats_t, mean), H5T_NATIVE_DOUBLE);
+    H5Tinsert(mtype, "maxerr", HOFFSET(H5Z_zfp_chunk_stats_t, maxerr), H5T_NATIVE_DOUBLE);
+    H5Tinsert(mtype, "flags", HOFFSET(H5Z_zfp_chunk_stats_t, flags), H5T_NATIVE_UINT);
+    for (k = 0; k < nchunks; k++)
+    {
+        hid_t fsid = H5Dget_space(idsid), msid = H5Screate_simple(1, &adim, 0);
+        hsize_t j, off, n;
+        double lo, hi, sum = 0, err = 0;
+
+        H5Sselect_hyperslab(fsid, H5S_SELECT_SET, &k, 0, &adim, 0);
+        if (0 > H5Dread(idsid, mtype, msid, fsid, H5P_DEFAULT, &st)) ERROR(H5Dread);
+        H5Sclose(msid);
+        H5Sclose(fsid);
+
+        /* edge chunks are padded with the fill value, zero here */
+        off = st.offset[0];
+        n = npoints - off < chunk ? npoints - off : chunk;
+        lo = hi = buf[off];
+        for (j = 0; j < n; j++)
+        {
+            double d = fabs(rbuf[off+j] - buf[off+j]);
+            if (buf[off+j] < lo) lo = buf[off+j];
+            if (buf[off+j] > hi) hi = buf[off+j];
+            sum += buf[off+j];
+            if (d > err) err = d;
+        }
+        if (n < chunk)
+        {
+            if (lo > 0) lo = 0;
+            if (hi < 0) hi = 0;
+        }
+        if (st.min != lo || st.max != hi || fabs(st.mean - sum / chunk) > 1e-9 * (1 + fabs(st.mean)))
+        {
+            fprintf(stderr, "chunk at %llu: range [%g,%g] mean %g, expected [%g,%g] mean %g\n",
+                (unsigned long long) off, st.min, st.max, st.mean, lo, hi, sum / chunk);
+            ERROR(check_chunk_stats);
+        }
+        if ((cstats & H5Z_ZFP_CSTATS_ERROR) &&
+            (!(st.flags & H5Z_ZFP_CSTATS_ERROR) || st.maxerr < err || st.maxerr > err + 1e-9 * (1 + err)))
+        {
+            fprintf(stderr, "chunk at %llu: maxerr %g, read back differs by %g\n",
+                (unsigned long long) off, st.maxerr, err);
+            ERROR(check_chunk_stats);
+        }
+    }
+    printf("Chunk statistics: %llu chunks indexed\n", (unsigned long long) nchunks);
+
+    H5Tclose(mtype);
+    H5Tclose(atype);
+    H5Dclose(idsid);
+    H5Fclose(fid);
+    free(rbuf);
+    return 0;
+}
+
+/* Check dsid's stored cd_values are in the compact layout, marked "ZC" */
+static int check_compact(hid_t dsid)
+{
+    unsigned int flags, cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    size_t cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX;
+    hid_t dcpl = H5Dget_create_plist(dsid);
+    int nbad = 0 > H5Pget_filter_by_id(dcpl, H5Z_FILTER_ZFP, &flags, &cd_nelmts, cd_values, 0, 0, 0) ||
+               cd_nelmts < 6 || (cd_values[0] & 0xFFFF) < 0x0110 || (cd_values[1] >> 16) != 0x5a43;
+
+    H5Pclose(dcpl);
+    if (!nbad)
+        printf("Compact cd_values: %zu words, version 0x%04x\n", cd_nelmts, cd_values[0] & 0xFFFF);
+    return nbad;
+}
+
+#if H5_VERSION_GE(1,10,3)
+typedef struct _sink_buf_t {
+    char *buf;
+    size_t n, cap;
+    int calls;
+} sink_buf_t;
+
+static int sink_append(void *ctx, void const *bytes, size_t n)
+{
+    sink_buf_t *sb = (sink_buf_t *) ctx;
+
+    if (sb->n + n > sb->cap)
+    {
+        size_t cap = 2 * (sb->n + n);
+        char *p = (char *) realloc(sb->buf, cap);
+        if (!p) return 0;
+        sb->buf = p;
+        sb->cap = cap;
+    }
+    memcpy(sb->buf + sb->n, bytes, n);
+    sb->n += n;
+    sb->calls++;
+    return 1;
+}
+
+/* Compress each chunk of 1D dataset dsid in slabs of slab bytes through a sink,
+   check the result is what H5Z_zfp_encode_chunk and the filter produced and
+   write it back with H5Dwrite_chunk */
+static int check_sink(hid_t dsid, double const *buf, hsize_t chunk, hsize_t npoints, size_t slab)
+{
+    unsigned int flags, cd_values[H5Z_ZFP_CD_NELMTS_MAX];
+    size_t cd_nelmts = H5Z_ZFP_CD_NELMTS_MAX, outsize = 0, stored_size = 0;
+    hsize_t off, nchunks = 0;
+    hid_t dcpl = H5Dget_create_plist(dsid);
+    sink_buf_t sb = {0, 0, 0, 0};
+    void *out = 0, *stored = 0;
+    double *cbuf;
+    int calls = 0;
+
+    if (0 > H5Pget_filter_by_id(dcpl, H5Z_FILTER_ZFP, &flags, &cd_nelmts, cd_values, 0, 0, 0))
+        ERROR(H5Pget_filter_by_id);
+    H5Pclose(dcpl);
+    if (0 == (cbuf = (double *) malloc((size_t) chunk * sizeof(double)))) ERROR(malloc);
+    for (off = 0; off < npoints; off += chunk, nchunks++)
+    {
+        size_t n = (size_t) (npoints - off < chunk ? npoints - off : chunk), zsize, ssize;
+        hsize_t nbytes;
+        uint32_t filters = 0;
+
+        /* edge chunks are padded with the fill value, zero here */
+        memset(cbuf, 0, (size_t) chunk * sizeof(double));
+        memcpy(cbuf, buf + off, n * sizeof(double));
+
+        sb.n = 0;
+        sb.calls = 0;
+        if (0 == (ssize = H5Z_zfp_encode_chunk_sink(cd_nelmts, cd_values, cbuf,
+                              (size_t) chunk * sizeof(double), sink_append, &sb, slab)))
+            ERROR(H5Z_zfp_encode_chunk_sink);
+        if (0 == (zsize = H5Z_zfp_encode_chunk(cd_nelmts, cd_values, cbuf,
+                              (size_t) chunk * sizeof(double), &out, &outsize)))
+            ERROR(H5Z_zfp_encode_chunk);
+        if (0 > H5Dget_chunk_storage_size(dsid, &off, &nbytes)) ERROR(H5Dget_chunk_storage_size);
+        if (nbytes > stored_size)
+        {
+            void *p = realloc(stored, (size_t) nbytes);
+            if (!p) ERROR(realloc);
+            stored = p;
+            stored_size = (size_t) nbytes;
+        }
+        if (0 > H5Dread_chunk(dsid, H5P_DEFAULT, &off, &filters, stored)) ERROR(H5Dread_chunk);
+        if (ssize != sb.n || ssize != zsize || ssize != nbytes ||
+            memcmp(sb.buf, out, zsize) || memcmp(sb.buf, stored, zsize))
+        {
+            fprintf(stderr, "chunk at %llu: sink %zu bytes, encode_chunk %zu, stored %llu\n",
+                (unsigned long long) off, ssize, zsize, (unsigned long long) nbytes);
+            ERROR(check_sink);
+        }
+        if (0 > H5Dwrite_chunk(dsid, H5P_DEFAULT, filters, &off, sb.n, sb.buf)) ERROR(H5Dwrite_chunk);
+        calls += sb.calls;
+    }
+    printf("Sink: %llu chunks in %d pieces, identical to stored\n", (unsigned long long) nchunks, calls);
+
+    free(cbuf);
+    free(out);
+    free(stored);
+    free(sb.buf);
+    return 0;
+}
+#endif
+#endif
 
 int main(int argc, char **argv)
 {
@@ -322,12 +570,27 @@ int main(int argc, char **argv)
     int zfpmode = H5Z_ZFP_MODE_ACCURACY;
     double rate = 4;
     double acc = 0;
+    double ratio = 0;
     uint prec = 11;
     uint minbits = 0;
     uint maxbits = 4171;
     uint maxprec = 64;
     int minexp = -1074;
+    int exec = H5Z_ZFP_EXEC_SERIAL;
+    uint nthreads = 0;
+    int pool = 0;
+    int writer = 0;
+    int ndsets = 0;
+    int vary = 0;
+    uint precond = 0;
+    int predict = 0;
+    uint cstats = 0;
+    int compact = 0;
+    size_t memlimit = 0;
+    size_t sink = 0;
+    int sparse = 0;
     int *ibuf = 0;
+    long long *lbuf = 0;
     double *buf = 0;
 
     /* HDF5 related variables */
@@ -344,20 +607,43 @@ int main(int argc, char **argv)
     HANDLE_ARG(npoints,(hsize_t) strtol(argv[i]+len2,0,10), "%llu",set number of points for generated dataset);
     HANDLE_ARG(noise,(double) strtod(argv[i]+len2,0),"%g",set amount of random noise in generated dataset);
     HANDLE_ARG(amp,(double) strtod(argv[i]+len2,0),"%g",set amplitude of sinusoid in generated dataset);
-    HANDLE_ARG(doint,(int) strtol(argv[i]+len2,0,10),"%d",also do integer data);
-    HANDLE_ARG(highd,(int) strtol(argv[i]+len2,0,10),"%d",run high-dimensional (>3D) case);
+    HANDLE_ARG(doint,(int) strtol(argv[i]+len2,0,10),"%d",also do integer data (2=int64 too));
+    HANDLE_ARG(highd,(int) strtol(argv[i]+len2,0,10),"%d",run high-dimensional case (1=4D,2=4D large chunks,3=5D));
 
     /* HDF5 chunking and ZFP filter arguments */
     HANDLE_ARG(chunk,(hsize_t) strtol(argv[i]+len2,0,10), "%llu",set chunk size for dataset);
-    HANDLE_ARG(zfpmode,(int) strtol(argv[i]+len2,0,10),"%d",set zfp mode (1=rate,2=prec,3=acc,4=expert)); 
+    HANDLE_ARG(zfpmode,(int) strtol(argv[i]+len2,0,10),"%d",set mode (1=rate,2=prec,3=acc,4=expert,5=rev,6=tgt)); 
     HANDLE_ARG(rate,(double) strtod(argv[i]+len2,0),"%g",set rate for rate mode of filter);
     HANDLE_ARG(acc,(double) strtod(argv[i]+len2,0),"%g",set accuracy for accuracy mode of filter);
+    HANDLE_ARG(ratio,(double) strtod(argv[i]+len2,0),"%g",set ratio for target mode (acc is error));
     HANDLE_ARG(prec,(uint) strtol(argv[i]+len2,0,10),"%u",set precision for precision mode of zfp filter);
     HANDLE_ARG(minbits,(uint) strtol(argv[i]+len2,0,10),"%u",set minbits for expert mode of zfp filter);
     HANDLE_ARG(maxbits,(uint) strtol(argv[i]+len2,0,10),"%u",set maxbits for expert mode of zfp filter);
     HANDLE_ARG(maxprec,(uint) strtol(argv[i]+len2,0,10),"%u",set maxprec for expert mode of zfp filter);
     HANDLE_ARG(minexp,(int) strtol(argv[i]+len2,0,10),"%d",set minexp for expert mode of zfp filter);
-    cpid = setup_filter(1, &chunk, zfpmode, rate, acc, prec, minbits, maxbits, maxprec, minexp);
+    HANDLE_ARG(exec,(int) strtol(argv[i]+len2,0,10),"%d",set execution policy (0=serial,1=omp,2=cuda));
+    HANDLE_ARG(nthreads,(uint) strtol(argv[i]+len2,0,10),"%u",set number of threads (0=default));
+    HANDLE_ARG(pool,(int) strtol(argv[i]+len2,0,10),"%d",use filter buffer pool (lib only));
+    HANDLE_ARG(writer,(int) strtol(argv[i]+len2,0,10),"%d",write-behind on N threads (lib only));
+    HANDLE_ARG(ndsets,(int) strtol(argv[i]+len2,0,10),"%d",create N more compressed datasets);
+    HANDLE_ARG(vary,(int) strtol(argv[i]+len2,0,10),"%d",give each of those its own rate (lib only));
+    HANDLE_ARG(precond,(uint) strtol(argv[i]+len2,0,10),"%u",integer pre-conditioning flags (lib only));
+    HANDLE_ARG(predict,(int) strtol(argv[i]+len2,0,10),"%d",check predicted chunk size (lib only));
+    HANDLE_ARG(cstats,(uint) strtol(argv[i]+len2,0,10),"%u",per-chunk statistics flags (lib only));
+    HANDLE_ARG(compact,(int) strtol(argv[i]+len2,0,10),"%d",store compact cd_values (lib only));
+    HANDLE_ARG(memlimit,(size_t) strtoull(argv[i]+len2,0,10),"%zu",cap filter memory per chunk (lib only));
+    HANDLE_ARG(sink,(size_t) strtoull(argv[i]+len2,0,10),"%zu",re-write chunks via sink of N byte slabs (lib only));
+    HANDLE_ARG(sparse,(int) strtol(argv[i]+len2,0,10),"%d",write a dataset with every other chunk left to fill (lib only));
+#ifndef H5Z_ZFP_USE_PLUGIN
+    if (pool) H5Z_zfp_set_buffer_pool(1);
+    if (memlimit) H5Z_zfp_set_memory_limit(memlimit);
+#endif
+    cpid = setup_filter(1, &chunk, zfpmode, rate, acc, ratio, prec, minbits, maxbits, maxprec, minexp, exec, nthreads);
+#ifndef H5Z_ZFP_USE_PLUGIN
+    if (precond) H5Pset_zfp_int_precondition(cpid, precond);
+    if (cstats) H5Pset_zfp_chunk_stats(cpid, cstats);
+    if (compact) H5Pset_zfp_compact_header(cpid, 1);
+#endif
     /* Put this after setup_filter to permit printing of otherwise hard to 
        construct cd_values to facilitate manual invokation of h5repack */
     HANDLE_ARG(help,(int)strtol(argv[i]+len2,0,10),"%d",this help message); /* must be last for help to work */
@@ -372,6 +658,14 @@ int main(int argc, char **argv)
     if (doint)
         gen_data((size_t) npoints, noise*100, amp*1000000, (void**)&ibuf, TYPINT);
 
+    /* and the same as int64, biased so that it needs more than 32 bits */
+    if (doint > 1)
+    {
+        lbuf = (long long *) malloc(npoints * sizeof(long long));
+        for (i = 0; i < (int) npoints; i++)
+            lbuf[i] = (long long) ibuf[i] + (1LL << 40);
+    }
+
     /* create HDF5 file */
     if (0 > (fid = H5Fcreate(ofile, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT))) ERROR(H5Fcreate);
 
@@ -388,36 +682,166 @@ int main(int argc, char **argv)
         if (0 > H5Dwrite(idsid, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, ibuf)) ERROR(H5Dwrite);
         if (0 > H5Dclose(idsid)) ERROR(H5Dclose);
     }
+    if (lbuf)
+    {
+        if (0 > (idsid = H5Dcreate(fid, "int64_original", H5T_NATIVE_LLONG, sid, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT))) ERROR(H5Dcreate);
+        if (0 > H5Dwrite(idsid, H5T_NATIVE_LLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, lbuf)) ERROR(H5Dwrite);
+        if (0 > H5Dclose(idsid)) ERROR(H5Dclose);
+    }
 
     /* write the data with requested compression */
     if (0 > (dsid = H5Dcreate(fid, "compressed", H5T_NATIVE_DOUBLE, sid, H5P_DEFAULT, cpid, H5P_DEFAULT))) ERROR(H5Dcreate);
+#ifndef H5Z_ZFP_USE_PLUGIN
+    if (writer)
+    {
+        if (write_chunks(dsid, buf, sizeof(double), npoints, chunk, writer)) ERROR(write_chunks);
+    }
+    else
+#endif
     if (0 > H5Dwrite(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf)) ERROR(H5Dwrite);
+#ifndef H5Z_ZFP_USE_PLUGIN
+    if (predict && check_predicted_size(dsid, cpid, chunk, npoints)) ERROR(check_predicted_size);
+    if (cstats && check_chunk_stats(dsid, buf, chunk, npoints, cstats)) ERROR(check_chunk_stats);
+    if (compact && check_compact(dsid)) ERROR(check_compact);
+#if H5_VERSION_GE(1,10,3)
+    if (sink && check_sink(dsid, buf, chunk, npoints, sink)) ERROR(check_sink);
+#endif
+#endif
     if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
     if (doint)
     {
         if (0 > (idsid = H5Dcreate(fid, "int_compressed", H5T_NATIVE_INT, sid, H5P_DEFAULT, cpid, H5P_DEFAULT))) ERROR(H5Dcreate);
+#ifndef H5Z_ZFP_USE_PLUGIN
+        if (writer)
+        {
+            if (write_chunks(idsid, ibuf, sizeof(int), npoints, chunk, writer)) ERROR(write_chunks);
+        }
+        else
+#endif
         if (0 > H5Dwrite(idsid, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, ibuf)) ERROR(H5Dwrite);
         if (0 > H5Dclose(idsid)) ERROR(H5Dclose);
     }
+    if (lbuf)
+    {
+        if (0 > (idsid = H5Dcreate(fid, "int64_compressed", H5T_NATIVE_LLONG, sid, H5P_DEFAULT, cpid, H5P_DEFAULT))) ERROR(H5Dcreate);
+        if (0 > H5Dwrite(idsid, H5T_NATIVE_LLONG, H5S_ALL, H5S_ALL, H5P_DEFAULT, lbuf)) ERROR(H5Dwrite);
+        if (0 > H5Dclose(idsid)) ERROR(H5Dclose);
+    }
+
+#ifndef H5Z_ZFP_USE_PLUGIN
+    /* only every other chunk written, the rest left to a fill value at the data's max */
+    if (sparse)
+    {
+        hid_t spid, fsid, msid;
+        hsize_t k, count;
+        double fill = buf[0];
+
+        for (k = 1; k < npoints; k++)
+            if (buf[k] > fill) fill = buf[k];
+        if (0 > (spid = H5Pcopy(cpid))) ERROR(H5Pcopy);
+        if (0 > H5Pset_fill_value(spid, H5T_NATIVE_DOUBLE, &fill)) ERROR(H5Pset_fill_value);
+        if (0 > (dsid = H5Dcreate(fid, "sparse_compressed", H5T_NATIVE_DOUBLE, sid, H5P_DEFAULT, spid, H5P_DEFAULT))) ERROR(H5Dcreate);
+        if (0 > (fsid = H5Dget_space(dsid))) ERROR(H5Dget_space);
+        for (k = 0; k < npoints; k += 2 * chunk)
+        {
+            count = npoints - k < chunk ? npoints - k : chunk;
+            if (0 > (msid = H5Screate_simple(1, &count, 0))) ERROR(H5Screate_simple);
+            if (0 > H5Sselect_hyperslab(fsid, H5S_SELECT_SET, &k, 0, &count, 0)) ERROR(H5Sselect_hyperslab);
+            if (0 > H5Dwrite(dsid, H5T_NATIVE_DOUBLE, msid, fsid, H5P_DEFAULT, buf + k)) ERROR(H5Dwrite);
+            if (0 > H5Sclose(msid)) ERROR(H5Sclose);
+        }
+        if (0 > H5Sclose(fsid)) ERROR(H5Sclose);
+        if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
+        if (0 > H5Pclose(spid)) ERROR(H5Pclose);
+    }
+
+    /* indexed, then the first chunk re-written with values above all others, so
+       queries must see the index is stale */
+    if (cstats)
+    {
+        hid_t fsid, msid;
+        hsize_t k, zero = 0, count = npoints < chunk ? npoints : chunk;
+        double mn = buf[0], mx = buf[0], *cbuf;
+
+        for (k = 1; k < npoints; k++)
+        {
+            if (buf[k] < mn) mn = buf[k];
+            if (buf[k] > mx) mx = buf[k];
+        }
+        if (0 == (cbuf = (double *) malloc(count * sizeof(double)))) ERROR(malloc);
+        for (k = 0; k < count; k++)
+            cbuf[k] = 2 * mx - mn + 1;
+        if (0 > (dsid = H5Dcreate(fid, "rewritten_compressed", H5T_NATIVE_DOUBLE, sid, H5P_DEFAULT, cpid, H5P_DEFAULT))) ERROR(H5Dcreate);
+        if (0 > H5Dwrite(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf)) ERROR(H5Dwrite);
+        if (0 > H5Z_zfp_write_chunk_index(dsid, 0)) ERROR(H5Z_zfp_write_chunk_index);
+        if (0 > (fsid = H5Dget_space(dsid))) ERROR(H5Dget_space);
+        if (0 > (msid = H5Screate_simple(1, &count, 0))) ERROR(H5Screate_simple);
+        if (0 > H5Sselect_hyperslab(fsid, H5S_SELECT_SET, &zero, 0, &count, 0)) ERROR(H5Sselect_hyperslab);
+        if (0 > H5Dwrite(dsid, H5T_NATIVE_DOUBLE, msid, fsid, H5P_DEFAULT, cbuf)) ERROR(H5Dwrite);
+        if (0 > H5Sclose(msid)) ERROR(H5Sclose);
+        if (0 > H5Sclose(fsid)) ERROR(H5Sclose);
+        if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
+        free(cbuf);
+    }
+#endif
+
+    /* many datasets sharing type, chunking and filter settings, all created
+       before any is written and each read back once written */
+    if (ndsets)
+    {
+        hid_t *dsids = (hid_t *) malloc(ndsets * sizeof(hid_t));
+        double *rbuf = (double *) malloc(npoints * sizeof(double));
+        for (i = 0; i < ndsets; i++)
+        {
+            char dsname[32];
+            snprintf(dsname, sizeof(dsname), "compressed_%d", i);
+#ifndef H5Z_ZFP_USE_PLUGIN
+            /* a quarter bit more per value is one more bit per 1D block, so new cd_values */
+            if (vary && 0 > H5Pset_zfp_rate(cpid, rate + 0.25 * i)) ERROR(H5Pset_zfp_rate);
+#endif
+            if (0 > (dsids[i] = H5Dcreate(fid, dsname, H5T_NATIVE_DOUBLE, sid, H5P_DEFAULT, cpid, H5P_DEFAULT))) ERROR(H5Dcreate);
+        }
+        for (i = 0; i < ndsets; i++)
+        {
+            char dsname[32];
+            if (0 > H5Dwrite(dsids[i], H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf)) ERROR(H5Dwrite);
+            if (0 > H5Dclose(dsids[i])) ERROR(H5Dclose);
+
+            /* re-open, so chunks are read from the file, not HDF5's chunk cache */
+            snprintf(dsname, sizeof(dsname), "compressed_%d", i);
+            if (0 > (dsid = H5Dopen(fid, dsname, H5P_DEFAULT))) ERROR(H5Dopen);
+            if (0 > H5Dread(dsid, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, rbuf)) ERROR(H5Dread);
+            if (0 > H5Dclose(dsid)) ERROR(H5Dclose);
+        }
+        free(rbuf);
+        free(dsids);
+    }
 
     /* clean up from simple tests */
     if (0 > H5Sclose(sid)) ERROR(H5Sclose);
     if (0 > H5Pclose(cpid)) ERROR(H5Pclose);
     free(buf);
     if (ibuf) free(ibuf);
+    if (lbuf) free(lbuf);
 
-    /* Test high dimensional (>3D) array */
+    /* Test high dimensional (>3D) array. With highd=2, it is written with 4D
+       chunks of 4 or more in every dimension, which ZFP can compress as 4D.
+       With highd=3, the same data is written as a 5D array with 5D chunks,
+       which the filter folds into 3D. */
     if (highd)
     {
-        int fd, dims[] = {128,128,16,32}, ucdims[]={1,3};
-        hsize_t hdims[] = {128,128,16,32};
-        hsize_t hchunk[] = {1,128,1,32};
+        int dims[] = {128,128,16,32}, ucdims[]={1,3};
+        int hrank = highd > 2 ? 5 : 4;
+        hsize_t hdims4[] = {128,128,16,32}, hchunk4[] = {1,128,1,32}, hchunk4n[] = {4,128,16,32};
+        hsize_t hdims5[] = {8,16,128,16,32}, hchunk5[] = {2,16,8,16,32};
+        hsize_t *hdims = highd > 2 ? hdims5 : hdims4;
+        hsize_t *hchunk = highd > 2 ? hchunk5 : highd > 1 ? hchunk4n : hchunk4;
 
         buf = gen_random_correlated_array(TYPDBL, 4, dims, 2, ucdims);
 
-        cpid = setup_filter(4, hchunk, zfpmode, rate, acc, prec, minbits, maxbits, maxprec, minexp);
+        cpid = setup_filter(hrank, hchunk, zfpmode, rate, acc, ratio, prec, minbits, maxbits, maxprec, minexp, exec, nthreads);
 
-        if (0 > (sid = H5Screate_simple(4, hdims, 0))) ERROR(H5Screate_simple);
+        if (0 > (sid = H5Screate_simple(hrank, hdims, 0))) ERROR(H5Screate_simple);
 
         /* write the data WITHOUT compression */
         if (0 > (dsid = H5Dcreate(fid, "highD_original", H5T_NATIVE_DOUBLE, sid, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT))) ERROR(H5Dcreate);
@@ -442,6 +866,19 @@ int main(int argc, char **argv)
     free(ids);
 
 #ifndef H5Z_ZFP_USE_PLUGIN
+    {
+        unsigned long long resident, peak, hits, misses;
+        H5Z_zfp_stats_t stats;
+        H5Z_zfp_pool_stats(&resident, &peak);
+        printf("Buffer pool: %llu bytes resident, %llu bytes peak\n", resident, peak);
+        H5Z_zfp_memo_stats(&hits, &misses);
+        printf("Header memo: %llu hits, %llu misses\n", hits, misses);
+        H5Z_zfp_get_stats(&stats);
+        if (stats.calls[0])
+            printf("Threaded: %llu of %llu compress calls, %llu of %llu decompress calls\n",
+                stats.threaded[0], stats.calls[0], stats.threaded[1], stats.calls[1]);
+    }
+
     /* When filter is used as a library, we need to finalize it */
     H5Z_zfp_finalize();
 #endif
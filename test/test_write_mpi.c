@@ -0,0 +1,234 @@
+/*
+Copyright (c) 2016, Lawrence Livermore National Security, LLC.
+Produced at the Lawrence Livermore National Laboratory
+Written by Mark C. Miller, miller86@llnl.gov
+LLNL-CODE-707197. All rights reserved.
+
+This file is part of H5Z-ZFP. Please also read the BSD license
+https://raw.githubusercontent.com/LLNL/H5Z-ZFP/master/LICENSE
+*/
+
+/* Weak scaling test of collective writes of ZFP compressed data with
+   parallel HDF5. Each rank writes an nz x ny x nx slab of the same smooth 3D
+   field, stacked along the slowest dimension, so the dataset grows with the
+   number of ranks while the work per rank stays fixed. */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "mpi.h"
+#include "hdf5.h"
+
+#include "H5Zzfp_lib.h"
+#include "H5Zzfp_props.h"
+
+#define NAME_LEN 256
+
+/* convenience macro to handle command-line args and help; only rank 0 prints */
+#define HANDLE_ARG(A,PARSEA,PRINTA,HELPSTR)                     \
+{                                                               \
+    int i;                                                      \
+    char tmpstr[64];                                            \
+    int len;                                                    \
+    int len2 = strlen(#A)+1;                                    \
+    for (i = 0; i < argc; i++)                                  \
+    {                                                           \
+        if (!strncmp(argv[i], #A"=", len2))                     \
+        {                                                       \
+            A = PARSEA;                                         \
+            break;                                              \
+        }                                                       \
+        else if (!strncasecmp(argv[i], "help", 4))              \
+        {                                                       \
+            MPI_Finalize();                                     \
+            return 0;                                           \
+        }                                                       \
+    }                                                           \
+    len = snprintf(tmpstr, sizeof(tmpstr), "%s=" PRINTA, #A, A);\
+    if (!mpi_rank)                                              \
+        printf("    %s%*s\n",tmpstr,60-len,#HELPSTR);           \
+}
+
+/* convenience macro to handle errors; any failing rank takes down all */
+#define ERROR(FNAME)                                              \
+do {                                                              \
+    int _errno = errno;                                           \
+    fprintf(stderr, "rank %d: " #FNAME " failed at line %d, errno=%d (%s)\n", \
+        mpi_rank, __LINE__, _errno, _errno?strerror(_errno):"ok");\
+    MPI_Abort(MPI_COMM_WORLD, 1);                                 \
+    return 1;                                                     \
+} while(0)
+
+/* Samples of a smooth function of the global (z,y,x) position */
+static double field(hsize_t z, hsize_t y, hsize_t x)
+{
+    return 1000 * sin(0.05 * (double) z) * cos(0.07 * (double) y) + 0.1 * (double) x;
+}
+
+int main(int argc, char **argv)
+{
+    int mpi_rank, mpi_size;
+    hsize_t i, n, dims[3], local[3], start[3], chunk[3];
+    hsize_t storage_alloc, storage_written;
+    hid_t fapl, fid, cpid, sid, msid, dsid, dxpl;
+    double *buf, *rbuf, t0, twrite, tmax, maxdiff = 0, gmaxdiff;
+    size_t nlocal;
+
+    /* slab dimensions (per rank) and file arguments */
+    int nx = 64, ny = 64, nz = 64;
+    int chunkz = 32;
+    char *ofile = 0;
+
+    /* ZFP filter arguments */
+    int zfpmode = H5Z_ZFP_MODE_RATE;
+    double rate = 16;
+    int prec = 20;
+    double acc = 0.01;
+    int threads = 0;
+    int prealloc = 1;
+    double max_absdiff = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    ofile = strdup("test_zfp_mpi.h5");
+
+    HANDLE_ARG(ofile,strndup(argv[i]+len2,NAME_LEN), "\"%s\"",set output filename);
+    HANDLE_ARG(nx,(int) strtol(argv[i]+len2,0,10), "%d",slab size along x (fastest) per rank);
+    HANDLE_ARG(ny,(int) strtol(argv[i]+len2,0,10), "%d",slab size along y per rank);
+    HANDLE_ARG(nz,(int) strtol(argv[i]+len2,0,10), "%d",slab size along z (slowest) per rank);
+    HANDLE_ARG(chunkz,(int) strtol(argv[i]+len2,0,10), "%d",chunk size along z (must divide nz));
+    HANDLE_ARG(zfpmode,(int) strtol(argv[i]+len2,0,10), "%d",(1=rate 2=prec 3=acc 5=rev));
+    HANDLE_ARG(rate,(double) strtod(argv[i]+len2,0),"%g",set rate for rate mode);
+    HANDLE_ARG(prec,(int) strtol(argv[i]+len2,0,10), "%d",set precision for precision mode);
+    HANDLE_ARG(acc,(double) strtod(argv[i]+len2,0),"%g",set accuracy for accuracy mode);
+    HANDLE_ARG(threads,(int) strtol(argv[i]+len2,0,10), "%d",compress each chunk on N OpenMP threads);
+    HANDLE_ARG(prealloc,(int) strtol(argv[i]+len2,0,10), "%d",allocate chunks when dataset is created);
+    HANDLE_ARG(max_absdiff,(double) strtod(argv[i]+len2,0),"%g",fail if read back differs by more);
+
+    if (nx < 1 || ny < 1 || nz < 1 || chunkz < 1 || nz % chunkz) ERROR(chunkz);
+
+    H5Z_zfp_initialize();
+
+    /* this rank's slab of the data */
+    local[0] = nz; local[1] = ny; local[2] = nx;
+    start[0] = (hsize_t) mpi_rank * nz; start[1] = 0; start[2] = 0;
+    dims[0] = (hsize_t) mpi_size * nz; dims[1] = ny; dims[2] = nx;
+    nlocal = (size_t) nz * ny * nx;
+    if (0 == (buf = (double *) malloc(nlocal * sizeof(double)))) ERROR(malloc);
+    if (0 == (rbuf = (double *) malloc(nlocal * sizeof(double)))) ERROR(malloc);
+    for (i = 0, n = 0; i < local[0]; i++)
+    {
+        hsize_t j, k;
+        for (j = 0; j < local[1]; j++)
+            for (k = 0; k < local[2]; k++)
+                buf[n++] = field(start[0] + i, j, k);
+    }
+
+    /* chunks never straddle ranks so no two ranks compress the same chunk */
+    chunk[0] = chunkz; chunk[1] = ny; chunk[2] = nx;
+
+    if (0 > (fapl = H5Pcreate(H5P_FILE_ACCESS))) ERROR(H5Pcreate);
+    if (0 > H5Pset_fapl_mpio(fapl, MPI_COMM_WORLD, MPI_INFO_NULL)) ERROR(H5Pset_fapl_mpio);
+    if (0 > (fid = H5Fcreate(ofile, H5F_ACC_TRUNC, H5P_DEFAULT, fapl))) ERROR(H5Fcreate);
+
+    if (0 > (cpid = H5Pcreate(H5P_DATASET_CREATE))) ERROR(H5Pcreate);
+    if (0 > H5Pset_chunk(cpid, 3, chunk)) ERROR(H5Pset_chunk);
+    if (zfpmode == H5Z_ZFP_MODE_RATE) H5Pset_zfp_rate(cpid, rate);
+    else if (zfpmode == H5Z_ZFP_MODE_PRECISION) H5Pset_zfp_precision(cpid, (unsigned int) prec);
+    else if (zfpmode == H5Z_ZFP_MODE_ACCURACY) H5Pset_zfp_accuracy(cpid, acc);
+    else if (zfpmode == H5Z_ZFP_MODE_REVERSIBLE) H5Pset_zfp_reversible(cpid);
+    else ERROR(zfpmode);
+    if (threads > 1)
+        H5Pset_zfp_execution(cpid, H5Z_ZFP_EXEC_OMP, (unsigned int) threads, 0);
+
+    /* In fixed-rate mode, every chunk, including the fill value chunk HDF5
+       compresses to allocate space, has the same compressed size. So, space
+       allocated collectively when the dataset is created is never resized. */
+    if (prealloc)
+    {
+        if (0 > H5Pset_alloc_time(cpid, H5D_ALLOC_TIME_EARLY)) ERROR(H5Pset_alloc_time);
+        if (0 > H5Pset_fill_time(cpid, H5D_FILL_TIME_ALLOC)) ERROR(H5Pset_fill_time);
+    }
+
+    if (0 > (sid = H5Screate_simple(3, dims, 0))) ERROR(H5Screate_simple);
+    if (0 > (dsid = H5Dcreate(fid, "compressed", H5T_NATIVE_DOUBLE, sid, H5P_DEFAULT, cpid, H5P_DEFAULT)))
+        ERROR(H5Dcreate);
+    storage_alloc = H5Dget_storage_size(dsid);
+
+    if (0 > H5Sselect_hyperslab(sid, H5S_SELECT_SET, start, 0, local, 0)) ERROR(H5Sselect_hyperslab);
+    if (0 > (msid = H5Screate_simple(3, local, 0))) ERROR(H5Screate_simple);
+
+    /* filtered datasets can be written in parallel only collectively */
+    if (0 > (dxpl = H5Pcreate(H5P_DATASET_XFER))) ERROR(H5Pcreate);
+    if (0 > H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE)) ERROR(H5Pset_dxpl_mpio);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    if (0 > H5Dwrite(dsid, H5T_NATIVE_DOUBLE, msid, sid, dxpl, buf)) ERROR(H5Dwrite);
+    if (0 > H5Fflush(fid, H5F_SCOPE_GLOBAL)) ERROR(H5Fflush);
+    twrite = MPI_Wtime() - t0;
+    MPI_Reduce(&twrite, &tmax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    storage_written = H5Dget_storage_size(dsid);
+
+    /* read back this rank's slab */
+    if (0 > H5Dread(dsid, H5T_NATIVE_DOUBLE, msid, sid, dxpl, rbuf)) ERROR(H5Dread);
+    for (n = 0; n < nlocal; n++)
+    {
+        double d = fabs(rbuf[n] - buf[n]);
+        if (d > maxdiff) maxdiff = d;
+    }
+    MPI_Allreduce(&maxdiff, &gmaxdiff, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+    if (!mpi_rank)
+    {
+        double mb = (double) nlocal * sizeof(double) / (1 << 20);
+        printf("ranks %d, %g MB per rank, write %g s, %g MB/s aggregate, %g MB/s per rank\n",
+            mpi_size, mb, tmax, tmax > 0 ? mb * mpi_size / tmax : 0, tmax > 0 ? mb / tmax : 0);
+        printf("stored %llu bytes (ratio %g), %llu bytes allocated at create, max absdiff %g\n",
+            (unsigned long long) storage_written,
+            storage_written ? (double) nlocal * mpi_size * sizeof(double) / storage_written : 0,
+            (unsigned long long) storage_alloc, gmaxdiff);
+    }
+
+    H5Pclose(dxpl);
+    H5Sclose(msid);
+    H5Dclose(dsid);
+    H5Sclose(sid);
+    H5Pclose(cpid);
+    H5Fclose(fid);
+    H5Pclose(fapl);
+
+    free(buf);
+    free(rbuf);
+    free(ofile);
+
+    H5Z_zfp_finalize();
+
+    if (max_absdiff > 0 && gmaxdiff > max_absdiff)
+    {
+        if (!mpi_rank)
+            fprintf(stderr, "max absdiff %g exceeds %g\n", gmaxdiff, max_absdiff);
+        MPI_Finalize();
+        return 1;
+    }
+
+    /* with chunks allocated up front, a fixed-rate write must not resize them */
+    if (prealloc && zfpmode == H5Z_ZFP_MODE_RATE && storage_alloc != storage_written)
+    {
+        if (!mpi_rank)
+            fprintf(stderr, "fixed-rate chunks resized from %llu to %llu bytes\n",
+                (unsigned long long) storage_alloc, (unsigned long long) storage_written);
+        MPI_Finalize();
+        return 1;
+    }
+
+    MPI_Finalize();
+
+    return 0;
+}